@@ -19,6 +19,7 @@
 #include "espnow.h"
 #include "indicator.h"
 #include "kb_matrix.h"
+#include "kb_mgt.h"
 #include "nimble/nimble_port.h"
 
 static const char *TAG = "GAP";
@@ -218,6 +219,8 @@ static int gap_event_cb(struct ble_gap_event *event, void *arg)
       {
         ESP_LOGW(TAG, "Failed to request low latency params; rc=%d", rc);
       }
+      // NKRO only once the MTU fits it, the event below tells when it does
+      kb_mgt_hid_set_mtu(ble_att_mtu(event->connect.conn_handle));
       matrix_scan_start();
       bool conn_state = true;
       send_to_espnow(MASTER, CONN, &conn_state);
@@ -265,6 +268,7 @@ static int gap_event_cb(struct ble_gap_event *event, void *arg)
   case BLE_GAP_EVENT_MTU:
     ESP_LOGI(TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d",
              event->mtu.conn_handle, event->mtu.channel_id, event->mtu.value);
+    kb_mgt_hid_set_mtu(event->mtu.value);
     return 0;
 
   case BLE_GAP_EVENT_ENC_CHANGE:
@@ -285,6 +289,10 @@ static int gap_event_cb(struct ble_gap_event *event, void *arg)
                 "status=%d is_indication=%d",
                 event->notify_tx.conn_handle, event->notify_tx.attr_handle,
                 event->notify_tx.status, event->notify_tx.indication);
+    if (!event->notify_tx.indication)
+    {
+      kb_mgt_hid_tx_done();
+    }
     return 0;
 
   case BLE_GAP_EVENT_REPEAT_PAIRING:
@@ -4,7 +4,9 @@
 
 #include "common.h"
 
-#define IS_MASTER 1
+#ifndef IS_MASTER
+#define IS_MASTER 1 // Right half; the host tests build both halves
+#endif
 
 #define MATRIX_ROW 5
 #define MATRIX_COL 6
@@ -24,14 +26,37 @@
 
 // Ultra Low Latency Configuration
 #define DEBOUNCE_TIME_MS 4 // Minimal debounce == Less latecy
+#define DEBOUNCE_ALGORITHM                                                     \
+  DEBOUNCE_ASYM_EAGER_DEFER // Eager press, deferred release (see debounce.h)
 #define DEFAULT_TIMEOUT_MS                                                     \
   120                      // Optimized for quick typing (reduced from 150ms)
-#define SCAN_INTERVAL_MS 1 // aggressive polling == Less latency
-
-// Optimized GPIO timing for speed
+#define SCAN_TIMER_RESOLUTION_HZ                                               \
+  1000000 // Scan clock ticks in microseconds (see power_config_t)
+
+// Tap-hold decisions (hold_tap_flavor_t in keymap.h). A tap-hold key pressed
+// again within the quick-tap window of its last tap taps right away, so
+// holding it auto-repeats. One held past its timeout without another key
+// pressed still taps if released within the retro-tap window. A mod-tap key
+// pressed within the prior-idle window of the previous key press, and not
+// after a pause well past the current cadence, is typing: it taps right away.
+#define HOLD_TAP_FLAVOR        HOLD_TAP_TAP_PREFERRED // Keys without their own
+#define HOLD_TAP_QUICK_TAP_MS  150                    // 0 = off
+#define HOLD_TAP_RETRO_TAP_MS  0                      // 0 = off
+#define HOLD_TAP_PRIOR_IDLE_MS 100                    // 0 = off
+
+// Combos (keymap_combos in keymap.c): keys that are part of one wait at most
+// this long for the rest of it, other keys are never delayed
+#define COMBO_TERM_MS 40
+
+// GPIO timing fallbacks, replaced at boot by measured values (kb_matrix.c)
 #define GPIO_SETTLE_US 5 // Minimal stable GPIO settling
 #define ROW_DELAY_US   2 // Minimal row completion delay
 
+// Matrix scan backend
+#define MATRIX_BACKEND_GPIO  0 // gpio_set_level()/gpio_get_level() per pin
+#define MATRIX_BACKEND_DEDIC 1 // Dedicated GPIO bundles, one access per row
+#define MATRIX_SCAN_BACKEND  MATRIX_BACKEND_DEDIC
+
 // Wireless Configuration
 #define ESP_NOW_CHANNEL 1
 #define MAX_RETRY_COUNT 3
@@ -49,21 +74,29 @@
 // HID Configuration
 #define HID_DEVICE_NAME  "CureProWL"
 #define HID_MANUFACTURER "Kppras"
+#define HID_NKRO_ENABLE  1 // 0 = always send the 6KRO boot-compatible report
+#define HID_TX_FIFO_SIZE 8 // Key reports queued behind the BLE link
+#define HID_TX_CREDITS   1 // Notifications in flight before reports coalesce
+#define HID_TX_STALL_MS  50 // Reclaim a credit if NOTIFY_TX never arrives
+#define HID_TX_RETRY_MS  5  // Retry a report the BLE stack refused
+#define MACRO_QUEUE_SIZE 4  // Macro keys pressed while another one plays
 
 #define MATRIX_TASK_STACK_SIZE    4096 // Matrix scaning task
 #define ESPNOW_TASK_STACK_SIZE    4096 // ESPNOW task sending between havles
 #define POWER_TASK_STACK_SIZE     2048 // Power task management
 #define HEARTBEAT_TASK_STACK_SIZE 2048 // Heartbeat task
 #define INDICATOR_TASK_STACK_SIZE 4096 // Power task management
+#define KB_MGT_TASK_STACK_SIZE    4096 // Key processing task
 
 #define MATRIX_SCAN_PRIORITY 7
+#define KB_MGT_PRIORITY      6 // Key processing, just below scanning
 #define ESPNOW_PRIORITY      4
 #define POWER_PRIORITY       3
 #define HEARTBEAT_PRIORITY   2 // Heartbeat task
 #define INDICATOR_PRIORITY   1 // Connection and battery indicator
 
 // Keyboard Layer Configuration
-#define MAX_LAYERS    3
+#define MAX_LAYERS    3 // Up to 32, layer state is a bitmask
 #define DEFAULT_LAYER 0
 
 #if IS_MASTER
@@ -76,4 +109,11 @@
 #define ESP_NOW_CHANNEL    1
 #define ESP_NOW_QUEUE_SIZE 6
 
+// Key processing inboxes
+#define KEY_EVENT_RING_SIZE 64 // Scan -> kb_mgt events, power of two
+// Remote half -> kb_mgt key events and brief taps, enough for every key of
+// the other half pressed and released. Its key reports, layers and pending
+// state take no room here (kb_mgt_post_remote).
+#define KB_MGT_INBOX_SIZE (2 * MAX_KEYS)
+
 #endif // CONFIG_H
@@ -0,0 +1,231 @@
+/**
+ * @file debounce.c
+ * @brief Matrix Debounce Engine
+ *
+ * Turns raw matrix samples into debounced key state. Works on whole-half
+ * bitboards, so keys that are not changing cost nothing per scan.
+ *
+ * Timing uses one small saturating counter per key, stored bit-sliced across
+ * DEBOUNCE_COUNTER_BITS words (plane i holds bit i of every key's counter).
+ * A counter holds the milliseconds since the key's last raw edge or lockout
+ * start, so every key is advanced or cleared with a few bitwise operations per
+ * scan instead of a timestamp per key.
+ *
+ * Algorithms:
+ * - Symmetric defer: report a change once the raw level has been stable for
+ *   DEBOUNCE_TIME_MS
+ * - Per-key eager: report the first edge immediately, then ignore the key for
+ *   DEBOUNCE_TIME_MS
+ * - Asymmetric: eager on press, deferred on release
+ */
+
+#include "debounce.h"
+
+static const char *TAG = "DEBOUNCE";
+
+// Enough counter bits to hold DEBOUNCE_TIME_MS
+#if DEBOUNCE_TIME_MS < 2
+#define DEBOUNCE_COUNTER_BITS 1
+#elif DEBOUNCE_TIME_MS < 4
+#define DEBOUNCE_COUNTER_BITS 2
+#elif DEBOUNCE_TIME_MS < 8
+#define DEBOUNCE_COUNTER_BITS 3
+#elif DEBOUNCE_TIME_MS < 16
+#define DEBOUNCE_COUNTER_BITS 4
+#else
+#error "DEBOUNCE_TIME_MS too large for the debounce counters"
+#endif
+
+// =============================================================================
+// STATE VARIABLES
+// =============================================================================
+
+static struct
+{
+  debounce_algo_t algo;
+  matrix_bits_t   raw;    // Last raw sample
+  matrix_bits_t   cooked; // Debounced state
+  matrix_bits_t   locked; // Eager keys inside their lockout window
+  matrix_bits_t   count[DEBOUNCE_COUNTER_BITS]; // Bit-sliced counters
+  time_us_t       last_us; // Time the counters were last advanced to
+} state;
+
+// =============================================================================
+// FORWARD DECLARATIONS
+// =============================================================================
+
+static matrix_bits_t counter_full(void);
+static void          counter_clear(matrix_bits_t keys);
+static void          counter_advance(time_us_t now_us);
+static void          track_raw(matrix_bits_t raw);
+static void          update_sym_defer(matrix_bits_t raw);
+static void          update_sym_eager_pk(matrix_bits_t raw);
+static void          update_asym_eager_defer(matrix_bits_t raw);
+static const char *algo_to_string(debounce_algo_t algo);
+
+// =============================================================================
+// PUBLIC API
+// =============================================================================
+
+esp_err_t debounce_init(debounce_algo_t algo)
+{
+  memset(&state, 0, sizeof(state));
+  state.algo = algo;
+
+  ESP_LOGI(TAG, "Debounce initialized: %s, %dms", algo_to_string(algo),
+           DEBOUNCE_TIME_MS);
+  return ESP_OK;
+}
+
+void debounce_set_algo(debounce_algo_t algo)
+{
+  // Keep the reported state, restart any window in flight
+  state.algo = algo;
+  state.locked = 0;
+  state.raw = state.cooked;
+
+  ESP_LOGI(TAG, "Debounce algorithm: %s", algo_to_string(algo));
+}
+
+debounce_algo_t debounce_get_algo(void) { return state.algo; }
+
+matrix_bits_t debounce_update(matrix_bits_t raw, time_us_t now_us)
+{
+  // Nothing moved and nothing settling: no algorithm can change the state,
+  // and the counters of keys that are not settling are never read
+  if (raw == state.raw && !debounce_is_settling())
+  {
+    return state.cooked;
+  }
+
+  counter_advance(now_us);
+
+  switch (state.algo)
+  {
+  case DEBOUNCE_SYM_DEFER:
+    update_sym_defer(raw);
+    break;
+  case DEBOUNCE_SYM_EAGER_PK:
+    update_sym_eager_pk(raw);
+    break;
+  case DEBOUNCE_ASYM_EAGER_DEFER:
+    update_asym_eager_defer(raw);
+    break;
+  }
+
+  return state.cooked;
+}
+
+bool debounce_is_settling(void)
+{
+  return ((state.raw ^ state.cooked) | state.locked) != 0;
+}
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - SWAR COUNTERS
+// =============================================================================
+
+// Keys whose counter reached DEBOUNCE_TIME_MS
+static matrix_bits_t counter_full(void)
+{
+  matrix_bits_t full = MATRIX_KEYS_MASK;
+
+  for (int i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+  {
+    full &= (DEBOUNCE_TIME_MS >> i) & 1 ? state.count[i] : ~state.count[i];
+  }
+
+  return full;
+}
+
+static void counter_clear(matrix_bits_t keys)
+{
+  for (int i = 0; i < DEBOUNCE_COUNTER_BITS; i++)
+  {
+    state.count[i] &= ~keys;
+  }
+}
+
+// Add the whole milliseconds since the last advance to every counter,
+// saturating at DEBOUNCE_TIME_MS. The sub-millisecond remainder carries over
+// to the next update so fast scan rates still count real time.
+static void counter_advance(time_us_t now_us)
+{
+  uint32_t ticks = time_elapsed_us(now_us, state.last_us) / 1000;
+
+  if (ticks > DEBOUNCE_TIME_MS)
+  {
+    ticks = DEBOUNCE_TIME_MS;
+    state.last_us = now_us;
+  }
+  else
+  {
+    state.last_us += TIME_MS_TO_US(ticks);
+  }
+
+  while (ticks--)
+  {
+    // Ripple-carry increment of all non-saturated counters at once
+    matrix_bits_t carry = MATRIX_KEYS_MASK & ~counter_full();
+
+    for (int i = 0; i < DEBOUNCE_COUNTER_BITS && carry; i++)
+    {
+      matrix_bits_t next = state.count[i] & carry;
+      state.count[i] ^= carry;
+      carry = next;
+    }
+  }
+}
+
+// Restart the window of every key whose raw level moved
+static void track_raw(matrix_bits_t raw)
+{
+  counter_clear(raw ^ state.raw);
+  state.raw = raw;
+}
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - ALGORITHMS
+// =============================================================================
+
+static void update_sym_defer(matrix_bits_t raw)
+{
+  track_raw(raw);
+  state.cooked ^= (state.raw ^ state.cooked) & counter_full();
+}
+
+static void update_sym_eager_pk(matrix_bits_t raw)
+{
+  state.raw = raw;
+  state.locked &= ~counter_full();
+
+  matrix_bits_t changed = (raw ^ state.cooked) & ~state.locked;
+  state.cooked ^= changed;
+  state.locked |= changed;
+  counter_clear(changed);
+}
+
+static void update_asym_eager_defer(matrix_bits_t raw)
+{
+  track_raw(raw);
+
+  // Presses go out on the first edge; the deferred release already filters
+  // the bounce that follows
+  state.cooked |= raw;
+  state.cooked &= ~(~raw & counter_full());
+}
+
+static const char *algo_to_string(debounce_algo_t algo)
+{
+  switch (algo)
+  {
+  case DEBOUNCE_SYM_DEFER:
+    return "SYM_DEFER";
+  case DEBOUNCE_SYM_EAGER_PK:
+    return "SYM_EAGER_PK";
+  case DEBOUNCE_ASYM_EAGER_DEFER:
+    return "ASYM_EAGER_DEFER";
+  default:
+    return "UNKNOWN";
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include "common.h"
+#include "config.h"
+#include "kb_matrix.h"
+
+// Debounce algorithms
+typedef enum
+{
+  DEBOUNCE_SYM_DEFER,       // Report once the raw level is stable for the window
+  DEBOUNCE_SYM_EAGER_PK,    // Report the first edge, then lock the key out
+  DEBOUNCE_ASYM_EAGER_DEFER // Eager press, deferred release
+} debounce_algo_t;
+
+// Initialize debounce state with the given algorithm
+esp_err_t debounce_init(debounce_algo_t algo);
+
+// Switch algorithm at run time (debounced state is kept)
+void            debounce_set_algo(debounce_algo_t algo);
+debounce_algo_t debounce_get_algo(void);
+
+// Feed one raw matrix sample, returns the debounced matrix state
+matrix_bits_t debounce_update(matrix_bits_t raw, time_us_t now_us);
+
+// True while any key is waiting out a debounce window or lockout
+bool debounce_is_settling(void);
+
+#endif // DEBOUNCE_H
@@ -9,7 +9,7 @@
  * Key responsibilities:
  * - ESP-NOW initialization and peer management
  * - Message transmission between keyboard halves
- * - Event processing (key reports, layer sync, modifiers, heartbeat)
+ * - Event processing (key reports, layer sync, heartbeat)
  * - WiFi configuration for optimal BLE coexistence (master only)
  */
 
@@ -26,8 +26,14 @@ static const char *TAG = "ESPNOW";
 // STATE VARIABLES
 // =============================================================================
 
-static TaskHandle_t  task_hdl = NULL;
-static QueueHandle_t espnow_queue = NULL;
+static TaskHandle_t      task_hdl = NULL;
+static QueueHandle_t     espnow_queue = NULL;
+static SemaphoreHandle_t tx_lock = NULL; // Keeps sequence and send order equal
+
+// Frames are numbered in the order esp_now_send() queued them. The driver
+// reports them back in that order, so the Nth send callback is frame N.
+static uint32_t tx_seq = 0; // Last frame queued
+static uint32_t cb_seq = 0; // Last frame reported, WiFi task only
 
 // =============================================================================
 // FORWARD DECLARATIONS
@@ -38,6 +44,7 @@ static void recv_cb(const esp_now_recv_info_t *esp_now_info,
 static void send_cb(const esp_now_send_info_t *tx_info,
                     esp_now_send_status_t      status);
 static void task(void *pvParameters);
+static uint32_t next_seq(uint32_t seq);
 
 // =============================================================================
 // PUBLIC API - INITIALIZATION
@@ -102,6 +109,13 @@ esp_err_t espnow_init(void)
   ret = esp_now_init();
   ESP_ERROR_CHECK(ret);
 
+  tx_lock = xSemaphoreCreateMutex();
+  if (!tx_lock)
+  {
+    ESP_LOGE(TAG, "Failed to create tx lock");
+    return ESP_FAIL;
+  }
+
   ret = esp_now_register_recv_cb(recv_cb);
   ESP_ERROR_CHECK(ret);
 
@@ -136,10 +150,11 @@ esp_err_t espnow_init(void)
 // PUBLIC API - MESSAGE TRANSMISSION
 // =============================================================================
 
-void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
-                    void *data)
+uint32_t send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
+                        void *data)
 {
   esp_err_t ret;
+  uint32_t  seq = 0;
   uint8_t   espnow_peer_addr[] = ESPNOW_PEER_ADDR;
 
   espnow_event_info_data_t *info_data;
@@ -147,7 +162,7 @@ void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
   if (!info_data)
   {
     ESP_LOGE(TAG, "failed to allocate data");
-    return;
+    return 0;
   }
 
   info_data->from = from;
@@ -172,14 +187,15 @@ void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
     break;
 
   case LAYER_SYNC:
-  case LAYER_DESYNC:
-    info_data->layer = *(uint8_t *)data;
+    info_data->layer_mask = *(uint32_t *)data;
     break;
 
-  case MOD_SYNC:
-  case MOD_DESYNC:
-    memcpy(&info_data->key_report, (kb_mgt_hid_key_report_t *)data,
-           sizeof(kb_mgt_hid_key_report_t));
+  case KEY_EVENT:
+    info_data->key_event = *(kb_comm_key_event_t *)data;
+    break;
+
+  case HOLD_PENDING:
+    info_data->hold_pending_ms = *(uint16_t *)data;
     break;
 
   case REQ_HEARTBEAT:
@@ -192,8 +208,15 @@ void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
     break;
   }
 
+  xSemaphoreTake(tx_lock, portMAX_DELAY);
   ret = esp_now_send(espnow_peer_addr, (uint8_t *)info_data,
                      sizeof(espnow_event_info_data_t));
+  if (ret == ESP_OK)
+  {
+    tx_seq = next_seq(tx_seq);
+    seq = tx_seq;
+  }
+  xSemaphoreGive(tx_lock);
 
   if (info_data)
   {
@@ -204,8 +227,13 @@ void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
   {
     ESP_LOGE(TAG, "Failed to send data to destination, ret: %d", ret);
   }
+
+  return seq;
 }
 
+// Sequence numbers skip 0, which marks a frame that was never queued
+static uint32_t next_seq(uint32_t seq) { return seq + 1 ? seq + 1 : 1; }
+
 // =============================================================================
 // PRIVATE IMPLEMENTATIONS - ESP-NOW CALLBACKS
 // =============================================================================
@@ -243,14 +271,11 @@ static void send_cb(const esp_now_send_info_t *tx_info,
   espnow_send_cb_t *send_cb = &event.info.send_cb;
 
   memcpy(send_cb->to, tx_info->des_addr, ESP_NOW_ETH_ALEN);
-
-  if (status != ESP_NOW_SEND_SUCCESS)
-  {
-    ESP_LOGE(TAG, "Failed to send event to destination, status: %d", status);
-    return;
-  }
-
+  cb_seq = next_seq(cb_seq);
+  send_cb->seq = cb_seq;
   send_cb->status = status;
+
+  // Failures are posted too: the slave resends a lost macro report
   xQueueSend(espnow_queue, &event, portMAX_DELAY);
 }
 
@@ -307,6 +332,7 @@ static void task(void *pvParameters)
     {
       espnow_recv_cb_t         *recv_cb = &event.info.recv_cb;
       espnow_event_info_data_t *data = recv_cb->data;
+      kb_mgt_remote_msg_t       msg;
 
       ESP_LOGI(TAG, "Received data from: %d", data->from);
 
@@ -348,23 +374,21 @@ static void task(void *pvParameters)
         // -----------------------------------------------------------------------
 #if IS_MASTER
       case TAP:
-        memcpy(kb_mgt_hid_get_current_key_report(), &data->key_report,
-               sizeof(kb_mgt_hid_key_report_t));
-        kb_mgt_hid_send_key_report_unsafe();
+        msg.type = KB_MGT_REMOTE_KEY_REPORT;
+        msg.key_report = data->key_report;
+        kb_mgt_post_remote(&msg);
         break;
 
       case BRIEF_TAP:
-        memcpy(kb_mgt_hid_get_current_key_report(), &data->key_report,
-               sizeof(kb_mgt_hid_key_report_t));
-        kb_mgt_hid_send_key_report_unsafe();
-        kb_mgt_hid_clear_report();
-        kb_mgt_hid_send_key_report_unsafe();
+        msg.type = KB_MGT_REMOTE_BRIEF_TAP;
+        msg.key_report = data->key_report;
+        kb_mgt_post_remote(&msg);
         break;
 
       case CONSUMER:
-        memcpy(kb_mgt_hid_get_current_consumer_report(), &data->consumer_report,
-               sizeof(kb_mgt_hid_consumer_report_t));
-        kb_mgt_hid_send_consumer_report_unsafe();
+        msg.type = KB_MGT_REMOTE_CONSUMER;
+        msg.consumer_report = data->consumer_report;
+        kb_mgt_post_remote(&msg);
         break;
 
       case REQ_HEARTBEAT:
@@ -376,21 +400,28 @@ static void task(void *pvParameters)
       // SHARED MESSAGE HANDLERS (both master and slave)
       // -----------------------------------------------------------------------
       case LAYER_SYNC:
-        ESP_LOGI(TAG, "Layer sync to %d", data->layer);
-        kb_mgt_sync_layer(data->layer);
+        ESP_LOGI(TAG, "Layer sync to 0x%08lx", data->layer_mask);
+        msg.type = KB_MGT_REMOTE_LAYER_SYNC;
+        msg.layer_mask = data->layer_mask;
+        kb_mgt_post_remote(&msg);
         break;
 
-      case LAYER_DESYNC:
-        ESP_LOGI(TAG, "Layer desync from %d", data->layer);
-        kb_mgt_desync_layer(data->layer);
+      case KEY_EVENT:
+        // Onto our clock now, before the inbox adds its own delay
+        msg.type = KB_MGT_REMOTE_KEY_EVENT;
+        msg.key_event = (key_event_t){
+            .row = PROC_REMOTE_ROW,
+            .col = data->key_event.pos,
+            .pressed = data->key_event.pressed,
+            .timestamp = get_current_time_us() - data->key_event.age_us,
+        };
+        kb_mgt_post_remote(&msg);
         break;
 
-      case MOD_SYNC:
-        kb_mgt_sync_modifier(data->key_report.modifiers);
-        break;
-
-      case MOD_DESYNC:
-        kb_mgt_desync_modifier(data->key_report.modifiers);
+      case HOLD_PENDING:
+        msg.type = KB_MGT_REMOTE_HOLD_PENDING;
+        msg.hold_pending_ms = data->hold_pending_ms;
+        kb_mgt_post_remote(&msg);
         break;
 
       default:
@@ -406,8 +437,24 @@ static void task(void *pvParameters)
     }
 
     case EVENT_SEND_CB:
-      ESP_LOGI(TAG, "Message sent successfully to destination");
+    {
+      espnow_send_cb_t *send_cb = &event.info.send_cb;
+      bool              delivered = send_cb->status == ESP_NOW_SEND_SUCCESS;
+
+      if (delivered)
+      {
+        ESP_LOGD(TAG, "Frame %lu delivered", send_cb->seq);
+      }
+      else
+      {
+        ESP_LOGW(TAG, "Frame %lu not delivered, status: %d", send_cb->seq,
+                 send_cb->status);
+      }
+#if !IS_MASTER
+      kb_mgt_link_tx_done(send_cb->seq, delivered);
+#endif
       break;
+    }
 
     default:
       ESP_LOGW(TAG, "Unknown event type: %d", event.type);
@@ -15,14 +15,14 @@ typedef enum
   BRIEF_TAP,
   // Syncronization messages
   LAYER_SYNC,
-  LAYER_DESYNC,
-  MOD_SYNC,
-  MOD_DESYNC,
   // Heartbeat
   REQ_HEARTBEAT,
   RES_HEARTBEAT,
   // Consumer control
   CONSUMER,
+  // Hold-tap decisions across halves
+  KEY_EVENT,
+  HOLD_PENDING,
 } espnow_event_info_data_type_t;
 
 typedef enum
@@ -42,9 +42,11 @@ typedef struct
       kb_mgt_hid_consumer_report_t consumer_report;
       kb_mgt_hid_key_report_t      key_report;
     };
-    uint8_t layer;
-    bool    conn;
-    bool    alive;
+    kb_comm_key_event_t key_event;
+    uint32_t            layer_mask;
+    bool                conn;
+    bool                alive;
+    uint16_t            hold_pending_ms;
   };
 } espnow_event_info_data_t;
 
@@ -56,8 +58,9 @@ typedef enum
 
 typedef struct
 {
-  uint8_t status;
-  uint8_t to[ESP_NOW_ETH_ALEN];
+  uint32_t seq; // Number send_to_espnow() returned for the frame
+  uint8_t  status;
+  uint8_t  to[ESP_NOW_ETH_ALEN];
 } espnow_send_cb_t;
 
 typedef struct
@@ -85,7 +88,9 @@ typedef struct
 
 esp_err_t espnow_init(void);
 
-void send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
-                    void *data);
+// Queue a frame for the other half. Returns its sequence number, matched by
+// the EVENT_SEND_CB that reports its delivery, or 0 if it was not queued.
+uint32_t send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
+                        void *data);
 
 #endif // ESPNOW_H
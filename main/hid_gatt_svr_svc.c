@@ -1,5 +1,6 @@
 #include "hid_gatt_svr_svc.h"
 #include "kb_matrix.h"
+#include "kb_mgt.h"
 
 static const char *TAG = "HID_SVC";
 
@@ -103,7 +104,43 @@ const unsigned char HID_REPORT_MAPS[] = {
     0x81,
     0x00, //   Input (Data,Array,Abs)
     0xC0, // End Collection
-    // Total: 67 + 25 = 92 bytes (updated: extended keyboard usage to 0xE7)
+
+    // NKRO keyboard report (Report ID 5) - 30 bytes input
+    // Modifier byte followed by one bit per usage 0x00-0xE7
+    0x05,
+    0x01, // Usage Page (Generic Desktop Ctrls)
+    0x09,
+    0x06, // Usage (Keyboard)
+    0xA1,
+    0x01, // Collection (Application)
+    0x85,
+    0x05, //   Report ID (5)
+    0x05,
+    0x07, //   Usage Page (Kbrd/Keypad)
+    0x19,
+    0xE0, //   Usage Minimum (0xE0)
+    0x29,
+    0xE7, //   Usage Maximum (0xE7)
+    0x15,
+    0x00, //   Logical Minimum (0)
+    0x25,
+    0x01, //   Logical Maximum (1)
+    0x75,
+    0x01, //   Report Size (1)
+    0x95,
+    0x08, //   Report Count (8)
+    0x81,
+    0x02, //   Input (Data,Var,Abs)
+    0x19,
+    0x00, //   Usage Minimum (0x00)
+    0x29,
+    0xE7, //   Usage Maximum (0xE7)
+    0x95,
+    0xE8, //   Report Count (232)
+    0x81,
+    0x02, //   Input (Data,Var,Abs)
+    0xC0, // End Collection
+    // Total: 67 + 25 + 33 = 125 bytes
 };
 
 static esp_hid_raw_report_map_t hid_report_maps[] = {
@@ -119,12 +156,39 @@ static esp_hid_device_config_t ble_hid_config = {.vendor_id = 0x16C0,
                                                  .report_maps = hid_report_maps,
                                                  .report_maps_len = 1};
 
+static void hidd_event_callback(void *handler_args, esp_event_base_t base,
+                                int32_t id, void *event_data)
+{
+  esp_hidd_event_data_t *param = (esp_hidd_event_data_t *)event_data;
+
+  switch ((esp_hidd_event_t)id)
+  {
+  case ESP_HIDD_CONNECT_EVENT:
+    // Every new connection starts in report protocol
+    s_ble_hid_param.protocol_mode = ESP_HID_PROTOCOL_MODE_REPORT;
+    kb_mgt_hid_set_protocol_mode(s_ble_hid_param.protocol_mode);
+    break;
+
+  case ESP_HIDD_PROTOCOL_MODE_EVENT:
+    ESP_LOGI(TAG, "Host selected %s protocol",
+             param->protocol_mode.protocol_mode == ESP_HID_PROTOCOL_MODE_BOOT
+                 ? "boot"
+                 : "report");
+    s_ble_hid_param.protocol_mode = param->protocol_mode.protocol_mode;
+    kb_mgt_hid_set_protocol_mode(s_ble_hid_param.protocol_mode);
+    break;
+
+  default:
+    break;
+  }
+}
+
 esp_err_t hid_svc_init(void)
 {
   ESP_LOGI(TAG, "Initialize HID Service");
   esp_err_t ret;
-  ret = esp_hidd_dev_init(&ble_hid_config, ESP_HID_TRANSPORT_BLE, NULL,
-                          &s_ble_hid_param.hid_dev);
+  ret = esp_hidd_dev_init(&ble_hid_config, ESP_HID_TRANSPORT_BLE,
+                          hidd_event_callback, &s_ble_hid_param.hid_dev);
   if (ret != 0)
   {
     ESP_LOGE(TAG, "failed to init hid device, ret: %d", ret);
@@ -9,6 +9,10 @@
 #define HID_CONSUMER_REPORT_ID 0x02
 #define HID_MOUSE_REPORT_ID    0x03
 #define HID_SYSTEM_REPORT_ID   0x04
+#define HID_NKRO_REPORT_ID     0x05
+
+// Keyboard usages covered by the NKRO bitmap (0x00-0xE7)
+#define HID_NKRO_USAGE_COUNT 0xE8
 
 // HID Modifier keys
 #define HID_MOD_LEFT_CTRL   0x01
@@ -3,23 +3,54 @@
  * @brief Keyboard Matrix Scanner
  *
  * Implements matrix scanning for mechanical keyboard switch detection.
- * Handles GPIO configuration, debouncing, and key event generation.
+ * Handles GPIO configuration and key event generation; debouncing is
+ * delegated to debounce.c.
  *
  * Key responsibilities:
  * - Matrix GPIO initialization (rows as outputs, columns as inputs)
- * - Continuous matrix scanning with configurable interval
+ * - Continuous matrix scanning paced by a hardware timer (sub-millisecond
+ *   when active)
  * - Key state debouncing to filter electrical noise
- * - Key event generation and routing to keyboard management
+ * - Key event generation, handed to the keyboard management task through a
+ *   lock-free ring so scanning never blocks on key processing
+ * - Boot-time calibration of row settle delays from measured line timing
+ * - Single-read any-key probe that skips the row strobe when idle
+ * - Column-interrupt wake from deep idle instead of slow polling
+ * - Optional LP core column monitor with HP light sleep in deep idle while
+ *   no link is up (enabled with CONFIG_ULP_COPROC_TYPE_LP_CORE)
  * - Support for both master and slave keyboard halves
  */
 
 #include "kb_matrix.h"
 #include "config.h"
+#include "debounce.h"
+#include "driver/gptimer.h"
+#include "esp_cpu.h"
 #include "freertos/projdefs.h"
 #include "kb_mgt.h"
 #include "power_mgmt.h"
 #include "utils.h"
 #include <stdint.h>
+#if MATRIX_SCAN_BACKEND == MATRIX_BACKEND_DEDIC
+#include "driver/dedic_gpio.h"
+#endif
+
+// Deep idle on the LP core: only the columns are LP IOs on this board, so the
+// LP core watches them while the HP core holds the rows low and light-sleeps
+#ifdef CONFIG_ULP_COPROC_TYPE_LP_CORE
+#define MATRIX_LP_IDLE 1
+#include "driver/rtc_io.h"
+#include "esp_sleep.h"
+#include "lp_matrix_idle.h"
+#include "ulp_lp_core.h"
+#include "ulp_lp_matrix.h"
+
+extern const uint8_t
+    lp_matrix_bin_start[] asm("_binary_ulp_lp_matrix_bin_start");
+extern const uint8_t lp_matrix_bin_end[] asm("_binary_ulp_lp_matrix_bin_end");
+#else
+#define MATRIX_LP_IDLE 0
+#endif
 
 static const char *TAG = "MATRIX";
 
@@ -30,24 +61,73 @@ static const char *TAG = "MATRIX";
 static TaskHandle_t   task_hdl = NULL;
 static matrix_state_t state;
 
+// Scan clock: periodic alarm that wakes the scan task
+static gptimer_handle_t scan_timer = NULL;
+static uint32_t         scan_period_us = 0;
+static bool             scan_timer_running = false;
+
 // GPIO pin mappings
 const gpio_num_t row_pins[MATRIX_ROW] = ROW_PINS;
 const gpio_num_t col_pins[MATRIX_COL] = COL_PINS;
 
+static const gpio_num_t wake_pins[WAKEUP_PINS_COUNT] = WAKEUP_PINS;
+
+#define ROW_BUNDLE_MASK ((1U << MATRIX_ROW) - 1)
+#define COL_BUNDLE_MASK ((1U << MATRIX_COL) - 1)
+
+// Settle calibration: samples per line, give-up bound, and guard band applied
+// as measured * GUARD_MUL + GUARD_NS
+#define CALIB_SAMPLES    16
+#define CALIB_TIMEOUT_US 50
+#define CALIB_GUARD_MUL  2
+#define CALIB_GUARD_NS   250
+
+// Busy-wait budgets in CPU cycles; start from the config.h constants and are
+// tightened by calibrate_scan_timing()
+static struct
+{
+  uint32_t row_settle[MATRIX_ROW]; // After selecting a row, before reading
+  uint32_t all_settle;             // After selecting every row (probe, idle)
+  uint32_t row_gap;                // After reading a row
+  bool     col_delay;              // Per-column delay in the gpio backend
+} scan_timing;
+
+#if MATRIX_SCAN_BACKEND == MATRIX_BACKEND_DEDIC
+// Dedicated GPIO bundles: bit i of each bundle is row_pins[i] / col_pins[i]
+static dedic_gpio_bundle_handle_t row_bundle = NULL;
+static dedic_gpio_bundle_handle_t col_bundle = NULL;
+#endif
+
 // =============================================================================
 // FORWARD DECLARATIONS
 // =============================================================================
 
-static bool       scan(key_event_t *event, uint8_t *event_count);
-static void       set_row(uint8_t row, bool state);
-static bool       read_col(uint8_t col);
-static bool       read_raw_state(uint8_t row, uint8_t col);
-static bool       read_current_state(uint8_t row, uint8_t col);
-static bool       read_previous_state(uint8_t row, uint8_t col);
-static mt_state_t read_state(uint8_t row, uint8_t col);
-static void reset_and_track_key_state(bool key_state, uint8_t row, uint8_t col,
-                                      uint32_t timestamp);
-static void process_key_event(key_event_t *events, uint8_t *event_count);
+static uint8_t       scan(time_us_t now);
+static matrix_bits_t sample_matrix(void);
+static bool          probe_any_key(void);
+static void          delay_cycles(uint32_t cycles);
+static void          calibrate_scan_timing(void);
+static uint32_t      measure_row_settle(uint8_t row, uint32_t timeout);
+static uint32_t      measure_col_recovery(uint8_t col, uint32_t timeout);
+static uint32_t      measure_scan_cycles(void);
+static esp_err_t     backend_init(void);
+static void          select_row(uint8_t row);
+static void          select_all_rows(void);
+static void          unselect_rows(void);
+static uint32_t      read_cols(void);
+static esp_err_t     idle_wake_init(void);
+static bool          idle_wake_allowed(void);
+static bool          idle_wait(uint32_t timeout_ms);
+static bool          intr_idle_wait(uint32_t timeout_ms);
+static void          idle_wake_disarm(void);
+#if MATRIX_LP_IDLE
+static esp_err_t lp_idle_init(void);
+static bool      lp_idle_wait(uint32_t timeout_ms);
+#endif
+static esp_err_t     scan_clock_init(void);
+static void          scan_clock_set_period(uint32_t period_us);
+static void          scan_clock_start(void);
+static void          scan_clock_stop(void);
 
 // =============================================================================
 // PUBLIC API - INITIALIZATION
@@ -60,8 +140,9 @@ esp_err_t matrix_init(void)
   // Configure row pins (outputs)
   for (int i = 0; i < MATRIX_ROW; i++)
   {
+    // Input stays enabled so calibration can read back the driven level
     gpio_config_t row_config = {.pin_bit_mask = (1ULL << row_pins[i]),
-                                .mode = GPIO_MODE_OUTPUT,
+                                .mode = GPIO_MODE_INPUT_OUTPUT,
                                 .intr_type = GPIO_INTR_DISABLE,
                                 .pull_down_en = GPIO_PULLDOWN_DISABLE,
                                 .pull_up_en = GPIO_PULLUP_ENABLE};
@@ -95,8 +176,32 @@ esp_err_t matrix_init(void)
     }
   }
 
+  ret = backend_init();
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to initialize matrix scan backend");
+    return ret;
+  }
+  unselect_rows();
+  calibrate_scan_timing();
+
+  ret = idle_wake_init();
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to setup column wake interrupts");
+    return ret;
+  }
+
+  ret = scan_clock_init();
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to setup scan clock timer");
+    return ret;
+  }
+
   // Initialize matrix state and keyboard management
   memset(&state, 0, sizeof(matrix_state_t));
+  ret |= debounce_init(DEBOUNCE_ALGORITHM);
   ret |= kb_mgt_init();
 
   ESP_LOGI(TAG, "Matrix scanner initialized");
@@ -116,7 +221,12 @@ void matrix_scan_start(void)
 
 void matrix_scan_stop(void)
 {
+  // The wake ISR and the scan clock notify task_hdl, so neither may fire past
+  // this point
+  idle_wake_disarm();
+  scan_clock_stop();
   task_hdl_cleanup(task_hdl);
+  task_hdl = NULL;
   ESP_LOGI(TAG, "Matrix scanning stopped");
 }
 
@@ -126,12 +236,10 @@ void matrix_scan_stop(void)
 
 void matrix_scan_task(void *pvParameters)
 {
-  key_event_t events[MAX_KEYS];
-  uint8_t     event_count;
-
   ESP_LOGI(TAG,
            "Matrix scan task started - immediate response power management");
-  ESP_LOGI(TAG, "   Ultra-fast: 1ms, Quick: 5ms, Efficient: 25ms, Deep: 100ms");
+  ESP_LOGI(TAG, "   Ultra-fast: 250us, Quick: 5ms, Efficient: 25ms, Deep: on "
+                "key interrupt");
   ESP_LOGI(TAG,
            "   ⚡ Zero latency activation - instant response on key press");
 
@@ -150,36 +258,53 @@ void matrix_scan_task(void *pvParameters)
   const uint32_t WDT_RESET_INTERVAL_MS = 1000; // Reset every 1 second
   uint32_t       last_wdt_reset_time = get_current_time_ms();
 
+  scan_clock_set_period(power_mgmt_get_matrix_interval());
+  scan_clock_start();
+
   while (1)
   {
-    bool key_detected = scan(events, &event_count);
+    // One clock read per pass; every event in this pass carries the same time
+    time_snapshot_t now = get_time_snapshot();
 
-    if (key_detected)
+    uint8_t event_count = scan(now.us);
+
+    if (event_count > 0)
     {
       ESP_LOGD(TAG, "*** KEY EVENT DETECTED: %d events ***", event_count);
 
       // Force immediate active mode for zero latency response
-      power_mgmt_force_active(get_current_time_ms());
-
-      process_key_event(events, &event_count);
+      power_mgmt_force_active(now.ms);
 
       // Also notify of regular activity
-      power_mgmt_notify_activity(get_current_time_ms());
+      power_mgmt_notify_activity(now.ms);
     }
 
-    kb_mgt_proc_check_tap_timeouts(get_current_time_ms());
-
     // Time-based watchdog reset (independent of adaptive scan interval)
-    uint32_t current_time = get_current_time_ms();
-    if ((current_time - last_wdt_reset_time) >= WDT_RESET_INTERVAL_MS)
+    if ((now.ms - last_wdt_reset_time) >= WDT_RESET_INTERVAL_MS)
     {
       esp_task_wdt_reset();
-      last_wdt_reset_time = current_time;
+      last_wdt_reset_time = now.ms;
     }
 
-    // Get adaptive scan interval from power management
-    uint32_t scan_interval = power_mgmt_get_matrix_interval();
-    vTaskDelay(pdMS_TO_TICKS(scan_interval));
+    // Nothing held or settling in deep idle: sleep until a column interrupt
+    // instead of polling, then scan right away at full rate
+    if (idle_wake_allowed())
+    {
+      // The clock shares the task notification with the wake ISR
+      scan_clock_stop();
+      if (idle_wait(WDT_RESET_INTERVAL_MS))
+      {
+        power_mgmt_force_active(get_current_time_ms());
+      }
+      scan_clock_set_period(power_mgmt_get_matrix_interval());
+      scan_clock_start();
+      continue;
+    }
+
+    // Wait for the next scan clock tick at the adaptive interval. Ticks missed
+    // while scanning collapse into one, so a slow pass never causes a burst.
+    scan_clock_set_period(power_mgmt_get_matrix_interval());
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WDT_RESET_INTERVAL_MS));
   }
 }
 
@@ -187,150 +312,632 @@ void matrix_scan_task(void *pvParameters)
 // PRIVATE IMPLEMENTATIONS - GPIO CONTROL
 // =============================================================================
 
-static void set_row(uint8_t row, bool state)
+#if MATRIX_SCAN_BACKEND == MATRIX_BACKEND_DEDIC
+
+static esp_err_t backend_init(void)
 {
-  if (row < MATRIX_ROW)
+  int rows[MATRIX_ROW];
+  int cols[MATRIX_COL];
+
+  for (int i = 0; i < MATRIX_ROW; i++)
+  {
+    rows[i] = row_pins[i];
+  }
+  for (int i = 0; i < MATRIX_COL; i++)
+  {
+    cols[i] = col_pins[i];
+  }
+
+  dedic_gpio_bundle_config_t row_config = {
+      .gpio_array = rows,
+      .array_size = MATRIX_ROW,
+      .flags = {.out_en = 1},
+  };
+  esp_err_t ret = dedic_gpio_new_bundle(&row_config, &row_bundle);
+  if (ret != ESP_OK)
   {
-    gpio_set_level(row_pins[row], state ? 1 : 0);
+    ESP_LOGE(TAG, "Failed to create row bundle: %d", ret);
+    return ret;
   }
+
+  // Columns are pulled up, so invert in hardware to read pressed keys as 1
+  dedic_gpio_bundle_config_t col_config = {
+      .gpio_array = cols,
+      .array_size = MATRIX_COL,
+      .flags = {.in_en = 1, .in_invert = 1},
+  };
+  ret = dedic_gpio_new_bundle(&col_config, &col_bundle);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to create column bundle: %d", ret);
+    return ret;
+  }
+
+  ESP_LOGI(TAG, "Matrix scan backend: dedicated GPIO");
+  return ESP_OK;
 }
 
-static bool read_col(uint8_t col)
+static void select_row(uint8_t row)
 {
-  // Inverted due to pull-up resistors
-  return col < MATRIX_COL ? !gpio_get_level(col_pins[col]) : false;
+  // Set the current row low, all others high
+  dedic_gpio_bundle_write(row_bundle, ROW_BUNDLE_MASK,
+                          ROW_BUNDLE_MASK & ~(1U << row));
 }
 
-// =============================================================================
-// PRIVATE IMPLEMENTATIONS - STATE READERS
-// =============================================================================
+static void select_all_rows(void)
+{
+  dedic_gpio_bundle_write(row_bundle, ROW_BUNDLE_MASK, 0);
+}
 
-static bool read_raw_state(uint8_t row, uint8_t col)
+static void unselect_rows(void)
 {
-  return (row < MATRIX_ROW && col < MATRIX_COL) ? state.raw[row][col] : false;
+  dedic_gpio_bundle_write(row_bundle, ROW_BUNDLE_MASK, ROW_BUNDLE_MASK);
 }
 
-static bool read_current_state(uint8_t row, uint8_t col)
+static uint32_t read_cols(void)
 {
-  return (row < MATRIX_ROW && col < MATRIX_COL) ? state.current[row][col]
-                                                : false;
+  return dedic_gpio_bundle_read_in(col_bundle) & COL_BUNDLE_MASK;
 }
 
-static bool read_previous_state(uint8_t row, uint8_t col)
+#else // MATRIX_BACKEND_GPIO
+
+static esp_err_t backend_init(void)
 {
-  return (row < MATRIX_ROW && col < MATRIX_COL) ? state.previous[row][col]
-                                                : false;
+  ESP_LOGI(TAG, "Matrix scan backend: gpio driver");
+  return ESP_OK;
 }
 
-static mt_state_t read_state(uint8_t row, uint8_t col)
+static void select_row(uint8_t row)
 {
-  bool raw = read_raw_state(row, col);
-  bool current = read_current_state(row, col);
-  bool previous = read_previous_state(row, col);
-  bool pressed = read_col(col);
+  // Set the current row low, all others high
+  for (uint8_t r = 0; r < MATRIX_ROW; r++)
+  {
+    gpio_set_level(row_pins[r], r != row);
+  }
+}
 
-  mt_state_t state = {raw, current, previous, pressed};
-  return state;
+static void select_all_rows(void)
+{
+  for (uint8_t r = 0; r < MATRIX_ROW; r++)
+  {
+    gpio_set_level(row_pins[r], 0);
+  }
 }
 
-static void reset_and_track_key_state(bool key_state, uint8_t row, uint8_t col,
-                                      uint32_t timestamp)
+static void unselect_rows(void)
 {
-  state.raw[row][col] = key_state;
-  state.debounce_time[row][col] = timestamp;
+  for (uint8_t r = 0; r < MATRIX_ROW; r++)
+  {
+    gpio_set_level(row_pins[r], 1);
+  }
 }
 
+static uint32_t read_cols(void)
+{
+  uint32_t cols = 0;
+
+  for (uint8_t col = 0; col < MATRIX_COL; col++)
+  {
+    // Inverted due to pull-up resistors
+    if (!gpio_get_level(col_pins[col]))
+    {
+      cols |= 1U << col;
+    }
+
+    if (scan_timing.col_delay)
+    {
+      esp_rom_delay_us(GPIO_SETTLE_US);
+    }
+  }
+
+  return cols;
+}
+
+#endif // MATRIX_SCAN_BACKEND
+
 // =============================================================================
-// PRIVATE IMPLEMENTATIONS - MATRIX SCANNING
+// PRIVATE IMPLEMENTATIONS - IDLE WAKE
 // =============================================================================
 
-static bool scan(key_event_t *event, uint8_t *event_count)
+static void IRAM_ATTR col_wake_isr(void *arg)
 {
-  *event_count = 0;
-  bool detected_changes = false;
+  // Level interrupts keep firing while the key is down, so mask them all and
+  // let the scan task take over
+  for (int i = 0; i < WAKEUP_PINS_COUNT; i++)
+  {
+    gpio_intr_disable(wake_pins[i]);
+  }
 
-  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  if (task_hdl != NULL)
+  {
+    BaseType_t higher_prio_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task_hdl, &higher_prio_woken);
+    portYIELD_FROM_ISR(higher_prio_woken);
+  }
+}
+
+static esp_err_t idle_wake_init(void)
+{
+  esp_err_t ret = gpio_install_isr_service(0);
+  if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
   {
-    // Set the current row low, all others high
-    for (uint8_t r = 0; r < MATRIX_ROW; r++)
+    return ret;
+  }
+
+  for (int i = 0; i < WAKEUP_PINS_COUNT; i++)
+  {
+    ret = gpio_set_intr_type(wake_pins[i], GPIO_INTR_LOW_LEVEL);
+    if (ret == ESP_OK)
     {
-      set_row(r, r != row);
+      ret = gpio_isr_handler_add(wake_pins[i], col_wake_isr, NULL);
     }
+    if (ret != ESP_OK)
+    {
+      return ret;
+    }
+    gpio_intr_disable(wake_pins[i]);
+  }
 
-    esp_rom_delay_us(GPIO_SETTLE_US);
+#if MATRIX_LP_IDLE
+  return lp_idle_init();
+#else
+  return ESP_OK;
+#endif
+}
+
+static bool idle_wake_allowed(void)
+{
+  return state.raw == 0 && state.current == 0 && !debounce_is_settling() &&
+         power_mgmt_get_mode() == POWER_MODE_DEEP;
+}
 
-    for (uint8_t col = 0; col < MATRIX_COL; col++)
+static bool idle_wait(uint32_t timeout_ms)
+{
+  // With every row driven low, any pressed key pulls its column low
+  select_all_rows();
+  delay_cycles(scan_timing.all_settle);
+
+  bool woken = read_cols() != 0;
+  if (!woken)
+  {
+#if MATRIX_LP_IDLE
+    // Light sleep takes the radio down too, so only while no link is up
+    woken = power_mgmt_light_sleep_allowed() ? lp_idle_wait(timeout_ms)
+                                             : intr_idle_wait(timeout_ms);
+#else
+    woken = intr_idle_wait(timeout_ms);
+#endif
+  }
+
+  unselect_rows();
+  return woken;
+}
+
+// Rows are already selected. Blocks the task on the column interrupts while
+// the rest of the SoC keeps running. True if a key woke us.
+static bool intr_idle_wait(uint32_t timeout_ms)
+{
+  // Drop a stale notification so only a fresh edge ends the wait
+  ulTaskNotifyTake(pdTRUE, 0);
+
+  for (int i = 0; i < WAKEUP_PINS_COUNT; i++)
+  {
+    gpio_intr_enable(wake_pins[i]);
+  }
+
+  bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0;
+  idle_wake_disarm();
+  return woken;
+}
+
+static void idle_wake_disarm(void)
+{
+  for (int i = 0; i < WAKEUP_PINS_COUNT; i++)
+  {
+    gpio_intr_disable(wake_pins[i]);
+  }
+}
+
+#if MATRIX_LP_IDLE
+
+static esp_err_t lp_idle_init(void)
+{
+  // On the C6 the LP IO number of an LP-capable pad equals its GPIO number
+  uint32_t col_io_mask = 0;
+  for (int i = 0; i < MATRIX_COL; i++)
+  {
+    if (!rtc_gpio_is_valid_gpio(col_pins[i]))
     {
-      mt_state_t mt_state = read_state(row, col);
+      ESP_LOGE(TAG, "Column GPIO %d is not an LP IO", col_pins[i]);
+      return ESP_ERR_NOT_SUPPORTED;
+    }
+    col_io_mask |= 1U << col_pins[i];
+  }
+
+  esp_err_t ret = ulp_lp_core_load_binary(
+      lp_matrix_bin_start, lp_matrix_bin_end - lp_matrix_bin_start);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to load LP core idle program: %d", ret);
+    return ret;
+  }
+
+  ulp_col_io_mask = col_io_mask;
+  ESP_LOGI(TAG, "LP core idle monitor loaded (columns 0x%02lx)", col_io_mask);
+  return ESP_OK;
+}
+
+// Rows are already selected. Hands the columns to the LP core, light-sleeps
+// until it reports an active column or the timeout passes, then takes the
+// pins back. True if a key woke us.
+static bool lp_idle_wait(uint32_t timeout_ms)
+{
+  // Rows are HP pads, so hold their level through light sleep
+  for (int i = 0; i < MATRIX_ROW; i++)
+  {
+    gpio_hold_en(row_pins[i]);
+  }
+  for (int i = 0; i < MATRIX_COL; i++)
+  {
+    rtc_gpio_init(col_pins[i]);
+    rtc_gpio_set_direction(col_pins[i], RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pulldown_dis(col_pins[i]);
+    rtc_gpio_pullup_en(col_pins[i]);
+  }
+
+  ulp_wake_cols = 0;
+  ulp_stable_polls = 0;
+
+  ulp_lp_core_cfg_t cfg = {
+      .wakeup_source = ULP_LP_CORE_WAKEUP_SOURCE_LP_TIMER,
+      .lp_timer_sleep_duration_us = LP_MATRIX_POLL_US,
+  };
 
-      // Track state changes
-      if (mt_state.pressed != mt_state.raw)
+  esp_err_t ret = ulp_lp_core_run(&cfg);
+  if (ret == ESP_OK)
+  {
+    esp_sleep_enable_ulp_wakeup();
+    esp_sleep_enable_timer_wakeup(TIME_MS_TO_US(timeout_ms));
+    esp_light_sleep_start();
+
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ULP);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    ulp_lp_core_stop();
+  }
+  else
+  {
+    ESP_LOGW(TAG, "Failed to start LP core idle program: %d", ret);
+  }
+
+  for (int i = 0; i < MATRIX_COL; i++)
+  {
+    rtc_gpio_deinit(col_pins[i]);
+    gpio_pullup_en(col_pins[i]);
+  }
+  for (int i = 0; i < MATRIX_ROW; i++)
+  {
+    gpio_hold_dis(row_pins[i]);
+  }
+
+  // The key is still down (the LP filter saw it stay active), so the next
+  // full scan picks it up as a normal press
+  return ulp_wake_cols != 0;
+}
+
+#endif // MATRIX_LP_IDLE
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - SCAN TIMING CALIBRATION
+// =============================================================================
+
+static void delay_cycles(uint32_t cycles)
+{
+  esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+
+  while ((esp_cpu_cycle_count_t)(esp_cpu_get_cycle_count() - start) < cycles)
+  {
+  }
+}
+
+// Cycles from driving a row low until its pad reads back low
+static uint32_t measure_row_settle(uint8_t row, uint32_t timeout)
+{
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t            elapsed;
+
+  unselect_rows();
+  esp_rom_delay_us(CALIB_TIMEOUT_US);
+
+  portENTER_CRITICAL(&lock);
+  esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+  select_row(row);
+  do
+  {
+    elapsed = esp_cpu_get_cycle_count() - start;
+  } while (gpio_get_level(row_pins[row]) != 0 && elapsed < timeout);
+  portEXIT_CRITICAL(&lock);
+
+  unselect_rows();
+  return elapsed;
+}
+
+// Cycles for a column to return high through its pull-up after being held
+// low, which is what a key on the previous row leaves behind
+static uint32_t measure_col_recovery(uint8_t col, uint32_t timeout)
+{
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t            elapsed;
+
+  gpio_set_level(col_pins[col], 0);
+  gpio_set_direction(col_pins[col], GPIO_MODE_INPUT_OUTPUT);
+  esp_rom_delay_us(1);
+
+  portENTER_CRITICAL(&lock);
+  esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+  gpio_set_direction(col_pins[col], GPIO_MODE_INPUT);
+  do
+  {
+    elapsed = esp_cpu_get_cycle_count() - start;
+  } while (gpio_get_level(col_pins[col]) == 0 && elapsed < timeout);
+  portEXIT_CRITICAL(&lock);
+
+  return elapsed;
+}
+
+static uint32_t measure_scan_cycles(void)
+{
+  esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+  sample_matrix();
+  return esp_cpu_get_cycle_count() - start;
+}
+
+static void calibrate_scan_timing(void)
+{
+  const uint32_t cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+  const uint32_t timeout = CALIB_TIMEOUT_US * cycles_per_us;
+  const uint32_t guard = CALIB_GUARD_NS * cycles_per_us / 1000;
+
+  // Fixed delays first, so a failed measurement leaves the old behaviour
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  {
+    scan_timing.row_settle[row] = GPIO_SETTLE_US * cycles_per_us;
+  }
+  scan_timing.all_settle = GPIO_SETTLE_US * cycles_per_us;
+  scan_timing.row_gap = ROW_DELAY_US * cycles_per_us;
+  scan_timing.col_delay = true;
+
+  uint32_t before = measure_scan_cycles();
+
+  // Worst column recovery bounds every row: a key released by the previous
+  // row must have let go of its column before the next read
+  uint32_t col_recovery = 0;
+  for (uint8_t col = 0; col < MATRIX_COL; col++)
+  {
+    for (int i = 0; i < CALIB_SAMPLES; i++)
+    {
+      uint32_t cycles = measure_col_recovery(col, timeout);
+      if (cycles >= timeout)
       {
-        reset_and_track_key_state(mt_state.pressed, row, col,
-                                  get_current_time_ms());
+        ESP_LOGW(TAG, "Column %d did not recover, keeping fixed delays", col);
+        return;
       }
+      if (cycles > col_recovery)
+      {
+        col_recovery = cycles;
+      }
+    }
+  }
 
-      // Debounce check
-      bool debounce_elapsed =
-          (get_current_time_ms() - state.debounce_time[row][col]) >=
-          DEBOUNCE_TIME_MS;
-      bool state_actually_changes =
-          debounce_elapsed && (mt_state.current != mt_state.raw);
-
-      if (state_actually_changes)
+  uint32_t all_settle = 0;
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  {
+    uint32_t row_settle = col_recovery;
+    bool     settled = true;
+    for (int i = 0; i < CALIB_SAMPLES && settled; i++)
+    {
+      uint32_t cycles = measure_row_settle(row, timeout);
+      settled = cycles < timeout;
+      if (cycles > row_settle)
       {
-        state.previous[row][col] = mt_state.current;
-        state.current[row][col] = mt_state.raw;
-
-        if (*event_count < MAX_KEYS)
-        {
-          event[*event_count].col = col;
-          event[*event_count].row = row;
-          event[*event_count].pressed = mt_state.raw;
-          event[*event_count].timestamp = get_current_time_ms();
-
-          (*event_count)++;
-          detected_changes = true;
-        }
+        row_settle = cycles;
       }
+    }
 
-      esp_rom_delay_us(GPIO_SETTLE_US);
+    if (settled)
+    {
+      scan_timing.row_settle[row] = row_settle * CALIB_GUARD_MUL + guard;
+    }
+    else
+    {
+      ESP_LOGW(TAG, "Row %d did not settle, keeping fixed delay", row);
+    }
+
+    if (scan_timing.row_settle[row] > all_settle)
+    {
+      all_settle = scan_timing.row_settle[row];
     }
 
-    esp_rom_delay_us(ROW_DELAY_US);
+    ESP_LOGI(TAG, "Row %d settle: %lu cycles (measured %lu)", row,
+             scan_timing.row_settle[row], row_settle);
   }
 
-  // Set all rows high when done scanning
-  for (uint8_t r = 0; r < MATRIX_ROW; r++)
+  // Recovery is folded into each row's settle, so neither the gap after a row
+  // nor a delay between column reads is needed any more
+  scan_timing.all_settle = all_settle;
+  scan_timing.row_gap = 0;
+  scan_timing.col_delay = false;
+
+  uint32_t after = measure_scan_cycles();
+
+  ESP_LOGI(TAG, "Column recovery: %lu cycles, scan time %luus -> %luus",
+           col_recovery, before / cycles_per_us, after / cycles_per_us);
+}
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - SCAN CLOCK
+// =============================================================================
+
+static bool IRAM_ATTR scan_clock_isr(gptimer_handle_t                  timer,
+                                     const gptimer_alarm_event_data_t *edata,
+                                     void                             *arg)
+{
+  BaseType_t higher_prio_woken = pdFALSE;
+
+  if (task_hdl != NULL)
+  {
+    vTaskNotifyGiveFromISR(task_hdl, &higher_prio_woken);
+  }
+
+  return higher_prio_woken == pdTRUE;
+}
+
+static esp_err_t scan_clock_init(void)
+{
+  gptimer_config_t timer_config = {
+      .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+      .direction = GPTIMER_COUNT_UP,
+      .resolution_hz = SCAN_TIMER_RESOLUTION_HZ,
+  };
+
+  esp_err_t ret = gptimer_new_timer(&timer_config, &scan_timer);
+  if (ret != ESP_OK)
+  {
+    return ret;
+  }
+
+  gptimer_event_callbacks_t callbacks = {.on_alarm = scan_clock_isr};
+  ret = gptimer_register_event_callbacks(scan_timer, &callbacks, NULL);
+  if (ret != ESP_OK)
   {
-    set_row(r, true);
+    return ret;
   }
 
-  return detected_changes;
+  return gptimer_enable(scan_timer);
+}
+
+static void scan_clock_set_period(uint32_t period_us)
+{
+  if (scan_timer == NULL || period_us == scan_period_us)
+  {
+    return;
+  }
+
+  gptimer_alarm_config_t alarm_config = {
+      .alarm_count = period_us,
+      .reload_count = 0,
+      .flags.auto_reload_on_alarm = true,
+  };
+
+  if (gptimer_set_alarm_action(scan_timer, &alarm_config) == ESP_OK)
+  {
+    scan_period_us = period_us;
+    ESP_LOGD(TAG, "Scan clock period: %luus", period_us);
+  }
+}
+
+static void scan_clock_start(void)
+{
+  if (scan_timer == NULL || scan_timer_running)
+  {
+    return;
+  }
+
+  gptimer_set_raw_count(scan_timer, 0);
+  if (gptimer_start(scan_timer) == ESP_OK)
+  {
+    scan_timer_running = true;
+  }
+}
+
+static void scan_clock_stop(void)
+{
+  if (scan_timer == NULL || !scan_timer_running)
+  {
+    return;
+  }
+
+  gptimer_stop(scan_timer);
+  scan_timer_running = false;
 }
 
 // =============================================================================
-// PRIVATE IMPLEMENTATIONS - EVENT PROCESSING
+// PRIVATE IMPLEMENTATIONS - MATRIX SCANNING
 // =============================================================================
 
-static void process_key_event(key_event_t *events, uint8_t *event_count)
+static matrix_bits_t sample_matrix(void)
 {
-  kb_mgt_proc_check_tap_timeouts(get_current_time_ms());
+  matrix_bits_t sample = 0;
 
-  for (int i = 0; i < *event_count; i++)
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
   {
-    // Mirror column mapping for slave half
-#if !IS_MASTER
-    key_def_t key = keymap_get_key(kb_mgt_layer_get_active(), events[i].row,
-                                   MATRIX_COL - 1 - events[i].col);
-#else
-    key_def_t key =
-        keymap_get_key(kb_mgt_layer_get_active(), events[i].row, events[i].col);
-#endif
+    select_row(row);
+    delay_cycles(scan_timing.row_settle[row]);
+
+    sample |= (matrix_bits_t)read_cols() << MATRIX_KEY_INDEX(row, 0);
+
+    delay_cycles(scan_timing.row_gap);
+  }
+
+  // Set all rows high when done scanning
+  unselect_rows();
+
+  return sample;
+}
 
-    kb_mgt_process_key_event(key, events[i].row, events[i].col,
-                             events[i].pressed, get_current_time_ms());
+// One read with every row driven: true if any key in the half is down
+static bool probe_any_key(void)
+{
+  select_all_rows();
+  delay_cycles(scan_timing.all_settle);
+
+  bool any = read_cols() != 0;
+
+  unselect_rows();
+  return any;
+}
+
+// Returns the number of key events handed to kb_mgt
+static uint8_t scan(time_us_t now)
+{
+  uint8_t event_count = 0;
+
+  // Fast path: nothing reported, nothing settling and nothing down now means
+  // the full strobe and the debouncer have no work to do
+  if (state.current == 0 && !debounce_is_settling() && !probe_any_key())
+  {
+    state.raw = 0;
+    return 0;
+  }
+
+  state.raw = sample_matrix();
+
+  // Only keys whose debounced level flipped produce events, so a quiet scan
+  // ends here
+  matrix_bits_t debounced = debounce_update(state.raw, now);
+  matrix_bits_t changed = debounced ^ state.current;
+  state.current = debounced;
+
+  while (changed)
+  {
+    uint8_t       idx = __builtin_ctz(changed);
+    matrix_bits_t bit = changed & -changed;
+    changed &= changed - 1;
+
+    key_event_t event = {
+        .row = idx / MATRIX_COL,
+        .col = idx % MATRIX_COL,
+        .pressed = (state.current & bit) != 0,
+        .timestamp = now,
+    };
+
+    // Ring full: take the change back so the next scan reports it again
+    if (!kb_mgt_post_key_event(&event))
+    {
+      state.current ^= bit;
+      continue;
+    }
+    event_count++;
   }
 
-  kb_mgt_finalize_processing();
+  return event_count;
 }
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "config.h"
 #include "keymap.h"
+#include "utils.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -14,24 +15,24 @@ typedef struct
   uint8_t  row;
   uint8_t  col;
   bool     pressed;
-  uint32_t timestamp;
+  time_us_t timestamp; // Capture time of the scan that produced the event
 } key_event_t;
 
-typedef struct
-{
-  bool     raw[MATRIX_ROW][MATRIX_COL];
-  bool     current[MATRIX_ROW][MATRIX_COL];
-  bool     previous[MATRIX_ROW][MATRIX_COL];
-  uint32_t debounce_time[MATRIX_ROW][MATRIX_COL];
-} matrix_state_t;
+// Bit-packed key state for one half: bit (row * MATRIX_COL + col) per key
+typedef uint32_t matrix_bits_t;
+
+_Static_assert(MAX_KEYS <= 32, "Matrix does not fit in matrix_bits_t");
+
+#define MATRIX_KEYS_MASK           (0xFFFFFFFFU >> (32 - MAX_KEYS))
+#define MATRIX_KEY_INDEX(row, col) ((row) * MATRIX_COL + (col))
+#define MATRIX_KEY_BIT(row, col)                                               \
+  ((matrix_bits_t)1 << MATRIX_KEY_INDEX(row, col))
 
 typedef struct
 {
-  bool raw;
-  bool current;
-  bool previous;
-  bool pressed;
-} mt_state_t;
+  matrix_bits_t raw;     // Last sampled level of every key
+  matrix_bits_t current; // Debounced level of every key
+} matrix_state_t;
 
 esp_err_t matrix_init(void);
 void      matrix_scan_task(void *pvParameters);
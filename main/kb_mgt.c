@@ -6,8 +6,12 @@
  * communication. Organized into four main subsystems:
  * 1. HID Report Management - Building and sending HID reports
  * 2. Layer Management - Layer activation/deactivation logic
- * 3. Key Processor - Key event handling and tap-hold logic
+ * 3. Key Processor - Key event handling, combos and tap-hold logic
  * 4. Communication - ESP-NOW messaging for split keyboard
+ *
+ * All of it runs on one processing task that owns the state outright, so no
+ * locking is needed. Key events arrive from the scan task through a lock-free
+ * single-producer ring; messages from the other half arrive through a queue.
  */
 
 #include "kb_mgt.h"
@@ -16,18 +20,179 @@
 #include "freertos/projdefs.h"
 #include "keymap.h"
 #include "power_mgmt.h"
+#include <stdatomic.h>
+
+static const char *TAG = "KB_MGT";
 
-static const char       *TAG = "KB_MGT";
-static SemaphoreHandle_t sem_hdl;
+_Static_assert((KEY_EVENT_RING_SIZE & (KEY_EVENT_RING_SIZE - 1)) == 0,
+               "KEY_EVENT_RING_SIZE must be a power of two");
 
 // =============================================================================
 // STATE VARIABLES
 // =============================================================================
 
-static kb_mgt_hid_key_report_t      hid_key_report;
+static TaskHandle_t  task_hdl = NULL;
+static QueueHandle_t remote_inbox = NULL; // Edge messages (comm_edge_t)
+static atomic_uint   remote_overflows;    // Edges the full inbox turned away
+
+// ESP-NOW task -> processing task, the newest state message of each kind
+// (comm_state_index). A newer one replaces one not yet applied instead of
+// queueing behind it, so no burst can crowd them out. Sequence numbers from
+// remote_seq put them back in order with the queued edges.
+typedef struct
+{
+  kb_mgt_remote_msg_t latest;
+  kb_mgt_remote_msg_t replaced; // Left by replaced messages, applied first
+  uint32_t            seq;
+  uint32_t            replaced_seq;
+  bool                posted;
+  bool                has_replaced;
+} comm_state_t;
+
+typedef struct
+{
+  uint32_t            seq;
+  kb_mgt_remote_msg_t msg;
+} comm_edge_t;
+
+#define COMM_STATE_COUNT 4
+
+static portMUX_TYPE remote_lock = portMUX_INITIALIZER_UNLOCKED;
+static comm_state_t remote_state[COMM_STATE_COUNT];
+static uint32_t     remote_seq; // Written by the ESP-NOW task only
+
+// Scan task -> processing task. Each index has a single writer, so the
+// acquire/release pair on it is the only synchronization needed.
+static struct
+{
+  key_event_t          slots[KEY_EVENT_RING_SIZE];
+  atomic_uint_fast32_t head; // Next slot to fill, written by the scan task
+  atomic_uint_fast32_t tail; // Next slot to drain, written by kb_mgt task
+} key_ring;
+
+// Keyboard report contributions. Each has one owner and the outgoing report
+// is their union, so one half or a macro can never wipe another's keys.
+typedef enum
+{
+  HID_SRC_LOCAL,  // This half's key processing
+  HID_SRC_REMOTE, // Latest report forwarded by the slave (master only)
+  HID_SRC_MACRO,  // Macro playback
+  HID_SRC_COUNT
+} hid_src_t;
+
+static kb_mgt_hid_key_report_t      hid_src[HID_SRC_COUNT];
 static kb_mgt_hid_consumer_report_t hid_consumer_report;
+
+// Host protocol and ATT MTU, written from the HID and GAP event handlers
+static atomic_bool hid_boot_protocol;
+static atomic_uint hid_att_mtu;
+// Format of the last key report sent, so a switch can release the other one
+static bool hid_sent_nkro;
+
+// Shadows of what the transport last carried, nothing identical is resent
+static kb_mgt_hid_key_report_t      hid_key_sent;
+static kb_mgt_hid_consumer_report_t hid_consumer_sent;
+#if !IS_MASTER
+static uint32_t hid_key_sent_seq; // ESP-NOW frame that carried hid_key_sent
+#endif
+
+#if IS_MASTER
+// Key reports waiting for the BLE link, oldest first. While the link is busy
+// a new state is merged into the newest queued one unless that would hide a
+// press or release from the host, so every transition still goes out in order.
+static struct
+{
+  kb_mgt_hid_key_report_t fifo[HID_TX_FIFO_SIZE];
+  uint8_t                 head; // Oldest queued report
+  uint8_t                 count;
+  uint32_t                issued;    // Notifications handed to the stack
+  atomic_uint             completed; // NOTIFY_TX events, from the host task
+  time_us_t               issued_at;
+  bool                    failing;   // The stack refused the head report
+  time_us_t               failed_at; // First refusal in a row
+} hid_tx;
+#endif
 static proc_state_t                 proc_state;
 
+// Keymap as seen from the active layer: TRANSPARENT entries are replaced by
+// the first lower layer that defines the position. Indexed by keymap column.
+static struct
+{
+  uint8_t   layer; // Active layer the cache was built for
+  key_def_t keys[MATRIX_ROW][MATRIX_COL];
+} keymap_cache;
+
+// Pending tap-hold deadlines: a binary min-heap of held[] slots ordered by
+// deadline. pos[] tracks each slot's heap index so a key that resolves early
+// is removed in O(log n) instead of going stale in the heap.
+#define TIMER_NONE 0xFF
+
+static struct
+{
+  uint8_t heap[PROC_MAX_HELD_KEYS];
+  uint8_t pos[PROC_MAX_HELD_KEYS]; // Heap index per slot, TIMER_NONE if idle
+  uint8_t count;
+} timers;
+
+// Key events waiting to be processed, oldest first. The first held_back of
+// them arrived behind proc_state.pending and wait for its decision, so they
+// are processed on the layer and with the modifiers it selects.
+static struct
+{
+  key_event_t events[PROC_MAX_QUEUED_EVENTS];
+  uint8_t     count;
+  uint8_t     held_back;
+} proc_queue;
+
+// Combo detection. combo_index[pos] has bit i set when combo i uses that key,
+// so each press narrows the candidates with a single AND.
+static uint32_t combo_index[MAX_KEYS];
+static uint32_t combo_keys[KEYMAP_MAX_COMBOS];
+
+static struct
+{
+  key_event_t held[KEYMAP_COMBO_MAX_KEYS]; // Presses held back, oldest first
+  uint8_t     count;
+  key_event_t behind[KEYMAP_COMBO_MAX_KEYS]; // Releases that came after them
+  uint8_t     behind_count;
+  uint32_t    pressed;    // KEY_POS_BIT of the held back presses
+  uint32_t    candidates; // Combos still possible with them
+  time_us_t   started_at; // First held back press, opens the combo window
+  uint32_t    active;     // Fired combos whose action is still pressed
+  uint32_t    keys_down[KEYMAP_MAX_COMBOS]; // Keys of fired combos still down
+} combo;
+
+// Decision latency per combo, and of held back keys that were not one (the
+// delay combos add to ordinary typing). Logged every COMBO_STATS_LOG_EVERY.
+static kb_mgt_combo_stats_t combo_stats[KEYMAP_MAX_COMBOS];
+static kb_mgt_combo_stats_t combo_miss_stats;
+
+static kb_mgt_tap_dance_stats_t dance_stats[KEYMAP_MAX_TAP_DANCES];
+
+// Macro playback. A step runs only once the transport has taken the previous
+// report, so a macro goes out at the link's own pace and the processing path
+// never waits on it.
+static struct
+{
+  const uint8_t *pc; // Next opcode, NULL when idle
+  const uint8_t *end;
+  time_us_t      resume_at; // End of a DELAY
+  time_us_t      sent_at;   // Last report, for the stall timeout
+  bool           delaying;
+  bool           tap_pending; // A TAP key goes back up on the next step
+  uint8_t        tap_key;
+  uint8_t        queue[MACRO_QUEUE_SIZE]; // Macro ids waiting their turn
+  uint8_t        queue_head;
+  uint8_t        queue_count;
+#if !IS_MASTER
+  bool        awaiting_ack; // Last report has not been acknowledged yet
+  uint32_t    frame_seq;    // Its ESP-NOW frame, 0 if it was not queued
+  time_us_t   first_sent_at; // First attempt, resends stop at the stall
+  atomic_uint tx_done;   // Last ESP-NOW frame reported, from the ESP-NOW task
+  atomic_uint tx_failed; // Bit (seq % 32) set if that frame was lost
+#endif
+} macro;
+
 // =============================================================================
 // FORWARD DECLARATIONS - HID Management
 // =============================================================================
@@ -39,6 +204,22 @@ static void      hid_set_consumer_unsafe(uint16_t usage);
 static void      hid_clear_consumer_unsafe(void);
 static void      hid_set_modifier_unsafe(uint8_t modifier);
 static void      hid_clear_modifier_unsafe(uint8_t modifier);
+static void      hid_merge_key_report(kb_mgt_hid_key_report_t *out);
+static void      hid_send_key_report_unsafe(void);
+static void      hid_send_consumer_report_unsafe(void);
+#if IS_MASTER
+static void      hid_build_boot_report(const kb_mgt_hid_key_report_t *report,
+                                       kb_mgt_hid_boot_report_t      *boot);
+static esp_err_t hid_input_key_report(bool                           nkro,
+                                      const kb_mgt_hid_key_report_t *report);
+static bool      hid_report_mergeable(const kb_mgt_hid_key_report_t *prev,
+                                      const kb_mgt_hid_key_report_t *mid,
+                                      const kb_mgt_hid_key_report_t *next);
+static void      hid_tx_enqueue(const kb_mgt_hid_key_report_t *report);
+static bool      hid_tx_transmit(const kb_mgt_hid_key_report_t *report);
+static void      hid_tx_flush(time_us_t now);
+static uint32_t  hid_tx_in_flight(void);
+#endif
 
 // =============================================================================
 // FORWARD DECLARATIONS - Layer Management
@@ -49,6 +230,8 @@ static void      layer_activate_momentary_unsafe(uint8_t layer);
 static void      layer_deactivate_momentary_unsafe(uint8_t layer);
 static void      layer_toggle_unsafe(uint8_t layer);
 static bool      layer_is_momentary_active(uint8_t layer);
+static void      layer_sync_unsafe(void);
+static void      layer_refresh_cache_unsafe(void);
 
 // =============================================================================
 // FORWARD DECLARATIONS - Key Processor
@@ -56,112 +239,119 @@ static bool      layer_is_momentary_active(uint8_t layer);
 
 static esp_err_t proc_init(void);
 
+static bool proc_ring_pop(key_event_t *event);
+static void proc_queue_event(const key_event_t *event);
+static void proc_run_queue(void);
+static key_event_t proc_queue_remove(uint8_t index);
+static void proc_hold_back(proc_held_key_t   *pending,
+                           const key_event_t *event);
+static bool proc_other_half(const key_event_t *event);
+static void proc_send_key_event(const key_event_t *event);
+static void proc_sync_pending(time_us_t now);
+static bool proc_resend_deadline(time_us_t *deadline);
+static bool proc_check_remote_pending(time_us_t now);
+static bool proc_remote_deadline(time_us_t *deadline);
+static void proc_handle_event(const key_event_t *event);
+static bool proc_check_tap_timeouts(time_us_t now);
+static void proc_decide(proc_held_key_t *held, proc_decision_t decision);
+static bool proc_quick_tap(uint8_t row, uint8_t col, time_us_t timestamp);
+static uint32_t proc_typing_record(time_us_t timestamp);
+static bool proc_typing_press(time_us_t timestamp);
+static void proc_press_action(key_def_t key);
 static void proc_handle_press(key_def_t key, uint8_t row, uint8_t col,
-                              uint32_t timestamp);
-static void proc_handle_release(uint8_t row, uint8_t col, uint32_t timestamp);
-static void proc_store_pressed_key(uint8_t row, uint8_t col, key_def_t key);
-static key_def_t proc_get_stored_key(uint8_t row, uint8_t col);
-static bool      proc_has_stored_key(uint8_t row, uint8_t col);
-static void      proc_clear_stored_key(uint8_t row, uint8_t col);
+                              time_us_t timestamp);
+static void proc_handle_release(uint8_t row, uint8_t col, time_us_t timestamp);
+static void proc_release_tap_hold(const proc_held_key_t *held,
+                                  time_us_t              timestamp);
+static proc_held_key_t *proc_store_pressed_key(uint8_t row, uint8_t col,
+                                               key_def_t key,
+                                               time_us_t timestamp);
+static proc_held_key_t *proc_find_held(uint8_t row, uint8_t col);
+static void             proc_clear_held(proc_held_key_t *held);
+static proc_held_key_t *proc_pending(void);
+static time_us_t        proc_timeout_us(const proc_held_key_t *held);
+static uint8_t          proc_flavor(const proc_held_key_t *held);
+static uint8_t          proc_tap_key(const proc_held_key_t *held);
 
 // =============================================================================
-// FORWARD DECLARATIONS - Communication
+// FORWARD DECLARATIONS - Tap-Hold Timers
 // =============================================================================
 
-static void comm_send_event(kb_comm_event_t event_type, void *data);
-static void comm_handle_brief_tap(uint8_t keycode);
+static time_us_t timer_deadline(uint8_t heap_idx);
+static void      timer_swap(uint8_t a, uint8_t b);
+static void      timer_sift_up(uint8_t idx);
+static void      timer_sift_down(uint8_t idx);
+static void      timer_arm(proc_held_key_t *held);
+static void      timer_cancel(proc_held_key_t *held);
+static bool      timer_next_deadline(time_us_t *deadline);
 
 // =============================================================================
-// PUBLIC API - HID Report Access
+// FORWARD DECLARATIONS - Combos
 // =============================================================================
 
-kb_mgt_hid_key_report_t *kb_mgt_hid_get_current_key_report(void)
-{
-  return &hid_key_report;
-}
+static esp_err_t combo_init(void);
+static uint8_t   combo_event_pos(const key_event_t *event);
+static void      combo_handle_event(const key_event_t *event);
+static void      combo_resolve(time_us_t now);
+static void      combo_release(const key_event_t *event);
+static bool      combo_release_key(uint8_t pos, time_us_t timestamp);
+static void      combo_post_action(uint8_t index, bool pressed,
+                                   time_us_t timestamp);
+static void      combo_record(int index, time_us_t latency);
+static bool      combo_next_deadline(time_us_t *deadline);
+static bool      combo_check_timeout(time_us_t now);
 
-kb_mgt_hid_consumer_report_t *kb_mgt_hid_get_current_consumer_report(void)
-{
-  return &hid_consumer_report;
-}
+// =============================================================================
+// FORWARD DECLARATIONS - Macro Playback
+// =============================================================================
 
-void kb_mgt_hid_clear_report(void)
-{
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
-  {
-    ESP_LOGE(TAG, "Failed to acquire keyboard management mutex");
-    return;
-  }
-  memset(&hid_key_report, 0, sizeof(kb_mgt_hid_key_report_t));
-  xSemaphoreGive(sem_hdl);
-}
+static esp_err_t macro_init(void);
+static void      macro_enqueue(uint8_t id);
+static bool      macro_start_next(void);
+static void      macro_run(time_us_t now);
+static bool      macro_link_ready(time_us_t now);
+static void      macro_emit(time_us_t now);
+static void      macro_set_key(uint8_t keycode, bool pressed);
+static uint32_t  macro_read_varint(void);
+static bool      macro_next_deadline(time_us_t *deadline);
 
-#if IS_MASTER
-void kb_mgt_hid_send_key_report_unsafe(void)
-{
-  if (hid_dev)
-  {
-    esp_hidd_dev_input_set(hid_dev, 0, 1, (uint8_t *)(&hid_key_report),
-                           sizeof(kb_mgt_hid_key_report_t));
-  }
-}
-#else
-void kb_mgt_hid_send_key_report_unsafe(void)
-{
-  comm_send_event(KB_COMM_EVENT_TAP, &hid_key_report);
-}
-#endif
+// =============================================================================
+// FORWARD DECLARATIONS - Tap Dance
+// =============================================================================
+
+static void    dance_start(proc_held_key_t *held);
+static bool    dance_edge(proc_held_key_t *held, const key_event_t *event);
+static void    dance_counted(proc_held_key_t *held);
+static void    dance_commit(proc_held_key_t *held, proc_decision_t decision);
+static uint8_t dance_max_taps(const keymap_tap_dance_t *dance);
+static void    dance_record(kb_mgt_tap_dance_stats_t *stats, time_us_t latency,
+                            bool early);
+
+// =============================================================================
+// FORWARD DECLARATIONS - Communication
+// =============================================================================
 
+static uint32_t comm_send_event(kb_comm_event_t event_type, void *data);
+static void comm_handle_brief_tap(uint8_t keycode);
 #if IS_MASTER
-void kb_mgt_hid_send_consumer_report_unsafe(void)
-{
-  if (hid_dev)
-  {
-    ESP_LOGI(TAG, "Sending consumer report: usage=0x%04X",
-             hid_consumer_report.usage);
-    esp_err_t ret =
-        esp_hidd_dev_input_set(hid_dev, 0, 2, (uint8_t *)(&hid_consumer_report),
-                               sizeof(kb_mgt_hid_consumer_report_t));
-    if (ret != ESP_OK)
-    {
-      ESP_LOGE(TAG, "Failed to send consumer report: %d", ret);
-    }
-  }
-}
-#else
-void kb_mgt_hid_send_consumer_report_unsafe(void)
-{
-  comm_send_event(KB_COMM_EVENT_CONSUMER, &hid_consumer_report);
-}
+static bool comm_report_adds_key(const kb_mgt_hid_key_report_t *prev,
+                                 const kb_mgt_hid_key_report_t *next);
 #endif
+static void comm_handle_remote(const kb_mgt_remote_msg_t *msg);
+static int  comm_state_index(kb_mgt_remote_type_t type);
+static void comm_state_replace(comm_state_t              *state,
+                               const kb_mgt_remote_msg_t *msg, uint32_t seq);
+static uint32_t comm_state_seq(const comm_state_t *state);
+static bool comm_take_state(const uint32_t *before, kb_mgt_remote_msg_t *msg);
+static void comm_drain_remote(void);
 
 // =============================================================================
-// PUBLIC API - Modifier Sync (for split keyboard)
+// FORWARD DECLARATIONS - Processing Task
 // =============================================================================
 
-void kb_mgt_sync_modifier(uint8_t modifier)
-{
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
-  {
-    ESP_LOGE(TAG, "Failed to acquire keyboard management mutex");
-    return;
-  }
-  hid_key_report.modifiers |= modifier;
-  xSemaphoreGive(sem_hdl);
-  ESP_LOGI(TAG, "Modifier 0x%02x synced", modifier);
-}
-
-void kb_mgt_desync_modifier(uint8_t modifier)
-{
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
-  {
-    ESP_LOGE(TAG, "Failed to acquire keyboard management mutex");
-    return;
-  }
-  hid_key_report.modifiers &= ~modifier;
-  xSemaphoreGive(sem_hdl);
-  ESP_LOGI(TAG, "Modifier 0x%02x desynced", modifier);
-}
+static void task(void *pvParameters);
+static void task_process(void);
+static bool task_next_deadline(time_us_t *deadline);
 
 // =============================================================================
 // PUBLIC API - Layer Access
@@ -169,101 +359,96 @@ void kb_mgt_desync_modifier(uint8_t modifier)
 
 uint8_t kb_mgt_layer_get_active(void)
 {
-  // Check for momentary layers first (highest priority)
-  for (int i = MAX_LAYERS - 1; i > 0; i--)
-  {
-    if (proc_state.layer_momentary_active[i])
-    {
-      return i;
-    }
-  }
-  return proc_state.current_layer;
+  // Highest active layer wins; the base bit keeps the mask non-zero
+  uint32_t active = proc_state.layer_base | proc_state.layer_momentary |
+                    proc_state.layer_remote;
+  return 31 - __builtin_clz(active);
 }
 
 // =============================================================================
-// PUBLIC API - Layer Sync (for split keyboard)
+// PUBLIC API - Key Processing
 // =============================================================================
 
-void kb_mgt_sync_layer(uint8_t layer)
+uint32_t kb_mgt_typing_interval_ms(void)
 {
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
-  {
-    ESP_LOGE(TAG, "Failed to acquire mutex");
-    return;
-  }
-  layer_activate_momentary_unsafe(layer);
-  xSemaphoreGive(sem_hdl);
-  ESP_LOGI(TAG, "Layer %d synced (activated)", layer);
+  return proc_state.typing.interval_us / 1000;
 }
 
-void kb_mgt_desync_layer(uint8_t layer)
+// =============================================================================
+// PUBLIC API - Tap Dance
+// =============================================================================
+
+esp_err_t kb_mgt_tap_dance_get_stats(uint8_t                   dance,
+                                     kb_mgt_tap_dance_stats_t *stats)
 {
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
+  if (dance >= keymap_tap_dance_count() || stats == NULL)
   {
-    ESP_LOGE(TAG, "Failed to acquire mutex");
-    return;
+    return ESP_ERR_INVALID_ARG;
   }
-  layer_deactivate_momentary_unsafe(layer);
-  xSemaphoreGive(sem_hdl);
-  ESP_LOGI(TAG, "Layer %d desynced (deactivated)", layer);
+
+  *stats = dance_stats[dance];
+  return ESP_OK;
 }
 
 // =============================================================================
-// PUBLIC API - Processor Management
+// PUBLIC API - HID Transport
 // =============================================================================
 
-void kb_mgt_proc_check_tap_timeouts(uint32_t current_time)
+void kb_mgt_hid_set_protocol_mode(uint8_t protocol_mode)
 {
-  for (uint8_t row = 0; row < MATRIX_ROW; row++)
-  {
-    for (uint8_t col = 0; col < MATRIX_COL; col++)
-    {
-      if (!proc_state.pressed_key_active[row][col])
-        continue;
+  atomic_store_explicit(&hid_boot_protocol,
+                        protocol_mode == ESP_HID_PROTOCOL_MODE_BOOT,
+                        memory_order_relaxed);
+}
 
-      key_def_t key = proc_state.pressed_keys[row][col];
-      bool      is_tapped = proc_state.key_is_tapped[row][col];
+void kb_mgt_hid_set_mtu(uint16_t mtu)
+{
+  unsigned prev = atomic_exchange_explicit(&hid_att_mtu, mtu,
+                                           memory_order_relaxed);
 
-      uint16_t timeout_ms = proc_state.key_tap_timeout[row][col];
-      if (timeout_ms == 0)
-      {
-        timeout_ms = DEFAULT_TIMEOUT_MS;
-      }
+  if (HID_NKRO_ENABLE &&
+      (prev >= HID_NKRO_MIN_MTU) != (mtu >= HID_NKRO_MIN_MTU))
+  {
+    ESP_LOGI(TAG, "ATT MTU %d, key reports in %s", mtu,
+             mtu >= HID_NKRO_MIN_MTU ? "NKRO" : "6KRO");
+  }
+}
 
-      bool layer_tap_elapsed =
-          (current_time - proc_state.layer_tap_timer[row][col]) >= timeout_ms;
-      bool mod_tap_elapsed =
-          (current_time - proc_state.mod_tap_timer[row][col]) >= timeout_ms;
+void kb_mgt_hid_tx_done(void)
+{
+#if IS_MASTER
+  atomic_fetch_add_explicit(&hid_tx.completed, 1, memory_order_relaxed);
+  if (task_hdl != NULL)
+  {
+    xTaskNotifyGive(task_hdl);
+  }
+#endif
+}
 
-      switch (key.type)
-      {
-      case KEY_TYPE_LAYER_TAP:
-        if (layer_tap_elapsed && !is_tapped)
-        {
-          layer_activate_momentary_unsafe(key.layer_tap.layer);
-          proc_state.key_is_tapped[row][col] = true;
-          comm_send_event(KB_COMM_EVENT_LAYER_SYNC, &key.layer_tap.layer);
-          ESP_LOGD(TAG, "Layer tap timeout (%dms) - activating layer %d",
-                   timeout_ms, key.layer_tap.layer);
-        }
-        break;
+void kb_mgt_link_tx_done(uint32_t seq, bool delivered)
+{
+#if !IS_MASTER
+  uint32_t bit = 1UL << (seq % 32);
 
-      case KEY_TYPE_MOD_TAP:
-        if (mod_tap_elapsed && !is_tapped)
-        {
-          hid_set_modifier_unsafe(key.mod_tap.hold_key);
-          proc_state.key_is_tapped[row][col] = true;
-          comm_send_event(KB_COMM_EVENT_MOD_SYNC, &key.mod_tap.hold_key);
-          ESP_LOGD(TAG, "Mod tap timeout (%dms) - activating modifier 0x%02x",
-                   timeout_ms, key.mod_tap.hold_key);
-        }
-        break;
+  // Outcome first, then the sequence that publishes it
+  if (delivered)
+  {
+    atomic_fetch_and_explicit(&macro.tx_failed, ~bit, memory_order_relaxed);
+  }
+  else
+  {
+    atomic_fetch_or_explicit(&macro.tx_failed, bit, memory_order_relaxed);
+  }
+  atomic_store_explicit(&macro.tx_done, seq, memory_order_release);
 
-      default:
-        break;
-      }
-    }
+  if (task_hdl != NULL)
+  {
+    xTaskNotifyGive(task_hdl);
   }
+#else
+  (void)seq;
+  (void)delivered;
+#endif
 }
 
 // =============================================================================
@@ -276,47 +461,48 @@ void kb_mgt_proc_check_tap_timeouts(uint32_t current_time)
 
 static esp_err_t hid_init(void)
 {
-  memset(&hid_key_report, 0, sizeof(kb_mgt_hid_key_report_t));
+  memset(hid_src, 0, sizeof(hid_src));
   memset(&hid_consumer_report, 0, sizeof(kb_mgt_hid_consumer_report_t));
+  memset(&hid_key_sent, 0, sizeof(kb_mgt_hid_key_report_t));
+  memset(&hid_consumer_sent, 0, sizeof(kb_mgt_hid_consumer_report_t));
+  atomic_store(&hid_boot_protocol, false);
+  atomic_store(&hid_att_mtu, HID_ATT_MTU_DEFAULT);
+  hid_sent_nkro = HID_NKRO_ENABLE && HID_ATT_MTU_DEFAULT >= HID_NKRO_MIN_MTU;
+#if IS_MASTER
+  hid_tx.head = 0;
+  hid_tx.count = 0;
+  hid_tx.issued = 0;
+  hid_tx.failing = false;
+  atomic_store(&hid_tx.completed, 0);
+#endif
 
-  ESP_LOGI(TAG, "HID management initialized");
+  ESP_LOGI(TAG, "HID management initialized (%s)",
+           HID_NKRO_ENABLE ? "NKRO" : "6KRO");
   return ESP_OK;
 }
 
 static result_t hid_add_key_unsafe(uint8_t keycode)
 {
   ESP_LOGD(TAG, "Adding key 0x%02x to HID report", keycode);
-  for (int i = 0; i < HID_MAX_KEYS_IN_REPORT; i++)
+  if (keycode >= HID_NKRO_USAGE_COUNT)
   {
-    if (hid_key_report.keys[i] == 0)
-    {
-      hid_key_report.keys[i] = keycode;
-      ESP_LOGD(TAG, "Added key 0x%02x to slot %d", keycode, i);
-      return SUCCESS;
-    }
+    ESP_LOGW(TAG, "Key 0x%02x is outside the keyboard report", keycode);
+    return INVALID_PARAM;
   }
 
-  ESP_LOGW(TAG, "HID report full, cannot add key 0x%02x", keycode);
-  return REPORT_FULL;
+  if (keycode != HID_KEY_NONE)
+  {
+    hid_src[HID_SRC_LOCAL].keys[keycode >> 3] |= 1U << (keycode & 7);
+  }
+  return SUCCESS;
 }
 
 static void hid_remove_key_unsafe(uint8_t keycode)
 {
   ESP_LOGD(TAG, "Removing key 0x%02x from HID report", keycode);
-  for (int i = 0; i < HID_MAX_KEYS_IN_REPORT; i++)
+  if (keycode < HID_NKRO_USAGE_COUNT)
   {
-    if (hid_key_report.keys[i] == keycode)
-    {
-      // Shift remaining keys down
-      for (int j = i; j < HID_KEY_SHIFT_LAST_IDX; j++)
-      {
-        hid_key_report.keys[j] = hid_key_report.keys[j + 1];
-      }
-      hid_key_report.keys[HID_KEY_SHIFT_LAST_IDX] = 0;
-
-      ESP_LOGD(TAG, "Successfully removed key 0x%02x from slot %d", keycode, i);
-      break;
-    }
+    hid_src[HID_SRC_LOCAL].keys[keycode >> 3] &= ~(1U << (keycode & 7));
   }
 }
 
@@ -329,349 +515,1914 @@ static void hid_clear_consumer_unsafe(void) { hid_consumer_report.usage = 0; }
 
 static void hid_set_modifier_unsafe(uint8_t modifier)
 {
-  hid_key_report.modifiers |= modifier;
+  hid_src[HID_SRC_LOCAL].modifiers |= modifier;
 }
 
 static void hid_clear_modifier_unsafe(uint8_t modifier)
 {
-  hid_key_report.modifiers &= ~modifier;
+  hid_src[HID_SRC_LOCAL].modifiers &= ~modifier;
 }
 
-// =============================================================================
-// SUBSYSTEM 2: LAYER MANAGEMENT
-// =============================================================================
-
-static esp_err_t layer_init(void)
+#if IS_MASTER
+// 6KRO view of the bitmap: the first six held usages, or ErrorRollOver in
+// every slot once more are held
+static void hid_build_boot_report(const kb_mgt_hid_key_report_t *report,
+                                  kb_mgt_hid_boot_report_t      *boot)
 {
-  proc_state.current_layer = DEFAULT_LAYER;
-  memset(proc_state.layer_momentary_active, false,
-         sizeof(proc_state.layer_momentary_active));
+  uint8_t count = 0;
 
-  ESP_LOGI(TAG, "Layer management initialized with default layer %d",
-           DEFAULT_LAYER);
-  return ESP_OK;
-}
+  memset(boot, 0, sizeof(kb_mgt_hid_boot_report_t));
+  boot->modifiers = report->modifiers;
 
-static void layer_activate_momentary_unsafe(uint8_t layer)
-{
-  if (layer < MAX_LAYERS)
+  for (uint8_t i = 0; i < HID_NKRO_BITMAP_BYTES; i++)
   {
-    proc_state.layer_momentary_active[layer] = true;
-
-    ESP_LOGD(TAG, "Layer %d momentary activated", layer);
+    for (uint8_t bits = report->keys[i]; bits; bits &= bits - 1)
+    {
+      if (count == HID_MAX_KEYS_IN_REPORT)
+      {
+        memset(boot->keys, HID_KEY_ERR_OVF, sizeof(boot->keys));
+        return;
+      }
+      boot->keys[count++] = i * 8 + __builtin_ctz(bits);
+    }
   }
 }
 
-static void layer_deactivate_momentary_unsafe(uint8_t layer)
+static esp_err_t hid_input_key_report(bool                           nkro,
+                                      const kb_mgt_hid_key_report_t *report)
 {
-  if (layer < MAX_LAYERS)
+  if (nkro)
   {
-    proc_state.layer_momentary_active[layer] = false;
-
-    ESP_LOGD(TAG, "Layer %d momentary deactivated", layer);
+    return esp_hidd_dev_input_set(hid_dev, 0, HID_NKRO_REPORT_ID,
+                                  (uint8_t *)report,
+                                  sizeof(kb_mgt_hid_key_report_t));
   }
+
+  kb_mgt_hid_boot_report_t boot;
+  hid_build_boot_report(report, &boot);
+  return esp_hidd_dev_input_set(hid_dev, 0, HID_KEYBOARD_REPORT_ID,
+                                (uint8_t *)&boot,
+                                sizeof(kb_mgt_hid_boot_report_t));
 }
 
-static void layer_toggle_unsafe(uint8_t layer)
+// True if going prev -> mid -> next can be sent as prev -> next, i.e. no key
+// or modifier changes in both steps
+static bool hid_report_mergeable(const kb_mgt_hid_key_report_t *prev,
+                                 const kb_mgt_hid_key_report_t *mid,
+                                 const kb_mgt_hid_key_report_t *next)
 {
-  if (layer < MAX_LAYERS)
-  {
-    proc_state.current_layer =
-        (proc_state.current_layer == layer) ? DEFAULT_LAYER : layer;
-#if !IS_MASTER
-    comm_send_event(KB_COMM_EVENT_LAYER_SYNC, &proc_state.current_layer);
-#endif
+  const uint8_t *p = (const uint8_t *)prev;
+  const uint8_t *m = (const uint8_t *)mid;
+  const uint8_t *n = (const uint8_t *)next;
 
-    ESP_LOGD(TAG, "Layer toggled to %d", proc_state.current_layer);
+  for (size_t i = 0; i < sizeof(kb_mgt_hid_key_report_t); i++)
+  {
+    if ((p[i] ^ m[i]) & (m[i] ^ n[i]))
+    {
+      return false;
+    }
   }
+  return true;
 }
 
-static bool layer_is_momentary_active(uint8_t layer)
+static void hid_tx_enqueue(const kb_mgt_hid_key_report_t *report)
 {
-  return (layer < MAX_LAYERS) ? proc_state.layer_momentary_active[layer]
-                              : false;
-}
+  uint8_t tail =
+      (hid_tx.head + hid_tx.count + HID_TX_FIFO_SIZE - 1) % HID_TX_FIFO_SIZE;
+  kb_mgt_hid_key_report_t *newest =
+      hid_tx.count ? &hid_tx.fifo[tail] : &hid_key_sent;
 
-// =============================================================================
-// SUBSYSTEM 3: KEY PROCESSOR
-// =============================================================================
+  if (memcmp(newest, report, sizeof(kb_mgt_hid_key_report_t)) == 0)
+  {
+    return;
+  }
 
-static esp_err_t proc_init(void)
-{
-  memset(&proc_state, 0, sizeof(proc_state_t));
-  proc_state.current_layer = DEFAULT_LAYER;
+  if (hid_tx.count > 0)
+  {
+    const kb_mgt_hid_key_report_t *before =
+        hid_tx.count > 1
+            ? &hid_tx.fifo[(tail + HID_TX_FIFO_SIZE - 1) % HID_TX_FIFO_SIZE]
+            : &hid_key_sent;
 
-  ESP_LOGI(TAG, "Key processor initialized");
-  return ESP_OK;
+    if (hid_report_mergeable(before, newest, report))
+    {
+      *newest = *report;
+      return;
+    }
+  }
+
+  if (hid_tx.count == HID_TX_FIFO_SIZE)
+  {
+    // Link is badly behind, push the oldest out rather than lose a transition.
+    // If the stack refuses it too it is dropped, the newer states still follow.
+    ESP_LOGW(TAG, "HID TX queue full, sending without credit");
+    hid_tx_transmit(&hid_tx.fifo[hid_tx.head]);
+    hid_tx.head = (hid_tx.head + 1) % HID_TX_FIFO_SIZE;
+    hid_tx.count--;
+  }
+
+  hid_tx.fifo[(hid_tx.head + hid_tx.count) % HID_TX_FIFO_SIZE] = *report;
+  hid_tx.count++;
 }
 
-static void proc_handle_press(key_def_t key, uint8_t row, uint8_t col,
-                              uint32_t timestamp)
+// False if the stack refused the report, the caller keeps it for a retry
+static bool hid_tx_transmit(const kb_mgt_hid_key_report_t *report)
 {
-  ESP_LOGD(TAG, "Processing key press at [%d:%d], type=%d", row, col, key.type);
+  esp_err_t ret = ESP_OK;
+
+  if (!hid_dev)
+  {
+    return true;
+  }
+
+  // Boot protocol hosts only parse the 6KRO report, and a notification
+  // smaller than the NKRO report would cut it short
+  bool nkro_fits = atomic_load_explicit(&hid_att_mtu, memory_order_relaxed) >=
+                   HID_NKRO_MIN_MTU;
+  bool nkro = HID_NKRO_ENABLE && nkro_fits &&
+              !atomic_load_explicit(&hid_boot_protocol, memory_order_relaxed);
 
-  // TAP-PREFERRED: Check for pending tap-hold keys and resolve them as TAP when
-  // another key is pressed
-  for (uint8_t r = 0; r < MATRIX_ROW; r++)
+  // The MTU only shrinks with a new connection, which never saw an NKRO
+  // report to release
+  if (hid_sent_nkro && !nkro_fits)
   {
-    for (uint8_t c = 0; c < MATRIX_COL; c++)
+    hid_sent_nkro = false;
+  }
+
+  if (nkro != hid_sent_nkro)
+  {
+    static const kb_mgt_hid_key_report_t released = {0};
+    ret = hid_input_key_report(hid_sent_nkro, &released);
+    if (ret == ESP_OK)
     {
-      if (!proc_state.pressed_key_active[r][c])
-        continue;
-      if (r == row && c == col)
-        continue;
+      hid_sent_nkro = nkro;
+    }
+  }
 
-      uint16_t timeout_ms = proc_state.key_tap_timeout[r][c];
-      if (timeout_ms == 0)
-        timeout_ms = DEFAULT_TIMEOUT_MS;
+  if (ret == ESP_OK)
+  {
+    ret = hid_input_key_report(nkro, report);
+  }
 
-      key_def_t held_key = proc_state.pressed_keys[r][c];
-      bool      already_resolved = proc_state.key_is_tapped[r][c];
+  if (ret != ESP_OK)
+  {
+    if (!hid_tx.failing)
+    {
+      ESP_LOGE(TAG, "Key report not sent, retrying: %s", esp_err_to_name(ret));
+      hid_tx.failing = true;
+      hid_tx.failed_at = get_current_time_us();
+    }
+    return false;
+  }
 
-      if (already_resolved)
-        continue;
+  hid_tx.failing = false;
+  hid_key_sent = *report;
+  hid_tx.issued++;
+  hid_tx.issued_at = get_current_time_us();
+  return true;
+}
 
-      // LayerTap: send tap key immediately when another key is pressed
-      if (held_key.type == KEY_TYPE_LAYER_TAP)
-      {
-        uint32_t held_time = timestamp - proc_state.layer_tap_timer[r][c];
-        if (held_time < timeout_ms)
-        {
-          hid_add_key_unsafe(held_key.layer_tap.tap_key);
-          proc_state.key_is_tapped[r][c] = true;
-          ESP_LOGD(TAG, "LayerTap resolved as TAP at [%d:%d]", r, c);
-        }
-      }
+// Sends queued reports while transmit credits are available
+static void hid_tx_flush(time_us_t now)
+{
+  // A notification that never completed (dropped link) must not stall output
+  if (hid_tx_in_flight() > 0 &&
+      time_elapsed_us(now, hid_tx.issued_at) >= TIME_MS_TO_US(HID_TX_STALL_MS))
+  {
+    hid_tx.issued = atomic_load_explicit(&hid_tx.completed,
+                                         memory_order_relaxed);
+  }
 
-      // ModTap: send tap key immediately when another key is pressed
-      if (held_key.type == KEY_TYPE_MOD_TAP)
+  while (hid_tx.count > 0 && hid_tx_in_flight() < HID_TX_CREDITS)
+  {
+    if (!hid_tx_transmit(&hid_tx.fifo[hid_tx.head]))
+    {
+      // Refused past the stall timeout (link gone): replaying every queued
+      // transition later would type stale keys, only the newest state goes
+      if (hid_tx.count > 1 &&
+          time_elapsed_us(now, hid_tx.failed_at) >=
+              TIME_MS_TO_US(HID_TX_STALL_MS))
       {
-        uint32_t held_time = timestamp - proc_state.mod_tap_timer[r][c];
-        if (held_time < timeout_ms)
-        {
-          hid_add_key_unsafe(held_key.mod_tap.tap_key);
-          proc_state.key_is_tapped[r][c] = true;
-          ESP_LOGD(TAG, "ModTap resolved as TAP at [%d:%d]", r, c);
-        }
+        ESP_LOGW(TAG, "Dropping %d queued key reports", hid_tx.count - 1);
+        hid_tx.head = (hid_tx.head + hid_tx.count - 1) % HID_TX_FIFO_SIZE;
+        hid_tx.count = 1;
       }
+      return;
     }
+    hid_tx.head = (hid_tx.head + 1) % HID_TX_FIFO_SIZE;
+    hid_tx.count--;
   }
+}
 
-  switch (key.type)
+static uint32_t hid_tx_in_flight(void)
+{
+  uint32_t completed =
+      atomic_load_explicit(&hid_tx.completed, memory_order_relaxed);
+  int32_t in_flight = (int32_t)(hid_tx.issued - completed);
+
+  // Completions for notifications we did not issue (battery service)
+  if (in_flight < 0)
   {
-  case KEY_TYPE_NORMAL:
-    ESP_LOGD(TAG, "Processing normal key: keycode=0x%02x", key.keycode);
-    hid_add_key_unsafe(key.keycode);
-    break;
+    hid_tx.issued = completed;
+    return 0;
+  }
+  return in_flight;
+}
 
-  case KEY_TYPE_CONSUMER:
-    hid_set_consumer_unsafe(key.consumer);
-    kb_mgt_hid_send_consumer_report_unsafe();
-    break;
+static void hid_send_key_report_unsafe(void)
+{
+  kb_mgt_hid_key_report_t report;
+
+  hid_merge_key_report(&report);
+  hid_tx_enqueue(&report);
+  hid_tx_flush(get_current_time_us());
+}
+#else
+static void hid_send_key_report_unsafe(void)
+{
+  kb_mgt_hid_key_report_t report;
+
+  hid_merge_key_report(&report);
+  if (memcmp(&hid_key_sent, &report, sizeof(kb_mgt_hid_key_report_t)) == 0)
+  {
+    return;
+  }
+
+  hid_key_sent = report;
+  hid_key_sent_seq = comm_send_event(KB_COMM_EVENT_TAP, &report);
+}
+#endif
+
+// Union of all contributions: modifiers OR-ed, keys deduplicated by the bitmap
+static void hid_merge_key_report(kb_mgt_hid_key_report_t *out)
+{
+  *out = hid_src[HID_SRC_LOCAL];
+
+  for (int src = HID_SRC_LOCAL + 1; src < HID_SRC_COUNT; src++)
+  {
+    out->modifiers |= hid_src[src].modifiers;
+    for (int i = 0; i < HID_NKRO_BITMAP_BYTES; i++)
+    {
+      out->keys[i] |= hid_src[src].keys[i];
+    }
+  }
+}
+
+#if IS_MASTER
+static void hid_send_consumer_report_unsafe(void)
+{
+  if (hid_consumer_report.usage == hid_consumer_sent.usage)
+  {
+    return;
+  }
+
+  if (hid_dev)
+  {
+    ESP_LOGI(TAG, "Sending consumer report: usage=0x%04X",
+             hid_consumer_report.usage);
+    esp_err_t ret =
+        esp_hidd_dev_input_set(hid_dev, 0, 2, (uint8_t *)(&hid_consumer_report),
+                               sizeof(kb_mgt_hid_consumer_report_t));
+    if (ret != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to send consumer report: %d", ret);
+      return;
+    }
+    hid_consumer_sent = hid_consumer_report;
+  }
+}
+#else
+static void hid_send_consumer_report_unsafe(void)
+{
+  if (hid_consumer_report.usage == hid_consumer_sent.usage)
+  {
+    return;
+  }
+
+  hid_consumer_sent = hid_consumer_report;
+  comm_send_event(KB_COMM_EVENT_CONSUMER, &hid_consumer_report);
+}
+#endif
+
+// =============================================================================
+// SUBSYSTEM 2: LAYER MANAGEMENT
+// =============================================================================
+
+static esp_err_t layer_init(void)
+{
+  proc_state.layer_base = LAYER_BIT(DEFAULT_LAYER);
+  proc_state.layer_momentary = 0;
+  proc_state.layer_remote = 0;
+  proc_state.layer_synced = proc_state.layer_base;
+  keymap_cache.layer = MAX_LAYERS; // Force the first build
+  layer_refresh_cache_unsafe();
+
+  ESP_LOGI(TAG, "Layer management initialized with default layer %d",
+           DEFAULT_LAYER);
+  return ESP_OK;
+}
+
+static void layer_activate_momentary_unsafe(uint8_t layer)
+{
+  if (layer < MAX_LAYERS)
+  {
+    proc_state.layer_momentary |= LAYER_BIT(layer);
+    layer_sync_unsafe();
+
+    ESP_LOGD(TAG, "Layer %d momentary activated", layer);
+  }
+}
+
+static void layer_deactivate_momentary_unsafe(uint8_t layer)
+{
+  if (layer < MAX_LAYERS)
+  {
+    proc_state.layer_momentary &= ~LAYER_BIT(layer);
+    layer_sync_unsafe();
+
+    ESP_LOGD(TAG, "Layer %d momentary deactivated", layer);
+  }
+}
+
+static void layer_toggle_unsafe(uint8_t layer)
+{
+  if (layer < MAX_LAYERS)
+  {
+    proc_state.layer_base = (proc_state.layer_base == LAYER_BIT(layer))
+                                ? LAYER_BIT(DEFAULT_LAYER)
+                                : LAYER_BIT(layer);
+    layer_sync_unsafe();
+
+    ESP_LOGD(TAG, "Base layer toggled to %d",
+             31 - __builtin_clz(proc_state.layer_base));
+  }
+}
+
+static bool layer_is_momentary_active(uint8_t layer)
+{
+  return (layer < MAX_LAYERS) &&
+         (proc_state.layer_momentary & LAYER_BIT(layer)) != 0;
+}
+
+// Sends this half's layer mask to the other half whenever it changes
+static void layer_sync_unsafe(void)
+{
+  uint32_t local = proc_state.layer_base | proc_state.layer_momentary;
+
+  layer_refresh_cache_unsafe();
+
+  if (local != proc_state.layer_synced)
+  {
+    proc_state.layer_synced = local;
+    comm_send_event(KB_COMM_EVENT_LAYER_SYNC, &local);
+  }
+}
+
+// Rebuilds keymap_cache when the active layer moved, so a press costs one
+// lookup however deep the TRANSPARENT chain is
+static void layer_refresh_cache_unsafe(void)
+{
+  uint8_t active = kb_mgt_layer_get_active();
+
+  if (active == keymap_cache.layer)
+  {
+    return;
+  }
+
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  {
+    for (uint8_t col = 0; col < MATRIX_COL; col++)
+    {
+      key_def_t key = keymap_get_key(active, row, col);
+
+      for (int layer = active - 1;
+           key.type == KEY_TYPE_TRANSPARENT && layer >= 0; layer--)
+      {
+        key = keymap_get_key(layer, row, col);
+      }
+      keymap_cache.keys[row][col] = key;
+    }
+  }
+
+  keymap_cache.layer = active;
+  ESP_LOGD(TAG, "Keymap cache rebuilt for layer %d", active);
+}
+
+// =============================================================================
+// SUBSYSTEM 3: KEY PROCESSOR
+// =============================================================================
+
+static esp_err_t proc_init(void)
+{
+  proc_state.held_mask = 0;
+  proc_state.pending = PROC_SLOT_NONE;
+  proc_state.last_tap.valid = false;
+  proc_state.typing.valid = false;
+  proc_state.typing.interval_us = TIME_MS_TO_US(PROC_TYPING_INTERVAL_MAX_MS);
+  proc_state.pending_sent_ms = 0;
+  proc_state.remote_pending = false;
+  proc_queue.count = 0;
+  proc_queue.held_back = 0;
+
+  timers.count = 0;
+  memset(timers.pos, TIMER_NONE, sizeof(timers.pos));
+
+  ESP_LOGI(TAG, "Key processor initialized");
+  return ESP_OK;
+}
+
+// Single consumer side of the scan ring
+static bool proc_ring_pop(key_event_t *event)
+{
+  uint_fast32_t tail =
+      atomic_load_explicit(&key_ring.tail, memory_order_relaxed);
+  uint_fast32_t head =
+      atomic_load_explicit(&key_ring.head, memory_order_acquire);
+
+  if (tail == head)
+  {
+    return false;
+  }
+
+  *event = key_ring.slots[tail & (KEY_EVENT_RING_SIZE - 1)];
+  atomic_store_explicit(&key_ring.tail, tail + 1, memory_order_release);
+  return true;
+}
+
+// Appends a scan event and processes everything that need not wait
+static void proc_queue_event(const key_event_t *event)
+{
+  // Only events held back behind a pending key stay queued, so a full queue
+  // means it has been interrupted for long enough to count as a hold
+  while (proc_queue.count == PROC_MAX_QUEUED_EVENTS)
+  {
+    if (proc_pending() != NULL)
+    {
+      ESP_LOGW(TAG, "Key event queue full, resolving pending key as hold");
+      proc_decide(proc_pending(), PROC_HOLD);
+    }
+    else if (proc_state.remote_pending)
+    {
+      ESP_LOGW(TAG, "Key event queue full, no longer waiting on other half");
+      proc_state.remote_pending = false;
+      proc_queue.held_back = 0;
+    }
+    else
+    {
+      break;
+    }
+    proc_run_queue();
+  }
+
+  if (proc_queue.count == PROC_MAX_QUEUED_EVENTS)
+  {
+    ESP_LOGE(TAG, "Key event queue full, dropping event at [%d:%d]",
+             event->row, event->col);
+    return;
+  }
+
+  proc_queue.events[proc_queue.count++] = *event;
+  proc_run_queue();
+}
+
+static void proc_run_queue(void)
+{
+  while (proc_queue.held_back < proc_queue.count)
+  {
+    key_event_t     *event = &proc_queue.events[proc_queue.held_back];
+    proc_held_key_t *pending = proc_pending();
+
+    // A deadline reached before this event decides first, and whatever was
+    // held back goes ahead of it
+    if (proc_check_tap_timeouts(event->timestamp))
+    {
+      continue;
+    }
+
+    if (pending == NULL && event->row == PROC_REMOTE_ROW)
+    {
+      // Nothing here is waiting on the other half's keys
+      proc_queue_remove(proc_queue.held_back);
+      continue;
+    }
+
+    if (pending == NULL && proc_state.remote_pending)
+    {
+      // The other half is deciding a tap-hold key; our keys reach the host
+      // after whatever it decides
+      proc_queue.held_back++;
+      continue;
+    }
+
+    if (pending != NULL && pending->key.type == KEY_TYPE_TAP_DANCE)
+    {
+      if (event->row == pending->row && event->col == pending->col)
+      {
+        // Its own presses and releases count taps, unless one decides it
+        uint8_t index = event - proc_queue.events;
+        if (dance_edge(pending, event))
+        {
+          proc_queue_remove(index);
+        }
+        continue;
+      }
+
+      // Any other press ends the dance. Releases can only be of keys that
+      // were down before it started, they go straight through.
+      if (event->pressed)
+      {
+        proc_decide(pending, PROC_TAP);
+        continue;
+      }
+    }
+    else if (pending != NULL)
+    {
+      if (event->row != pending->row || event->col != pending->col)
+      {
+        proc_queue.held_back++;
+        proc_hold_back(pending, event);
+        continue;
+      }
+
+      if (!event->pressed)
+      {
+        // Let go before anything decided it
+        proc_decide(pending, PROC_TAP);
+        continue;
+      }
+    }
+
+    key_event_t next = proc_queue_remove(proc_queue.held_back);
+
+    proc_handle_event(&next);
+
+    // Events released by a decision each get their own report, so no press
+    // or release among them is folded away
+    if (proc_queue.count > 0)
+    {
+      hid_send_key_report_unsafe();
+    }
+  }
+}
+
+static key_event_t proc_queue_remove(uint8_t index)
+{
+  key_event_t event = proc_queue.events[index];
+
+  proc_queue.count--;
+  memmove(&proc_queue.events[index], &proc_queue.events[index + 1],
+          (proc_queue.count - index) * sizeof(key_event_t));
+  return event;
+}
+
+// Applies the pending key's flavor to an event that was just held back
+static void proc_hold_back(proc_held_key_t *pending, const key_event_t *event)
+{
+  uint8_t flavor = proc_flavor(pending);
+
+  if (event->pressed)
+  {
+    pending->interrupted = true;
+    if (flavor == HOLD_TAP_OPPOSITE_HANDS)
+    {
+      // A chord across the halves, a roll on this one
+      proc_decide(pending, proc_other_half(event) ? PROC_HOLD : PROC_TAP);
+    }
+    else if (flavor == HOLD_TAP_HOLD_PREFERRED)
+    {
+      proc_decide(pending, PROC_HOLD);
+    }
+    return;
+  }
+
+  if (flavor != HOLD_TAP_BALANCED && flavor != HOLD_TAP_PERMISSIVE_HOLD)
+  {
+    return;
+  }
+
+  // A key pressed and released while the pending one is held is a chord
+  for (uint8_t i = 0; i + 1 < proc_queue.held_back; i++)
+  {
+    const key_event_t *earlier = &proc_queue.events[i];
+
+    if (earlier->pressed && earlier->row == event->row &&
+        earlier->col == event->col)
+    {
+      proc_decide(pending, PROC_HOLD);
+      return;
+    }
+  }
+}
+
+// Combo events (PROC_COMBO_ROW) count by their member keys. Combos are
+// matched on this half's scan events only, so all of them are on this half.
+static bool proc_other_half(const key_event_t *event)
+{
+  return event->row == PROC_REMOTE_ROW;
+}
+
+// Mirrors a scan event to the other half while it is deciding a tap-hold
+// key, so our keys interrupt it like its own
+static void proc_send_key_event(const key_event_t *event)
+{
+  if (!proc_state.remote_pending)
+  {
+    return;
+  }
+
+#if !IS_MASTER
+  uint8_t keymap_col = MATRIX_COL - 1 - event->col;
+#else
+  uint8_t keymap_col = event->col;
+#endif
+  kb_comm_key_event_t msg = {
+      .age_us = time_elapsed_us(get_current_time_us(), event->timestamp),
+      .pos = KEY_POS(event->row, keymap_col),
+      .pressed = event->pressed,
+  };
+  comm_send_event(KB_COMM_EVENT_KEY_EVENT, &msg);
+}
+
+// Tells the other half when a tap-hold key starts or stops waiting here, and
+// how long it may, so it holds its own keys back meanwhile. Repeated every
+// PROC_PENDING_RESEND_MS while the key waits.
+static void proc_sync_pending(time_us_t now)
+{
+  proc_held_key_t *pending = proc_pending();
+  uint16_t         timeout_ms = pending ? proc_timeout_us(pending) / 1000 : 0;
+  time_us_t        resend_at;
+
+  if (timeout_ms == proc_state.pending_sent_ms &&
+      (!proc_resend_deadline(&resend_at) || !time_reached(now, resend_at)))
+  {
+    return;
+  }
+
+  proc_state.pending_sent_ms = timeout_ms;
+  proc_state.pending_sent_at = now;
+  comm_send_event(KB_COMM_EVENT_HOLD_PENDING, &timeout_ms);
+}
+
+static bool proc_resend_deadline(time_us_t *deadline)
+{
+  if (proc_state.pending_sent_ms == 0)
+  {
+    return false;
+  }
+
+  *deadline =
+      proc_state.pending_sent_at + TIME_MS_TO_US(PROC_PENDING_RESEND_MS);
+  return true;
+}
+
+// Stops waiting on the other half once its decision is overdue, returns true
+// if that let events go
+static bool proc_check_remote_pending(time_us_t now)
+{
+  time_us_t deadline;
+
+  if (!proc_remote_deadline(&deadline) || !time_reached(now, deadline))
+  {
+    return false;
+  }
+
+  ESP_LOGW(TAG, "Other half never settled its tap-hold key");
+  proc_state.remote_pending = false;
+  if (proc_pending() == NULL)
+  {
+    proc_queue.held_back = 0;
+  }
+  return true;
+}
+
+static bool proc_remote_deadline(time_us_t *deadline)
+{
+  if (!proc_state.remote_pending)
+  {
+    return false;
+  }
+
+  *deadline = proc_state.remote_pending_until;
+  return true;
+}
+
+static void proc_handle_event(const key_event_t *event)
+{
+  if (event->row == PROC_REMOTE_ROW)
+  {
+    // Only mattered while something here was undecided
+    return;
+  }
+
+  if (!event->pressed)
+  {
+    proc_handle_release(event->row, event->col, event->timestamp);
+    return;
+  }
+
+  if (event->row == PROC_COMBO_ROW)
+  {
+    proc_handle_press(keymap_decode(keymap_get_combo(event->col)->action),
+                      event->row, event->col, event->timestamp);
+    return;
+  }
+
+  // Mirror column mapping for slave half
+#if !IS_MASTER
+  uint8_t keymap_col = MATRIX_COL - 1 - event->col;
+#else
+  uint8_t keymap_col = event->col;
+#endif
+
+  proc_handle_press(keymap_cache.keys[event->row][keymap_col], event->row,
+                    event->col, event->timestamp);
+}
+
+// Settles tap-hold keys whose deadline is reached by `now`, returns true if
+// any was decided
+static bool proc_check_tap_timeouts(time_us_t now)
+{
+  bool      decided = false;
+  time_us_t deadline;
+
+  while (timer_next_deadline(&deadline) && time_reached(now, deadline))
+  {
+    proc_held_key_t *held = &proc_state.held[timers.heap[0]];
+
+    timer_cancel(held);
+
+    // A dance waiting for its next tap ends with the taps it has
+    proc_decide(held, held->released ? PROC_TAP : PROC_HOLD);
+    decided = true;
+  }
+
+  return decided;
+}
+
+// Commits a tap-hold key and lets the events held back behind it go
+static void proc_decide(proc_held_key_t *held, proc_decision_t decision)
+{
+  const key_def_t *key = &held->key;
+
+  held->decision = decision;
+  timer_cancel(held);
+  if (held == proc_pending())
+  {
+    proc_state.pending = PROC_SLOT_NONE;
+    proc_queue.held_back = 0;
+  }
+
+  switch (key->type)
+  {
+  case KEY_TYPE_TAP_DANCE:
+    dance_commit(held, decision);
+    return;
+
+  case KEY_TYPE_LAYER_TAP:
+    if (decision == PROC_HOLD)
+    {
+      layer_activate_momentary_unsafe(key->layer_tap.layer);
+    }
+    else
+    {
+      hid_add_key_unsafe(key->layer_tap.tap_key);
+    }
+    break;
+
+  case KEY_TYPE_MOD_TAP:
+    if (decision == PROC_HOLD)
+    {
+      hid_set_modifier_unsafe(key->mod_tap.hold_key);
+    }
+    else
+    {
+      hid_add_key_unsafe(key->mod_tap.tap_key);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  ESP_LOGD(TAG, "Tap-hold at [%d:%d] resolved as %s", held->row, held->col,
+           decision == PROC_HOLD ? "HOLD" : "TAP");
+
+  // On the wire before any of the events that waited for it
+  hid_send_key_report_unsafe();
+}
+
+// True if a tap-hold key at this position was tapped moments ago, in which
+// case pressing it again taps (and holding it repeats) instead of holding
+static bool proc_quick_tap(uint8_t row, uint8_t col, time_us_t timestamp)
+{
+#if HOLD_TAP_QUICK_TAP_MS > 0
+  const proc_last_tap_t *last = &proc_state.last_tap;
+
+  return last->valid && last->row == row && last->col == col &&
+         time_elapsed_us(timestamp, last->released_at) <
+             TIME_MS_TO_US(HOLD_TAP_QUICK_TAP_MS);
+#else
+  return false;
+#endif
+}
+
+// Feeds a press of either half into the typing average and returns the time
+// since the previous one. A press shortly before the last one recorded (held
+// back while a later one from the other half came in) returns 0 and is not
+// counted. Anything further back is the clock having wrapped since, a pause.
+static uint32_t proc_typing_record(time_us_t timestamp)
+{
+  proc_typing_t *typing = &proc_state.typing;
+  uint32_t       interval = TIME_MS_TO_US(PROC_TYPING_INTERVAL_MAX_MS);
+
+  if (typing->valid)
+  {
+    if (!time_reached(timestamp, typing->last_press_at) &&
+        time_elapsed_us(typing->last_press_at, timestamp) < interval)
+    {
+      return 0;
+    }
+    if (time_reached(timestamp, typing->last_press_at) &&
+        time_elapsed_us(timestamp, typing->last_press_at) < interval)
+    {
+      interval = time_elapsed_us(timestamp, typing->last_press_at);
+    }
+  }
+
+  typing->interval_us = typing->interval_us -
+                        (typing->interval_us >> PROC_TYPING_EWMA_SHIFT) +
+                        (interval >> PROC_TYPING_EWMA_SHIFT);
+  typing->last_press_at = timestamp;
+  typing->valid = true;
+
+  return interval;
+}
+
+// Records a local press. True if it is typing: it follows the previous press
+// within the prior-idle window and keeps the current cadence. A gap well past
+// the average is a pause before a chord even inside the window.
+static bool proc_typing_press(time_us_t timestamp)
+{
+  uint64_t cadence = (uint64_t)proc_state.typing.interval_us *
+                     PROC_TYPING_PAUSE_PCT / 100;
+  uint32_t interval = proc_typing_record(timestamp);
+
+#if HOLD_TAP_PRIOR_IDLE_MS > 0
+  return interval < TIME_MS_TO_US(HOLD_TAP_PRIOR_IDLE_MS) &&
+         interval < cadence;
+#else
+  (void)cadence;
+  (void)interval;
+  return false;
+#endif
+}
+
+static void proc_handle_press(key_def_t key, uint8_t row, uint8_t col,
+                              time_us_t timestamp)
+{
+  ESP_LOGD(TAG, "Processing key press at [%d:%d], type=%d", row, col, key.type);
+
+  bool typing = proc_typing_press(timestamp);
+
+  // Keys already down no longer count as held alone (retro-tap)
+  for (uint32_t m = proc_state.held_mask; m; m &= m - 1)
+  {
+    proc_state.held[__builtin_ctz(m)].interrupted = true;
+  }
+
+  proc_press_action(key);
+
+  // Store the pressed key for release processing
+  proc_held_key_t *held = proc_store_pressed_key(row, col, key, timestamp);
+  if (held == NULL)
+  {
+    ESP_LOGW(TAG, "Held key table full, release at [%d:%d] will be ignored",
+             row, col);
+    return;
+  }
+
+  if (key.type == KEY_TYPE_TAP_DANCE)
+  {
+    dance_start(held);
+    return;
+  }
+
+  if (key.type != KEY_TYPE_LAYER_TAP && key.type != KEY_TYPE_MOD_TAP)
+  {
+    return;
+  }
+
+  held->timeout_ms = key.type == KEY_TYPE_LAYER_TAP
+                         ? key.layer_tap.tap_timeout_ms
+                         : key.mod_tap.tap_timeout_ms;
+
+  // Mid-word a home-row mod is a letter, deciding now spares the hold-back
+  if (proc_quick_tap(row, col, timestamp) ||
+      (typing && key.type == KEY_TYPE_MOD_TAP))
+  {
+    proc_decide(held, PROC_TAP);
+    return;
+  }
+
+  proc_state.pending = held - proc_state.held;
+  timer_arm(held);
+}
+
+// What pressing a key does right away. Tap-hold and dance keys do nothing
+// until they are decided.
+static void proc_press_action(key_def_t key)
+{
+  switch (key.type)
+  {
+  case KEY_TYPE_NORMAL:
+    ESP_LOGD(TAG, "Processing normal key: keycode=0x%02x", key.keycode);
+    hid_add_key_unsafe(key.keycode);
+    break;
+
+  case KEY_TYPE_CONSUMER:
+    hid_set_consumer_unsafe(key.consumer);
+    hid_send_consumer_report_unsafe();
+    break;
+
+  case KEY_TYPE_MODIFIER:
+    hid_set_modifier_unsafe(key.modifier);
+    break;
+
+  case KEY_TYPE_SHIFTED:
+    hid_set_modifier_unsafe(HID_MOD_LEFT_SHIFT);
+    hid_add_key_unsafe(key.keycode);
+    break;
+
+  case KEY_TYPE_LAYER_TAP:
+  case KEY_TYPE_MOD_TAP:
+  case KEY_TYPE_TAP_DANCE:
+    // Decided later by its flavor, the timeout, the release or more taps
+    break;
+
+  case KEY_TYPE_LAYER_MOMENTARY:
+    layer_activate_momentary_unsafe(key.layer);
+    break;
+
+  case KEY_TYPE_LAYER_TOGGLE:
+    layer_toggle_unsafe(key.layer);
+    break;
+
+  case KEY_TYPE_TRANSPARENT:
+    // keymap_cache already fell through; transparent on every layer
+    break;
+
+  case KEY_TYPE_MACRO:
+    // Plays from the task loop, paced by the transport
+    macro_enqueue(key.macro_id);
+    break;
+
+  default:
+    ESP_LOGW(TAG, "Unknown key type: %d", key.type);
+    break;
+  }
+}
+
+static void proc_handle_release(uint8_t row, uint8_t col, time_us_t timestamp)
+{
+  proc_held_key_t *held = proc_find_held(row, col);
+  if (held == NULL)
+  {
+    ESP_LOGW(TAG, "No stored key found for release at [%d:%d]", row, col);
+    return;
+  }
+
+  key_def_t stored_key = held->key;
+
+  ESP_LOGD(TAG, "Processing key release at [%d:%d], type=%d", row, col,
+           stored_key.type);
+
+  switch (stored_key.type)
+  {
+  case KEY_TYPE_NORMAL:
+    hid_remove_key_unsafe(stored_key.keycode);
+    break;
+
+  case KEY_TYPE_CONSUMER:
+    hid_clear_consumer_unsafe();
+    hid_send_consumer_report_unsafe(); // Send clear immediately to
+    // release the key
+    break;
+
+  case KEY_TYPE_MODIFIER:
+    hid_clear_modifier_unsafe(stored_key.modifier);
+    break;
+
+  case KEY_TYPE_SHIFTED:
+    hid_clear_modifier_unsafe(HID_MOD_LEFT_SHIFT);
+    hid_remove_key_unsafe(stored_key.keycode);
+    break;
+
+  case KEY_TYPE_LAYER_TAP:
+  case KEY_TYPE_MOD_TAP:
+    proc_release_tap_hold(held, timestamp);
+    break;
+
+  case KEY_TYPE_LAYER_MOMENTARY:
+    layer_deactivate_momentary_unsafe(stored_key.layer);
+    break;
+
+  default:
+    break;
+  }
+
+  proc_clear_held(held);
+}
+
+// Undoes what a tap-hold key decided. A hold that no other key interrupted
+// and that ends inside the retro-tap window still sends its tap.
+static void proc_release_tap_hold(const proc_held_key_t *held,
+                                  time_us_t              timestamp)
+{
+  const key_def_t *key = &held->key;
+  uint8_t          tap_key = proc_tap_key(held);
+
+  if (held->decision == PROC_TAP)
+  {
+    hid_remove_key_unsafe(tap_key);
+    proc_state.last_tap = (proc_last_tap_t){
+        .released_at = timestamp,
+        .row = held->row,
+        .col = held->col,
+        .valid = true,
+    };
+    return;
+  }
+
+  if (key->type == KEY_TYPE_LAYER_TAP)
+  {
+    layer_deactivate_momentary_unsafe(key->layer_tap.layer);
+  }
+  else
+  {
+    hid_clear_modifier_unsafe(key->mod_tap.hold_key);
+  }
+
+#if HOLD_TAP_RETRO_TAP_MS > 0
+  if (!held->interrupted && time_elapsed_us(timestamp, held->pressed_at) <
+                                TIME_MS_TO_US(HOLD_TAP_RETRO_TAP_MS))
+  {
+    // Release the hold first so the tap goes out on its own
+    hid_send_key_report_unsafe();
+    comm_handle_brief_tap(tap_key);
+    ESP_LOGD(TAG, "Retro-tap at [%d:%d]", held->row, held->col);
+  }
+#endif
+}
+
+// Records (or refreshes) the held key at a position. NULL if the table is full.
+static proc_held_key_t *proc_store_pressed_key(uint8_t row, uint8_t col,
+                                               key_def_t key,
+                                               time_us_t timestamp)
+{
+  proc_held_key_t *held = proc_find_held(row, col);
+
+  if (held == NULL)
+  {
+    uint32_t free_mask = ~proc_state.held_mask;
+    if (PROC_MAX_HELD_KEYS < 32)
+    {
+      free_mask &= (1U << PROC_MAX_HELD_KEYS) - 1;
+    }
+    if (free_mask == 0)
+    {
+      return NULL;
+    }
+
+    uint8_t slot = __builtin_ctz(free_mask);
+    proc_state.held_mask |= 1U << slot;
+    held = &proc_state.held[slot];
+  }
+  else
+  {
+    timer_cancel(held);
+  }
+
+  *held = (proc_held_key_t){
+      .key = key,
+      .pressed_at = timestamp,
+      .row = row,
+      .col = col,
+  };
+  return held;
+}
+
+static proc_held_key_t *proc_find_held(uint8_t row, uint8_t col)
+{
+  for (uint32_t m = proc_state.held_mask; m; m &= m - 1)
+  {
+    proc_held_key_t *held = &proc_state.held[__builtin_ctz(m)];
+
+    if (held->row == row && held->col == col)
+    {
+      return held;
+    }
+  }
+
+  return NULL;
+}
+
+static void proc_clear_held(proc_held_key_t *held)
+{
+  uint8_t slot = held - proc_state.held;
+
+  timer_cancel(held);
+  if (proc_state.pending == slot)
+  {
+    proc_state.pending = PROC_SLOT_NONE;
+  }
+  proc_state.held_mask &= ~(1U << slot);
+}
+
+// Undecided tap-hold key the queue is waiting on, NULL if none
+static proc_held_key_t *proc_pending(void)
+{
+  if (proc_state.pending == PROC_SLOT_NONE)
+  {
+    return NULL;
+  }
+  return &proc_state.held[proc_state.pending];
+}
+
+static time_us_t proc_timeout_us(const proc_held_key_t *held)
+{
+  return TIME_MS_TO_US(held->timeout_ms ? held->timeout_ms
+                                        : DEFAULT_TIMEOUT_MS);
+}
+
+static uint8_t proc_flavor(const proc_held_key_t *held)
+{
+  return held->key.type == KEY_TYPE_LAYER_TAP ? held->key.layer_tap.flavor
+                                              : held->key.mod_tap.flavor;
+}
+
+static uint8_t proc_tap_key(const proc_held_key_t *held)
+{
+  return held->key.type == KEY_TYPE_LAYER_TAP ? held->key.layer_tap.tap_key
+                                              : held->key.mod_tap.tap_key;
+}
+
+// =============================================================================
+// SUBSYSTEM 3b: TAP-HOLD TIMERS
+// =============================================================================
+
+static time_us_t timer_deadline(uint8_t heap_idx)
+{
+  const proc_held_key_t *held = &proc_state.held[timers.heap[heap_idx]];
+  return held->pressed_at + proc_timeout_us(held);
+}
+
+static void timer_swap(uint8_t a, uint8_t b)
+{
+  uint8_t slot = timers.heap[a];
+  timers.heap[a] = timers.heap[b];
+  timers.heap[b] = slot;
+  timers.pos[timers.heap[a]] = a;
+  timers.pos[timers.heap[b]] = b;
+}
+
+static void timer_sift_up(uint8_t idx)
+{
+  while (idx > 0)
+  {
+    uint8_t parent = (idx - 1) / 2;
+    if (time_reached(timer_deadline(idx), timer_deadline(parent)))
+    {
+      break;
+    }
+    timer_swap(idx, parent);
+    idx = parent;
+  }
+}
+
+static void timer_sift_down(uint8_t idx)
+{
+  while (1)
+  {
+    uint8_t first = idx;
+    uint8_t left = 2 * idx + 1;
+    uint8_t right = left + 1;
+
+    if (left < timers.count &&
+        !time_reached(timer_deadline(left), timer_deadline(first)))
+    {
+      first = left;
+    }
+    if (right < timers.count &&
+        !time_reached(timer_deadline(right), timer_deadline(first)))
+    {
+      first = right;
+    }
+    if (first == idx)
+    {
+      break;
+    }
+    timer_swap(idx, first);
+    idx = first;
+  }
+}
+
+static void timer_arm(proc_held_key_t *held)
+{
+  uint8_t slot = held - proc_state.held;
+
+  if (timers.pos[slot] != TIMER_NONE)
+  {
+    timer_cancel(held);
+  }
+
+  uint8_t idx = timers.count++;
+  timers.heap[idx] = slot;
+  timers.pos[slot] = idx;
+  timer_sift_up(idx);
+}
+
+static void timer_cancel(proc_held_key_t *held)
+{
+  uint8_t slot = held - proc_state.held;
+  uint8_t idx = timers.pos[slot];
+
+  if (idx == TIMER_NONE)
+  {
+    return;
+  }
+
+  timers.pos[slot] = TIMER_NONE;
+  uint8_t last = --timers.count;
+  if (idx != last)
+  {
+    timers.heap[idx] = timers.heap[last];
+    timers.pos[timers.heap[idx]] = idx;
+    timer_sift_down(idx);
+    timer_sift_up(idx);
+  }
+}
+
+// Earliest pending tap-hold deadline, false if nothing is waiting
+static bool timer_next_deadline(time_us_t *deadline)
+{
+  if (timers.count == 0)
+  {
+    return false;
+  }
 
-  case KEY_TYPE_MODIFIER:
-    hid_set_modifier_unsafe(key.modifier);
-    break;
+  *deadline = timer_deadline(0);
+  return true;
+}
 
-  case KEY_TYPE_SHIFTED:
-    hid_set_modifier_unsafe(HID_MOD_LEFT_SHIFT);
-    hid_add_key_unsafe(key.keycode);
-    break;
+// =============================================================================
+// SUBSYSTEM 3c: COMBOS
+// =============================================================================
 
-  case KEY_TYPE_LAYER_TAP:
-    proc_state.layer_tap_timer[row][col] = timestamp;
-    proc_state.key_is_tapped[row][col] = false;
-    break;
+static esp_err_t combo_init(void)
+{
+  memset(&combo, 0, sizeof(combo));
+  memset(combo_index, 0, sizeof(combo_index));
 
-  case KEY_TYPE_MOD_TAP:
-    proc_state.mod_tap_timer[row][col] = timestamp;
-    proc_state.key_is_tapped[row][col] = false;
-    break;
+  for (uint8_t i = 0; i < keymap_combo_count(); i++)
+  {
+    combo_keys[i] = keymap_get_combo(i)->keys;
+    for (uint32_t m = combo_keys[i]; m; m &= m - 1)
+    {
+      combo_index[__builtin_ctz(m)] |= 1U << i;
+    }
+  }
 
-  case KEY_TYPE_LAYER_MOMENTARY:
-    layer_activate_momentary_unsafe(key.layer);
-    break;
+  ESP_LOGI(TAG, "Combo engine initialized: %d combos, %dms window",
+           keymap_combo_count(), COMBO_TERM_MS);
+  return ESP_OK;
+}
 
-  case KEY_TYPE_LAYER_TOGGLE:
-    layer_toggle_unsafe(key.layer);
-    break;
+// Keymap position of a scan event
+static uint8_t combo_event_pos(const key_event_t *event)
+{
+#if !IS_MASTER
+  uint8_t keymap_col = MATRIX_COL - 1 - event->col;
+#else
+  uint8_t keymap_col = event->col;
+#endif
+  return KEY_POS(event->row, keymap_col);
+}
 
-  case KEY_TYPE_TRANSPARENT:
-    // Handle transparent key by checking lower layers
-    for (int layer = kb_mgt_layer_get_active() - 1; layer >= 0; layer--)
+// First stage for scan events. A press that can still be part of a combo
+// waits here, and so does any release behind it. Everything else goes
+// straight on to the key processor.
+static void combo_handle_event(const key_event_t *event)
+{
+  combo_check_timeout(event->timestamp);
+
+  uint8_t  pos = combo_event_pos(event);
+  uint32_t bit = 1UL << pos;
+
+  if (!event->pressed)
+  {
+    // Letting go of a waiting key settles the attempt on the spot
+    if (combo.pressed & bit)
     {
-      key_def_t lower_key = keymap_get_key(layer, row, col);
-      if (lower_key.type != KEY_TYPE_TRANSPARENT)
+      combo_resolve(event->timestamp);
+    }
+    // Any other release must not overtake the presses held back before it
+    // (Shift let go after a combo key went down)
+    else if (combo.count > 0)
+    {
+      if (combo.behind_count == KEYMAP_COMBO_MAX_KEYS)
+      {
+        combo_resolve(event->timestamp);
+      }
+      else
       {
-        proc_handle_press(lower_key, row, col, timestamp);
-        proc_store_pressed_key(row, col, lower_key);
+        combo.behind[combo.behind_count++] = *event;
         return;
       }
     }
-    break;
+    combo_release(event);
+    return;
+  }
 
-  default:
-    ESP_LOGW(TAG, "Unknown key type: %d", key.type);
-    break;
+  // A key that rules out every candidate ends the attempt
+  if (combo.count > 0 &&
+      ((combo.pressed & bit) || (combo.candidates & combo_index[pos]) == 0))
+  {
+    combo_resolve(event->timestamp);
   }
 
-  // Store the pressed key for release processing
-  proc_store_pressed_key(row, col, key);
+  if (combo.count == 0)
+  {
+    if (combo_index[pos] == 0)
+    {
+      proc_queue_event(event);
+      return;
+    }
+    combo.candidates = combo_index[pos];
+    combo.started_at = event->timestamp;
+  }
+  else
+  {
+    combo.candidates &= combo_index[pos];
+  }
+
+  combo.held[combo.count++] = *event;
+  combo.pressed |= bit;
+
+  // No need to wait out the window once no candidate needs another key
+  for (uint32_t m = combo.candidates; m; m &= m - 1)
+  {
+    if (combo_keys[__builtin_ctz(m)] != combo.pressed)
+    {
+      return;
+    }
+  }
+  combo_resolve(event->timestamp);
 }
 
-static void proc_handle_release(uint8_t row, uint8_t col, uint32_t timestamp)
+// Ends the attempt in progress: the combo made of exactly the held back keys
+// fires, otherwise they go on as the ordinary presses they were
+static void combo_resolve(time_us_t now)
 {
-  if (!proc_has_stored_key(row, col))
+  time_us_t latency = time_elapsed_us(now, combo.started_at);
+  uint32_t  matched = 0;
+
+  for (uint32_t m = combo.candidates; m; m &= m - 1)
   {
-    ESP_LOGW(TAG, "No stored key found for release at [%d:%d]", row, col);
-    return;
+    if (combo_keys[__builtin_ctz(m)] == combo.pressed)
+    {
+      matched = m & -m;
+      break;
+    }
   }
 
-  uint16_t timeout_ms = proc_state.key_tap_timeout[row][col];
-  if (timeout_ms == 0)
-    timeout_ms = DEFAULT_TIMEOUT_MS;
+  if (matched)
+  {
+    uint8_t index = __builtin_ctz(matched);
+
+    combo.keys_down[index] |= combo.pressed;
+    combo.active |= matched;
+    combo_post_action(index, true, now);
+    hid_send_key_report_unsafe();
+    combo_record(index, latency);
+    ESP_LOGD(TAG, "Combo %d fired after %lu us", index, (uint32_t)latency);
+  }
+  else
+  {
+    // One report each, so the host still sees them in order and a key
+    // released in the same batch is not folded away
+    for (uint8_t i = 0; i < combo.count; i++)
+    {
+      proc_queue_event(&combo.held[i]);
+      hid_send_key_report_unsafe();
+    }
+    combo_record(-1, latency);
+  }
 
-  key_def_t stored_key = proc_get_stored_key(row, col);
+  uint8_t behind = combo.behind_count;
 
-  ESP_LOGD(TAG, "Processing key release at [%d:%d], type=%d", row, col,
-           stored_key.type);
+  combo.count = 0;
+  combo.behind_count = 0;
+  combo.pressed = 0;
+  combo.candidates = 0;
 
-  switch (stored_key.type)
+  // Then the releases that waited behind them
+  for (uint8_t i = 0; i < behind; i++)
   {
-  case KEY_TYPE_NORMAL:
-    hid_remove_key_unsafe(stored_key.keycode);
-    break;
+    combo_release(&combo.behind[i]);
+    hid_send_key_report_unsafe();
+  }
+}
 
-  case KEY_TYPE_CONSUMER:
-    hid_clear_consumer_unsafe();
-    kb_mgt_hid_send_consumer_report_unsafe(); // Send clear immediately to
-    // release the key
-    break;
+// A release on its way to the key processor, through the combo it may end
+static void combo_release(const key_event_t *event)
+{
+  if (!combo_release_key(combo_event_pos(event), event->timestamp))
+  {
+    proc_queue_event(event);
+  }
+}
 
-  case KEY_TYPE_MODIFIER:
-    hid_clear_modifier_unsafe(stored_key.modifier);
-    break;
+// Swallows the release of a key a combo consumed; the first one to go up
+// releases the combo's action. False if the key is not part of a fired combo.
+static bool combo_release_key(uint8_t pos, time_us_t timestamp)
+{
+  uint32_t bit = 1UL << pos;
+  bool     consumed = false;
 
-  case KEY_TYPE_SHIFTED:
-    hid_clear_modifier_unsafe(HID_MOD_LEFT_SHIFT);
-    hid_remove_key_unsafe(stored_key.keycode);
-    break;
+  for (uint32_t m = combo_index[pos]; m; m &= m - 1)
+  {
+    uint8_t index = __builtin_ctz(m);
 
-  case KEY_TYPE_LAYER_TAP:
+    if ((combo.keys_down[index] & bit) == 0)
+    {
+      continue;
+    }
+
+    combo.keys_down[index] &= ~bit;
+    consumed = true;
+
+    if (combo.active & (1U << index))
+    {
+      combo.active &= ~(1U << index);
+      combo_post_action(index, false, timestamp);
+    }
+  }
+
+  return consumed;
+}
+
+static void combo_post_action(uint8_t index, bool pressed, time_us_t timestamp)
+{
+  key_event_t event = {
+      .row = PROC_COMBO_ROW,
+      .col = index,
+      .pressed = pressed,
+      .timestamp = timestamp,
+  };
+  proc_queue_event(&event);
+}
+
+// Adds a decision of combo index, -1 for keys that were not a combo
+static void combo_record(int index, time_us_t latency)
+{
+  kb_mgt_combo_stats_t *stats =
+      index < 0 ? &combo_miss_stats : &combo_stats[index];
+
+  stats->count++;
+  stats->latency_sum_us += latency;
+  if (latency > stats->latency_max_us)
+  {
+    stats->latency_max_us = latency;
+  }
+
+  if (stats->count % COMBO_STATS_LOG_EVERY == 0)
+  {
+    uint32_t avg = stats->latency_sum_us / stats->count;
+
+    if (index < 0)
+    {
+      ESP_LOGI(TAG, "Combo misses: %lu, held back avg %lu us, max %lu us",
+               stats->count, avg, stats->latency_max_us);
+    }
+    else
+    {
+      ESP_LOGI(TAG, "Combo %d: %lu fired, held back avg %lu us, max %lu us",
+               index, stats->count, avg, stats->latency_max_us);
+    }
+  }
+}
+
+// End of the combo window, false if no key is waiting
+static bool combo_next_deadline(time_us_t *deadline)
+{
+  if (combo.count == 0)
+  {
+    return false;
+  }
+
+  *deadline = combo.started_at + TIME_MS_TO_US(COMBO_TERM_MS);
+  return true;
+}
+
+// Settles the attempt in progress once its window has closed by `now`
+static bool combo_check_timeout(time_us_t now)
+{
+  time_us_t deadline;
+
+  if (!combo_next_deadline(&deadline) || !time_reached(now, deadline))
+  {
+    return false;
+  }
+
+  combo_resolve(deadline);
+  return true;
+}
+
+// =============================================================================
+// SUBSYSTEM 3d: MACRO PLAYBACK
+// =============================================================================
+
+static esp_err_t macro_init(void)
+{
+  macro.pc = NULL;
+  macro.delaying = false;
+  macro.tap_pending = false;
+  macro.queue_head = 0;
+  macro.queue_count = 0;
+#if !IS_MASTER
+  macro.awaiting_ack = false;
+  atomic_init(&macro.tx_done, 0);
+  atomic_init(&macro.tx_failed, 0);
+#endif
+
+  ESP_LOGI(TAG, "Macro playback initialized");
+  return ESP_OK;
+}
+
+static void macro_enqueue(uint8_t id)
+{
+  if (macro.queue_count == MACRO_QUEUE_SIZE)
+  {
+    ESP_LOGW(TAG, "Macro queue full, dropping macro %d", id);
+    return;
+  }
+
+  macro.queue[(macro.queue_head + macro.queue_count) % MACRO_QUEUE_SIZE] = id;
+  macro.queue_count++;
+}
+
+// Loads the next queued macro, false if none is left
+static bool macro_start_next(void)
+{
+  while (macro.queue_count > 0)
   {
-    bool is_tapped = proc_state.key_is_tapped[row][col];
-    bool layer_is_active =
-        layer_is_momentary_active(stored_key.layer_tap.layer);
-    uint32_t layer_tap_hold_time =
-        timestamp - proc_state.layer_tap_timer[row][col];
+    uint8_t id = macro.queue[macro.queue_head];
+    macro.queue_head = (macro.queue_head + 1) % MACRO_QUEUE_SIZE;
+    macro.queue_count--;
+
+    const keymap_macro_t *def = keymap_get_macro(id);
+    if (def == NULL)
+    {
+      ESP_LOGW(TAG, "Macro %d is not defined", id);
+      continue;
+    }
+
+    macro.pc = def->code;
+    macro.end = def->code + def->length;
+    ESP_LOGD(TAG, "Playing macro %d (%d bytes)", id, def->length);
+    return true;
+  }
+
+  return false;
+}
+
+// Runs macro steps until one has to wait for the link or a DELAY. Every step
+// that changes HID_SRC_MACRO sends one report.
+static void macro_run(time_us_t now)
+{
+  kb_mgt_hid_key_report_t *report = &hid_src[HID_SRC_MACRO];
 
-    // If tap-preferred sent the tap key, remove it from report
-    if (is_tapped && !layer_is_active)
+  while (macro.pc != NULL || macro_start_next())
+  {
+    if (macro.delaying)
     {
-      hid_remove_key_unsafe(stored_key.layer_tap.tap_key);
+      if (!time_reached(now, macro.resume_at))
+      {
+        return;
+      }
+      macro.delaying = false;
     }
 
-    // ALWAYS deactivate layer if it was activated (by timeout)
-    if (layer_is_active)
+    if (!macro_link_ready(now))
     {
-      layer_deactivate_momentary_unsafe(stored_key.layer_tap.layer);
-      comm_send_event(KB_COMM_EVENT_LAYER_DESYNC, &stored_key.layer_tap.layer);
+      return;
     }
 
-    // If quick tap without layer activation and wasn't tap-preferred, send
-    // brief tap
-    if (!is_tapped && !layer_is_active && layer_tap_hold_time < timeout_ms)
+    if (macro.tap_pending)
     {
-      comm_handle_brief_tap(stored_key.layer_tap.tap_key);
+      macro.tap_pending = false;
+      macro_set_key(macro.tap_key, false);
+      macro_emit(now);
+      continue;
     }
-    break;
+
+    if (macro.pc == macro.end)
+    {
+      // Nothing a macro pressed outlives it
+      memset(report, 0, sizeof(kb_mgt_hid_key_report_t));
+      macro.pc = NULL;
+      macro_emit(now);
+      continue;
+    }
+
+    uint8_t op = *macro.pc++;
+
+    if (op == MACRO_OP_DELAY)
+    {
+      macro.resume_at = now + TIME_MS_TO_US(macro_read_varint());
+      macro.delaying = true;
+      continue;
+    }
+
+    uint8_t arg = *macro.pc++;
+
+    switch (op)
+    {
+    case MACRO_OP_PRESS:
+      macro_set_key(arg, true);
+      break;
+
+    case MACRO_OP_RELEASE:
+      macro_set_key(arg, false);
+      break;
+
+    case MACRO_OP_TAP:
+      macro_set_key(arg, true);
+      macro.tap_pending = true;
+      macro.tap_key = arg;
+      break;
+
+    case MACRO_OP_MOD_DOWN:
+      report->modifiers |= arg;
+      break;
+
+    case MACRO_OP_MOD_UP:
+      report->modifiers &= ~arg;
+      break;
+
+    default:
+      break;
+    }
+
+    macro_emit(now);
+  }
+}
+
+// True once the previous step's report has been taken by the transport
+static bool macro_link_ready(time_us_t now)
+{
+#if IS_MASTER
+  // Nothing queued behind the link: the next report rides the next
+  // connection event, one in flight and one waiting keeps every event busy
+  return hid_tx.count == 0;
+#else
+  if (!macro.awaiting_ack)
+  {
+    return true;
+  }
+
+  // Frames are reported in order, so ours is done once tx_done reaches it.
+  // Other frames (heartbeats, key events) do not count as its ack.
+  uint32_t done = atomic_load_explicit(&macro.tx_done, memory_order_acquire);
+  uint32_t since = done - macro.frame_seq;
+  bool     reported = macro.frame_seq != 0 && since < UINT32_MAX / 2;
+
+  if (reported && since < 32 &&
+      !(atomic_load_explicit(&macro.tx_failed, memory_order_relaxed) &
+        1UL << (macro.frame_seq % 32)))
+  {
+    macro.awaiting_ack = false;
+    return true;
+  }
+
+  if (time_elapsed_us(now, macro.first_sent_at) >=
+      TIME_MS_TO_US(HID_TX_STALL_MS))
+  {
+    ESP_LOGW(TAG, "Macro report not acknowledged, moving on");
+    macro.awaiting_ack = false;
+    return true;
+  }
+
+  // Lost, never queued, or too old to tell: the report is the full key
+  // state, so sending it again is safe
+  if (macro.frame_seq == 0 || reported)
+  {
+    hid_key_sent_seq = comm_send_event(KB_COMM_EVENT_TAP, &hid_key_sent);
+    macro.frame_seq = hid_key_sent_seq;
+    macro.sent_at = now;
+  }
+  return false;
+#endif
+}
+
+static void macro_emit(time_us_t now)
+{
+#if IS_MASTER
+  hid_send_key_report_unsafe();
+#else
+  kb_mgt_hid_key_report_t before = hid_key_sent;
+
+  hid_send_key_report_unsafe();
+
+  // Only a frame that actually went out has an acknowledgement to wait for
+  if (memcmp(&before, &hid_key_sent, sizeof(kb_mgt_hid_key_report_t)) != 0)
+  {
+    macro.awaiting_ack = true;
+    macro.frame_seq = hid_key_sent_seq;
+    macro.first_sent_at = now;
+  }
+#endif
+  macro.sent_at = now;
+}
+
+static void macro_set_key(uint8_t keycode, bool pressed)
+{
+  kb_mgt_hid_key_report_t *report = &hid_src[HID_SRC_MACRO];
+
+  if (keycode == HID_KEY_NONE || keycode >= HID_NKRO_USAGE_COUNT)
+  {
+    return;
+  }
+
+  if (pressed)
+  {
+    report->keys[keycode >> 3] |= 1U << (keycode & 7);
+  }
+  else
+  {
+    report->keys[keycode >> 3] &= ~(1U << (keycode & 7));
+  }
+}
+
+// LEB128, bounds were checked by keymap_init
+static uint32_t macro_read_varint(void)
+{
+  uint32_t value = 0;
+
+  for (uint8_t shift = 0; macro.pc < macro.end && shift < 32; shift += 7)
+  {
+    uint8_t byte = *macro.pc++;
+
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      break;
+    }
+  }
+
+  return value;
+}
+
+// When playback needs the task again without an event to wake it, false if
+// it does not. NOTIFY_TX and ESP-NOW acknowledgements wake the task anyway.
+static bool macro_next_deadline(time_us_t *deadline)
+{
+  if (macro.delaying)
+  {
+    *deadline = macro.resume_at;
+    return true;
   }
-
-  case KEY_TYPE_MOD_TAP:
+#if !IS_MASTER
+  if (macro.awaiting_ack)
   {
-    bool     is_tapped = proc_state.key_is_tapped[row][col];
-    uint32_t mod_tap_hold_time = timestamp - proc_state.mod_tap_timer[row][col];
-    bool     mod_is_active =
-        (hid_key_report.modifiers & stored_key.mod_tap.hold_key) != 0;
+    // A frame the driver refused is retried on the next tick, a queued one
+    // wakes the task when it is reported
+    *deadline = macro.frame_seq == 0
+                    ? macro.sent_at + TIME_MS_TO_US(1)
+                    : macro.first_sent_at + TIME_MS_TO_US(HID_TX_STALL_MS);
+    return true;
+  }
+#endif
+  return false;
+}
 
-    // If tap-preferred sent the tap key, remove it from report
-    if (is_tapped && !mod_is_active)
-    {
-      hid_remove_key_unsafe(stored_key.mod_tap.tap_key);
-    }
+// =============================================================================
+// SUBSYSTEM 3e: TAP DANCE
+// =============================================================================
+// A dance is the pending key from its first press until it is decided, and
+// keeps its held[] slot while it is up between taps. Its timer runs from the
+// last press or release: reached with the key down it holds, with the key up
+// it taps. Anything that fixes the outcome earlier decides right away.
 
-    // ALWAYS clear modifier if it was activated (by timeout)
-    if (mod_is_active)
-    {
-      hid_clear_modifier_unsafe(stored_key.mod_tap.hold_key);
-      comm_send_event(KB_COMM_EVENT_MOD_DESYNC, &stored_key.mod_tap.hold_key);
-    }
+static void dance_start(proc_held_key_t *held)
+{
+  const keymap_tap_dance_t *dance = keymap_get_tap_dance(held->key.tap_dance);
 
-    // If quick tap without modifier activation and wasn't tap-preferred, send
-    // brief tap
-    if (!is_tapped && !mod_is_active && mod_tap_hold_time < timeout_ms)
-    {
-      comm_handle_brief_tap(stored_key.mod_tap.tap_key);
-    }
-    break;
+  if (dance == NULL)
+  {
+    ESP_LOGW(TAG, "Tap-dance %d is not defined", held->key.tap_dance);
+    return;
   }
 
-  case KEY_TYPE_LAYER_MOMENTARY:
-    layer_deactivate_momentary_unsafe(stored_key.layer);
-    break;
+  held->timeout_ms = dance->timeout_ms;
+  held->taps = 1;
+  proc_state.pending = held - proc_state.held;
+  timer_arm(held);
+  dance_counted(held);
+}
 
-  case KEY_TYPE_TRANSPARENT:
-    // Handle transparent key release by checking lower layers
-    for (int layer = kb_mgt_layer_get_active() - 1; layer >= 0; layer--)
-    {
-      key_def_t lower_key = keymap_get_key(layer, row, col);
-      if (lower_key.type != KEY_TYPE_TRANSPARENT)
-      {
-        proc_handle_release(row, col, timestamp);
-        break;
-      }
-    }
-    break;
+// Counts a press or release of the pending dance. Returns true if the event
+// was used up, false if the dance was decided and the event still has to be
+// processed against what it decided.
+static bool dance_edge(proc_held_key_t *held, const key_event_t *event)
+{
+  const keymap_tap_dance_t *dance = keymap_get_tap_dance(held->key.tap_dance);
 
-  default:
-    break;
+  if (!event->pressed && held->taps == dance_max_taps(dance))
+  {
+    // No further tap can follow
+    proc_decide(held, PROC_TAP);
+    return false;
   }
 
-  proc_clear_stored_key(row, col);
+  timer_cancel(held);
+  held->pressed_at = event->timestamp;
+  held->released = !event->pressed;
+  timer_arm(held);
+
+  if (event->pressed)
+  {
+    held->taps++;
+    dance_counted(held);
+  }
+  return true;
 }
 
-static void proc_store_pressed_key(uint8_t row, uint8_t col, key_def_t key)
+// Taps as soon as the last defined tap is pressed, unless holding it would
+// mean something else
+static void dance_counted(proc_held_key_t *held)
 {
-  if (row < MATRIX_ROW && col < MATRIX_COL)
+  const keymap_tap_dance_t *dance = keymap_get_tap_dance(held->key.tap_dance);
+
+  if (held->taps == dance_max_taps(dance) && dance->hold[held->taps - 1] == 0)
   {
-    proc_state.pressed_keys[row][col] = key;
-    proc_state.pressed_key_active[row][col] = true;
+    proc_decide(held, PROC_TAP);
   }
 }
 
-static key_def_t proc_get_stored_key(uint8_t row, uint8_t col)
+// Turns the held dance into the action it chose. A dance decided with the key
+// up taps that action; otherwise it stays down until the key is released.
+static void dance_commit(proc_held_key_t *held, proc_decision_t decision)
 {
-  if (row < MATRIX_ROW && col < MATRIX_COL)
+  uint8_t                   id = held->key.tap_dance;
+  const keymap_tap_dance_t *dance = keymap_get_tap_dance(id);
+  uint8_t                   tap = held->taps - 1;
+  time_us_t latency = time_elapsed_us(get_current_time_us(), held->pressed_at);
+
+  dance_record(&dance_stats[id], latency, latency < proc_timeout_us(held));
+
+  held->key = keymap_decode(decision == PROC_HOLD && dance->hold[tap] != 0
+                                ? dance->hold[tap]
+                                : dance->tap[tap]);
+  proc_press_action(held->key);
+
+  ESP_LOGD(TAG, "Tap-dance %d at [%d:%d] resolved as %d %s after %lu us", id,
+           held->row, held->col, held->taps,
+           decision == PROC_HOLD ? "HOLD" : "TAP", (uint32_t)latency);
+
+  // On the wire before any of the events that waited for it
+  hid_send_key_report_unsafe();
+
+  if (held->released)
   {
-    return proc_state.pressed_keys[row][col];
+    // Its release too: the key came up before they happened
+    proc_handle_release(held->row, held->col, get_current_time_us());
+    hid_send_key_report_unsafe();
   }
-  key_def_t empty_key = {0};
-  return empty_key;
 }
 
-static bool proc_has_stored_key(uint8_t row, uint8_t col)
+// Highest tap count that has an action
+static uint8_t dance_max_taps(const keymap_tap_dance_t *dance)
 {
-  return (row < MATRIX_ROW && col < MATRIX_COL)
-             ? proc_state.pressed_key_active[row][col]
-             : false;
+  uint8_t taps = KEYMAP_TAP_DANCE_MAX_TAPS;
+
+  while (taps > 1 && dance->tap[taps - 1] == 0 && dance->hold[taps - 1] == 0)
+  {
+    taps--;
+  }
+
+  return taps;
 }
 
-static void proc_clear_stored_key(uint8_t row, uint8_t col)
+static void dance_record(kb_mgt_tap_dance_stats_t *stats, time_us_t latency,
+                         bool early)
 {
-  if (row < MATRIX_ROW && col < MATRIX_COL)
+  stats->count++;
+  stats->early += early;
+  stats->latency_sum_us += latency;
+  if (latency > stats->latency_max_us)
   {
-    memset(&proc_state.pressed_keys[row][col], 0, sizeof(key_def_t));
-    proc_state.pressed_key_active[row][col] = false;
+    stats->latency_max_us = latency;
   }
 }
 
@@ -679,79 +2430,334 @@ static void proc_clear_stored_key(uint8_t row, uint8_t col)
 // SUBSYSTEM 4: COMMUNICATION (ESP-NOW for Split Keyboard)
 // =============================================================================
 
-static void comm_send_event(kb_comm_event_t event_type, void *data)
+// Returns the ESP-NOW sequence number of the frame, 0 if it was not queued
+static uint32_t comm_send_event(kb_comm_event_t event_type, void *data)
 {
+  uint32_t seq = 0;
+
   switch (event_type)
   {
   case KB_COMM_EVENT_TAP:
 #if IS_MASTER
-    send_to_espnow(MASTER, TAP, data);
+    seq = send_to_espnow(MASTER, TAP, data);
 #else
-    send_to_espnow(SLAVE, TAP, data);
+    seq = send_to_espnow(SLAVE, TAP, data);
 #endif
     break;
 
   case KB_COMM_EVENT_BRIEF_TAP:
 #if IS_MASTER
-    send_to_espnow(MASTER, BRIEF_TAP, data);
+    seq = send_to_espnow(MASTER, BRIEF_TAP, data);
 #else
-    send_to_espnow(SLAVE, BRIEF_TAP, data);
+    seq = send_to_espnow(SLAVE, BRIEF_TAP, data);
 #endif
     break;
 
   case KB_COMM_EVENT_LAYER_SYNC:
 #if IS_MASTER
-    send_to_espnow(MASTER, LAYER_SYNC, data);
+    seq = send_to_espnow(MASTER, LAYER_SYNC, data);
 #else
-    send_to_espnow(SLAVE, LAYER_SYNC, data);
+    seq = send_to_espnow(SLAVE, LAYER_SYNC, data);
 #endif
     break;
 
-  case KB_COMM_EVENT_LAYER_DESYNC:
-#if IS_MASTER
-    send_to_espnow(MASTER, LAYER_DESYNC, data);
-#else
-    send_to_espnow(SLAVE, LAYER_DESYNC, data);
-#endif
-    break;
-
-  case KB_COMM_EVENT_MOD_SYNC:
+  case KB_COMM_EVENT_CONSUMER:
 #if IS_MASTER
-    send_to_espnow(MASTER, MOD_SYNC, data);
+    seq = send_to_espnow(MASTER, CONSUMER, data);
 #else
-    send_to_espnow(SLAVE, MOD_SYNC, data);
+    seq = send_to_espnow(SLAVE, CONSUMER, data);
 #endif
     break;
 
-  case KB_COMM_EVENT_MOD_DESYNC:
+  case KB_COMM_EVENT_KEY_EVENT:
 #if IS_MASTER
-    send_to_espnow(MASTER, MOD_DESYNC, data);
+    seq = send_to_espnow(MASTER, KEY_EVENT, data);
 #else
-    send_to_espnow(SLAVE, MOD_DESYNC, data);
+    seq = send_to_espnow(SLAVE, KEY_EVENT, data);
 #endif
     break;
 
-  case KB_COMM_EVENT_CONSUMER:
+  case KB_COMM_EVENT_HOLD_PENDING:
 #if IS_MASTER
-    send_to_espnow(MASTER, CONSUMER, data);
+    seq = send_to_espnow(MASTER, HOLD_PENDING, data);
 #else
-    send_to_espnow(SLAVE, CONSUMER, data);
+    seq = send_to_espnow(SLAVE, HOLD_PENDING, data);
 #endif
     break;
   }
+
+  return seq;
 }
 
 static void comm_handle_brief_tap(uint8_t keycode)
 {
   hid_add_key_unsafe(keycode);
 #if IS_MASTER
-  kb_mgt_hid_send_key_report_unsafe();
+  hid_send_key_report_unsafe();
   hid_remove_key_unsafe(keycode);
-  kb_mgt_hid_send_key_report_unsafe();
+  hid_send_key_report_unsafe();
 #else
-  comm_send_event(KB_COMM_EVENT_BRIEF_TAP, kb_mgt_hid_get_current_key_report());
+  kb_mgt_hid_key_report_t report;
+  hid_merge_key_report(&report);
+  comm_send_event(KB_COMM_EVENT_BRIEF_TAP, &report);
   hid_remove_key_unsafe(keycode);
+  // The master releases everything after a brief tap
+  memset(&hid_key_sent, 0, sizeof(kb_mgt_hid_key_report_t));
+#endif
+}
+
+#if IS_MASTER
+// True if next has a key down that prev did not, a press on the other half
+static bool comm_report_adds_key(const kb_mgt_hid_key_report_t *prev,
+                                 const kb_mgt_hid_key_report_t *next)
+{
+  for (uint8_t i = 0; i < HID_NKRO_BITMAP_BYTES; i++)
+  {
+    if (next->keys[i] & ~prev->keys[i])
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+#endif
+
+// Applies a message from the other half (see kb_mgt_post_remote)
+static void comm_handle_remote(const kb_mgt_remote_msg_t *msg)
+{
+  switch (msg->type)
+  {
+#if IS_MASTER
+  case KB_MGT_REMOTE_KEY_REPORT:
+    if (comm_report_adds_key(&hid_src[HID_SRC_REMOTE], &msg->key_report))
+    {
+      proc_typing_record(get_current_time_us());
+    }
+    hid_src[HID_SRC_REMOTE] = msg->key_report;
+    hid_send_key_report_unsafe();
+    break;
+
+  case KB_MGT_REMOTE_BRIEF_TAP:
+    proc_typing_record(get_current_time_us());
+    hid_src[HID_SRC_REMOTE] = msg->key_report;
+    hid_send_key_report_unsafe();
+    memset(&hid_src[HID_SRC_REMOTE], 0, sizeof(kb_mgt_hid_key_report_t));
+    hid_send_key_report_unsafe();
+    break;
+
+  case KB_MGT_REMOTE_CONSUMER:
+    hid_consumer_report = msg->consumer_report;
+    hid_send_consumer_report_unsafe();
+    break;
+#endif
+
+  case KB_MGT_REMOTE_LAYER_SYNC:
+    proc_state.layer_remote = msg->layer_mask & LAYER_ALL_MASK;
+    layer_refresh_cache_unsafe();
+    ESP_LOGI(TAG, "Remote layers synced: 0x%08lx", proc_state.layer_remote);
+    break;
+
+  case KB_MGT_REMOTE_KEY_EVENT:
+#if !IS_MASTER
+    // The master's presses only reach the slave this way, while a key here
+    // is pending. The master counts the slave's from its key reports.
+    if (msg->key_event.pressed)
+    {
+      proc_typing_record(msg->key_event.timestamp);
+    }
 #endif
+    proc_queue_event(&msg->key_event);
+    hid_send_key_report_unsafe();
+    break;
+
+  case KB_MGT_REMOTE_HOLD_PENDING:
+    proc_state.remote_pending = msg->hold_pending_ms != 0;
+    proc_state.remote_pending_until =
+        get_current_time_us() +
+        TIME_MS_TO_US(msg->hold_pending_ms + PROC_REMOTE_PENDING_MARGIN_MS);
+    if (msg->hold_pending_ms == 0 && proc_pending() == NULL)
+    {
+      // Its decision is in, our keys follow it
+      proc_queue.held_back = 0;
+      proc_run_queue();
+      hid_send_key_report_unsafe();
+    }
+    break;
+
+  default:
+    ESP_LOGW(TAG, "Unhandled remote message: %d", msg->type);
+    break;
+  }
+}
+
+// Slot of a state message in remote_state, -1 for an edge, which is queued
+static int comm_state_index(kb_mgt_remote_type_t type)
+{
+  switch (type)
+  {
+  case KB_MGT_REMOTE_KEY_REPORT:
+    return 0;
+  case KB_MGT_REMOTE_CONSUMER:
+    return 1;
+  case KB_MGT_REMOTE_LAYER_SYNC:
+    return 2;
+  case KB_MGT_REMOTE_HOLD_PENDING:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+// Stores msg over a message not applied yet. What must not be missed from
+// the old one is kept in replaced: keys down only in a replaced report still
+// get pressed, and a replaced decision (hold pending 0) still lets go of
+// what waited for it, in the old message's place. Call under remote_lock.
+static void comm_state_replace(comm_state_t              *state,
+                               const kb_mgt_remote_msg_t *msg, uint32_t seq)
+{
+  const kb_mgt_remote_msg_t *old = &state->latest;
+
+  if (state->posted && !state->has_replaced)
+  {
+    state->replaced_seq = state->seq;
+  }
+
+  if (state->posted)
+  {
+    switch (msg->type)
+    {
+    case KB_MGT_REMOTE_KEY_REPORT:
+      if (!state->has_replaced)
+      {
+        state->replaced = *old;
+        state->has_replaced = true;
+        break;
+      }
+      state->replaced.key_report.modifiers |= old->key_report.modifiers;
+      for (uint8_t i = 0; i < HID_NKRO_BITMAP_BYTES; i++)
+      {
+        state->replaced.key_report.keys[i] |= old->key_report.keys[i];
+      }
+      break;
+
+    case KB_MGT_REMOTE_CONSUMER:
+      if (old->consumer_report.usage != 0 &&
+          old->consumer_report.usage != msg->consumer_report.usage)
+      {
+        state->replaced = *old;
+        state->has_replaced = true;
+      }
+      break;
+
+    case KB_MGT_REMOTE_HOLD_PENDING:
+      if (old->hold_pending_ms == 0)
+      {
+        state->replaced = *old;
+        state->has_replaced = true;
+      }
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  state->latest = *msg;
+  state->seq = seq;
+  state->posted = true;
+}
+
+// Where a state message not applied yet goes among the queued edges
+static uint32_t comm_state_seq(const comm_state_t *state)
+{
+  return state->has_replaced ? state->replaced_seq : state->seq;
+}
+
+// Takes the oldest state message not applied yet, if it was posted before the
+// edge numbered *before (any, for NULL)
+static bool comm_take_state(const uint32_t *before, kb_mgt_remote_msg_t *msg)
+{
+  comm_state_t *oldest = NULL;
+
+  taskENTER_CRITICAL(&remote_lock);
+
+  for (uint8_t i = 0; i < COMM_STATE_COUNT; i++)
+  {
+    comm_state_t *state = &remote_state[i];
+    if (state->posted &&
+        (oldest == NULL ||
+         (int32_t)(comm_state_seq(state) - comm_state_seq(oldest)) < 0))
+    {
+      oldest = state;
+    }
+  }
+
+  if (oldest != NULL && before != NULL &&
+      (int32_t)(comm_state_seq(oldest) - *before) > 0)
+  {
+    oldest = NULL;
+  }
+
+  if (oldest != NULL && oldest->has_replaced)
+  {
+    // Replaced keys go down together with the ones still held
+    *msg = oldest->replaced;
+    oldest->has_replaced = false;
+    if (msg->type == KB_MGT_REMOTE_KEY_REPORT)
+    {
+      msg->key_report.modifiers |= oldest->latest.key_report.modifiers;
+      for (uint8_t i = 0; i < HID_NKRO_BITMAP_BYTES; i++)
+      {
+        msg->key_report.keys[i] |= oldest->latest.key_report.keys[i];
+      }
+    }
+  }
+  else if (oldest != NULL)
+  {
+    *msg = oldest->latest;
+    oldest->posted = false;
+  }
+
+  taskEXIT_CRITICAL(&remote_lock);
+
+  return oldest != NULL;
+}
+
+// Applies everything the other half sent since the last pass, states and
+// edges in the order they were posted
+static void comm_drain_remote(void)
+{
+  kb_mgt_remote_msg_t msg;
+  comm_edge_t         edge;
+  bool have_edge = xQueueReceive(remote_inbox, &edge, 0) == pdTRUE;
+
+  // Only key events and brief taps can be lost. A pending key the other
+  // half's events would have decided still ends at its timeout, and the next
+  // key report brings the host up to date.
+  uint32_t lost = atomic_exchange_explicit(&remote_overflows, 0,
+                                           memory_order_relaxed);
+  if (lost > 0)
+  {
+    ESP_LOGW(TAG, "Remote inbox overflowed, %lu key events lost", lost);
+  }
+
+  for (;;)
+  {
+    if (comm_take_state(have_edge ? &edge.seq : NULL, &msg))
+    {
+      comm_handle_remote(&msg);
+    }
+    else if (have_edge)
+    {
+      comm_handle_remote(&edge.msg);
+      have_edge = xQueueReceive(remote_inbox, &edge, 0) == pdTRUE;
+    }
+    else
+    {
+      break;
+    }
+  }
 }
 
 // =============================================================================
@@ -762,19 +2768,29 @@ esp_err_t kb_mgt_init(void)
 {
   esp_err_t ret = ESP_OK;
 
+  ret |= keymap_init();
   ret |= hid_init();
   ret |= layer_init();
   ret |= proc_init();
+  ret |= combo_init();
+  ret |= macro_init();
 
-  sem_hdl = xSemaphoreCreateMutex();
-  if (!sem_hdl)
+  atomic_init(&key_ring.head, 0);
+  atomic_init(&key_ring.tail, 0);
+
+  memset(remote_state, 0, sizeof(remote_state));
+  atomic_init(&remote_overflows, 0);
+  remote_inbox = xQueueCreate(KB_MGT_INBOX_SIZE, sizeof(comm_edge_t));
+  if (!remote_inbox)
   {
-    ESP_LOGE(TAG, "Failed to create keyboard management mutex");
+    ESP_LOGE(TAG, "Failed to create remote message inbox");
     ret = ESP_FAIL;
   }
 
   if (ret == ESP_OK)
   {
+    task_hdl_init(&task_hdl, task, "kb_mgt_task", KB_MGT_PRIORITY,
+                  KB_MGT_TASK_STACK_SIZE, NULL);
     ESP_LOGI(TAG,
              "All keyboard management subsystems initialized successfully");
   }
@@ -786,34 +2802,209 @@ esp_err_t kb_mgt_init(void)
   return ret;
 }
 
-void kb_mgt_process_key_event(key_def_t key, uint8_t row, uint8_t col,
-                              bool pressed, uint32_t timestamp)
+bool kb_mgt_post_key_event(const key_event_t *event)
 {
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
+  uint_fast32_t head =
+      atomic_load_explicit(&key_ring.head, memory_order_relaxed);
+  uint_fast32_t tail =
+      atomic_load_explicit(&key_ring.tail, memory_order_acquire);
+
+  if (head - tail == KEY_EVENT_RING_SIZE)
   {
-    ESP_LOGE(TAG, "Failed to acquire keyboard management mutex");
-    return;
+    return false;
   }
 
-  if (pressed)
+  key_ring.slots[head & (KEY_EVENT_RING_SIZE - 1)] = *event;
+  atomic_store_explicit(&key_ring.head, head + 1, memory_order_release);
+
+  if (task_hdl != NULL)
+  {
+    xTaskNotifyGive(task_hdl);
+  }
+  return true;
+}
+
+esp_err_t kb_mgt_post_remote(const kb_mgt_remote_msg_t *msg)
+{
+  esp_err_t ret = ESP_OK;
+  int       index = comm_state_index(msg->type);
+
+  if (!remote_inbox)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (index >= 0)
+  {
+    taskENTER_CRITICAL(&remote_lock);
+    comm_state_replace(&remote_state[index], msg, remote_seq++);
+    taskEXIT_CRITICAL(&remote_lock);
+  }
+  else
+  {
+    comm_edge_t edge = {.seq = remote_seq++, .msg = *msg};
+
+    // Never wait: a stalled ESP-NOW task would hold up every later message.
+    // The inbox holds the worst case burst; the task reports the overflow.
+    if (xQueueSend(remote_inbox, &edge, 0) != pdTRUE)
+    {
+      atomic_fetch_add_explicit(&remote_overflows, 1, memory_order_relaxed);
+      ret = ESP_FAIL;
+    }
+  }
+
+  if (task_hdl != NULL)
+  {
+    xTaskNotifyGive(task_hdl);
+  }
+  return ret;
+}
+
+// =============================================================================
+// PROCESSING TASK
+// =============================================================================
+
+static void task(void *pvParameters)
+{
+  // Subscribe to watchdog
+  esp_err_t wdt_ret = esp_task_wdt_add(NULL);
+  if (wdt_ret == ESP_OK)
   {
-    proc_handle_press(key, row, col, timestamp);
+    ESP_LOGI(TAG, "Key processing task subscribed to watchdog");
   }
   else
   {
-    proc_handle_release(row, col, timestamp);
+    ESP_LOGW(TAG, "Failed to subscribe to watchdog: %d", wdt_ret);
+  }
+
+  const uint32_t WDT_RESET_INTERVAL_MS = 1000; // Reset every 1 second
+  uint32_t       last_wdt_reset_time = get_current_time_ms();
+
+  while (1)
+  {
+    // Sleep until the next deadline, or until an event arrives
+    TickType_t wait = pdMS_TO_TICKS(WDT_RESET_INTERVAL_MS);
+    time_us_t  deadline;
+    if (task_next_deadline(&deadline))
+    {
+      time_us_t now = get_current_time_us();
+      uint32_t  remaining_ms =
+          time_reached(now, deadline) ? 0 : (deadline - now + 999) / 1000;
+      if (remaining_ms < WDT_RESET_INTERVAL_MS)
+      {
+        wait = pdMS_TO_TICKS(remaining_ms);
+      }
+    }
+#if IS_MASTER
+    // Queued reports wait for NOTIFY_TX, but not past the stall timeout. One
+    // the stack refused is retried sooner.
+    uint32_t hid_wait_ms = hid_tx.failing ? HID_TX_RETRY_MS : HID_TX_STALL_MS;
+    if (hid_tx.count > 0 && wait > pdMS_TO_TICKS(hid_wait_ms))
+    {
+      wait = pdMS_TO_TICKS(hid_wait_ms);
+    }
+#endif
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    uint32_t current_time = get_current_time_ms();
+    if ((current_time - last_wdt_reset_time) >= WDT_RESET_INTERVAL_MS)
+    {
+      esp_task_wdt_reset();
+      last_wdt_reset_time = current_time;
+    }
+
+    task_process();
   }
-  xSemaphoreGive(sem_hdl);
 }
 
-void kb_mgt_finalize_processing(void)
+// One pass over everything that may have changed since the last wake-up
+static void task_process(void)
 {
-  if (!sem_hdl || xSemaphoreTake(sem_hdl, pdMS_TO_TICKS(10)) != pdTRUE)
+  key_event_t event;
+
+  comm_drain_remote();
+
+  // Drain everything the scan task has queued, then send one report
+  bool processed = false;
+  while (proc_ring_pop(&event))
   {
-    ESP_LOGE(TAG, "Failed to acquire keyboard management mutex");
-    return;
+    proc_send_key_event(&event);
+    combo_handle_event(&event);
+    processed = true;
+  }
+
+  // A combo window that closed lets its keys go
+  if (combo_check_timeout(get_current_time_us()))
+  {
+    processed = true;
+  }
+
+  // Holds that resolved on their own release what waited behind them
+  if (proc_check_tap_timeouts(get_current_time_us()))
+  {
+    proc_run_queue();
+    processed = true;
+  }
+
+  if (proc_check_remote_pending(get_current_time_us()))
+  {
+    proc_run_queue();
+    processed = true;
+  }
+
+  if (processed)
+  {
+    hid_send_key_report_unsafe();
+  }
+#if IS_MASTER
+  else
+  {
+    // Woken by NOTIFY_TX, the stall timeout or a retry
+    hid_tx_flush(get_current_time_us());
+  }
+#endif
+
+  // After the report above, so the other half gets our decision first
+  proc_sync_pending(get_current_time_us());
+
+  // After the report above, so a macro never overtakes real keys
+  macro_run(get_current_time_us());
+}
+
+// Earliest tap-hold, combo, macro, remote decision or pending resend deadline,
+// false if none is armed
+static bool task_next_deadline(time_us_t *deadline)
+{
+  time_us_t next;
+  bool      found = timer_next_deadline(deadline);
+
+  if (proc_remote_deadline(&next) &&
+      (!found || time_reached(*deadline, next)))
+  {
+    *deadline = next;
+    found = true;
+  }
+
+  if (proc_resend_deadline(&next) &&
+      (!found || time_reached(*deadline, next)))
+  {
+    *deadline = next;
+    found = true;
+  }
+
+  if (combo_next_deadline(&next) &&
+      (!found || time_reached(*deadline, next)))
+  {
+    *deadline = next;
+    found = true;
+  }
+
+  if (macro_next_deadline(&next) &&
+      (!found || time_reached(*deadline, next)))
+  {
+    *deadline = next;
+    found = true;
   }
 
-  kb_mgt_hid_send_key_report_unsafe();
-  xSemaphoreGive(sem_hdl);
+  return found;
 }
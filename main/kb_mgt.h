@@ -3,7 +3,9 @@
 
 #include "common.h"
 #include "config.h"
+#include "kb_matrix.h"
 #include "keymap.h"
+#include "utils.h"
 
 // Forward declaration to avoid circular dependency with espnow.h
 struct esp_hidd_dev_s;
@@ -12,7 +14,43 @@ extern esp_hidd_dev_t        *hid_dev;
 
 // HID Configuration Constants
 #define HID_MAX_KEYS_IN_REPORT 6
-#define HID_KEY_SHIFT_LAST_IDX 5
+#define HID_NKRO_BITMAP_BYTES  ((HID_NKRO_USAGE_COUNT + 7) / 8)
+// ATT MTU before the host negotiates a larger one
+#define HID_ATT_MTU_DEFAULT 23
+// Smallest ATT MTU whose notifications carry the whole NKRO report (3 bytes
+// of ATT header). Below it the 6KRO report is sent.
+#define HID_NKRO_MIN_MTU (sizeof(kb_mgt_hid_key_report_t) + 3)
+
+// Bit of a layer in the layer masks
+#define LAYER_BIT(layer) (1UL << (layer))
+#define LAYER_ALL_MASK   (0xFFFFFFFFUL >> (32 - MAX_LAYERS))
+
+// Most keys the processor tracks as held at once (at most 32)
+#define PROC_MAX_HELD_KEYS 16
+// Most key events held back behind an undecided tap-hold key
+#define PROC_MAX_QUEUED_EVENTS 16
+// No held[] slot
+#define PROC_SLOT_NONE 0xFF
+// Row of the events combos inject, the column is the combo index
+#define PROC_COMBO_ROW MATRIX_ROW
+// Row of the other half's key events, the column is the KEY_POS it sent.
+// They have no action here, they only decide tap-hold keys.
+#define PROC_REMOTE_ROW (MATRIX_ROW + 1)
+// Local events wait for the other half's tap-hold decision at most its key's
+// timeout plus this much, in case the message that ends it is lost
+#define PROC_REMOTE_PENDING_MARGIN_MS 30
+// An undecided key's state is sent again this often, so a lost message costs
+// the other half at most this long and a key that stays undecided past its
+// timeout (a tap dance waiting for its next tap) keeps the other half waiting
+#define PROC_PENDING_RESEND_MS 50
+// Weight of the newest interval in the typing average, 1 / 2^shift
+#define PROC_TYPING_EWMA_SHIFT 2
+// Longer pauses count as this long, so the average recovers within a few keys
+#define PROC_TYPING_INTERVAL_MAX_MS 1000
+// A press later than this share of the average gap is a pause, not typing
+#define PROC_TYPING_PAUSE_PCT 150
+// Each combo's hold-back latency is logged once per this many decisions
+#define COMBO_STATS_LOG_EVERY 64
 
 // Key processing result types
 typedef enum
@@ -30,61 +68,141 @@ typedef enum
   KB_COMM_EVENT_TAP,
   KB_COMM_EVENT_BRIEF_TAP,
   KB_COMM_EVENT_LAYER_SYNC,
-  KB_COMM_EVENT_LAYER_DESYNC,
-  KB_COMM_EVENT_MOD_SYNC,
-  KB_COMM_EVENT_MOD_DESYNC,
-  KB_COMM_EVENT_CONSUMER
+  KB_COMM_EVENT_CONSUMER,
+  KB_COMM_EVENT_KEY_EVENT,   // kb_comm_key_event_t
+  KB_COMM_EVENT_HOLD_PENDING // Undecided local key's timeout in ms, 0 = none
+                             // (uint16_t)
 } kb_comm_event_t;
 
-// Forward declarations
+// Key event as sent to the other half, which runs on its own clock
+typedef struct
+{
+  uint32_t age_us; // Time since the event when it was sent
+  uint8_t  pos;    // KEY_POS on the sender's matrix
+  bool     pressed;
+} kb_comm_key_event_t;
+
+// Keyboard state, also the NKRO input report (HID_NKRO_REPORT_ID)
+typedef struct
+{
+  uint8_t modifiers;
+  uint8_t keys[HID_NKRO_BITMAP_BYTES]; // Bit n set while usage n is held
+} kb_mgt_hid_key_report_t;
+
+// 6KRO input report (HID_KEYBOARD_REPORT_ID), same layout as the boot report
 typedef struct
 {
   uint8_t modifiers;
   uint8_t reserved;
   uint8_t keys[HID_MAX_KEYS_IN_REPORT];
-} kb_mgt_hid_key_report_t;
+} kb_mgt_hid_boot_report_t;
 
 typedef struct
 {
   uint16_t usage;
 } kb_mgt_hid_consumer_report_t;
 
+// Messages from the remote half, applied by the processing task
+typedef enum
+{
+  KB_MGT_REMOTE_KEY_REPORT,   // Slave key report (master only)
+  KB_MGT_REMOTE_BRIEF_TAP,    // Slave report to send then release (master)
+  KB_MGT_REMOTE_CONSUMER,     // Slave consumer report (master only)
+  KB_MGT_REMOTE_LAYER_SYNC,   // Layers active on the other half
+  KB_MGT_REMOTE_KEY_EVENT,    // Key event on the other half
+  KB_MGT_REMOTE_HOLD_PENDING  // Other half started or ended a tap-hold
+} kb_mgt_remote_type_t;
+
 typedef struct
 {
-  uint8_t   current_layer;
-  uint32_t  layer_tap_timer[MATRIX_ROW][MATRIX_COL];
-  uint32_t  mod_tap_timer[MATRIX_ROW][MATRIX_COL];
-  uint16_t  key_tap_timeout[MATRIX_ROW][MATRIX_COL];
-  key_def_t pressed_keys[MATRIX_ROW][MATRIX_COL];
-  bool      key_is_tapped[MATRIX_ROW][MATRIX_COL];
-  bool      layer_momentary_active[MAX_LAYERS];
-  bool      pressed_key_active[MATRIX_ROW][MATRIX_COL];
-} proc_state_t;
+  kb_mgt_remote_type_t type;
+  union
+  {
+    kb_mgt_hid_key_report_t      key_report;
+    kb_mgt_hid_consumer_report_t consumer_report;
+    uint32_t                     layer_mask;
+    key_event_t                  key_event; // PROC_REMOTE_ROW, local clock
+    uint16_t                     hold_pending_ms; // 0 = decided
+  };
+} kb_mgt_remote_msg_t;
 
-// =============================================================================
-// HID MANAGEMENT
-// =============================================================================
+// Where a tap-hold key stands
+typedef enum
+{
+  PROC_UNDECIDED, // Waiting, later key events are held back
+  PROC_TAP,       // Tap key sent
+  PROC_HOLD       // Layer or modifier active
+} proc_decision_t;
 
-// Get current HID report
-kb_mgt_hid_key_report_t *kb_mgt_hid_get_current_key_report(void);
+// A key that is currently held down, or a tap-dance between two taps
+typedef struct
+{
+  key_def_t key;        // Definition resolved at press time
+  time_us_t pressed_at; // Start of the tap-hold window, last edge for a dance
+  uint16_t  timeout_ms; // Tap-hold timeout, 0 for DEFAULT_TIMEOUT_MS
+  uint8_t   row;
+  uint8_t   col;
+  uint8_t   decision;    // proc_decision_t, tap-hold keys only
+  bool      interrupted; // Another key was pressed while this one was held
+  uint8_t   taps;        // Tap-dance presses so far
+  bool      released;    // Tap-dance key is up, waiting for another tap
+} proc_held_key_t;
 
-// Get current HID(Consumer) report
-kb_mgt_hid_consumer_report_t *kb_mgt_hid_get_current_consumer_report(void);
+// Last tap-hold key that was tapped, for the quick-tap window
+typedef struct
+{
+  time_us_t released_at;
+  uint8_t   row;
+  uint8_t   col;
+  bool      valid;
+} proc_last_tap_t;
 
-// Send HID report (only if master)
-void kb_mgt_hid_send_key_report_unsafe(void);
+// Typing cadence, updated in O(1) on every press
+typedef struct
+{
+  time_us_t last_press_at;
+  uint32_t  interval_us; // Moving average of the time between presses
+  bool      valid;       // last_press_at holds a press
+} proc_typing_t;
 
-// Send HID(Consumer) report (only if master)
-void kb_mgt_hid_send_consumer_report_unsafe(void);
+typedef struct
+{
+  uint32_t        layer_base;      // Toggled base layer, a single bit
+  uint32_t        layer_momentary; // Momentary layers held on this half
+  uint32_t        layer_remote;    // Layers active on the other half
+  uint32_t        layer_synced;    // Local layers last sent to the other half
+  uint32_t        held_mask;       // Occupied slots of held[]
+  proc_held_key_t held[PROC_MAX_HELD_KEYS];
+  uint8_t         pending; // Undecided tap-hold or dance, PROC_SLOT_NONE
+  proc_last_tap_t last_tap;
+  proc_typing_t   typing;
+  uint16_t        pending_sent_ms; // Undecided timeout last sent to other half
+  time_us_t       pending_sent_at;
+  bool            remote_pending; // Other half is deciding a tap-hold key
+  time_us_t       remote_pending_until; // Stop waiting on it here
+} proc_state_t;
 
-// Clear entire HID report
-void kb_mgt_hid_clear_report(void);
+// How long combo keys were held back before the engine decided, logged
+// every COMBO_STATS_LOG_EVERY decisions of a combo
+typedef struct
+{
+  uint32_t count;          // Decisions taken
+  uint32_t latency_max_us; // Longest hold-back
+  uint64_t latency_sum_us; // Average is latency_sum_us / count
+} kb_mgt_combo_stats_t;
 
-// Sync modifier from remote half
-void kb_mgt_sync_modifier(uint8_t modifier);
+// How long tap-dance keys waited for their decision after their last press
+// or release
+typedef struct
+{
+  uint32_t count;          // Decisions taken
+  uint32_t early;          // Decided before the timeout ran out
+  uint32_t latency_max_us; // Longest wait
+  uint64_t latency_sum_us; // Average is latency_sum_us / count
+} kb_mgt_tap_dance_stats_t;
 
-// Desync modifier from remote half
-void kb_mgt_desync_modifier(uint8_t modifier);
+_Static_assert(PROC_MAX_HELD_KEYS <= 32, "held_mask is 32 bits");
+_Static_assert(MAX_LAYERS <= 32, "layer masks are 32 bits");
 
 // =============================================================================
 // LAYER MANAGEMENT
@@ -93,31 +211,64 @@ void kb_mgt_desync_modifier(uint8_t modifier);
 // Get current active layer
 uint8_t kb_mgt_layer_get_active(void);
 
-// Sync layer activation from remote half
-void kb_mgt_sync_layer(uint8_t layer);
+// =============================================================================
+// KEY PROCESSING
+// =============================================================================
+
+// Average time between recent key presses of both halves in ms,
+// PROC_TYPING_INTERVAL_MAX_MS when idle. Useful for tuning
+// HOLD_TAP_PRIOR_IDLE_MS and PROC_TYPING_PAUSE_PCT.
+uint32_t kb_mgt_typing_interval_ms(void);
+
+// =============================================================================
+// TAP DANCE
+// =============================================================================
 
-// Desync layer activation from remote half
-void kb_mgt_desync_layer(uint8_t layer);
+// Decision latency of one tap-dance key. Updated by the processing task, so
+// values read elsewhere may be mid-update.
+esp_err_t kb_mgt_tap_dance_get_stats(uint8_t                   dance,
+                                     kb_mgt_tap_dance_stats_t *stats);
 
 // =============================================================================
-// KEY PROCESSOR MANAGEMENT
+// HID TRANSPORT
 // =============================================================================
 
-// Check and handle tap timeouts
-void kb_mgt_proc_check_tap_timeouts(uint32_t current_time);
+// Record the protocol mode the host selected (ESP_HID_PROTOCOL_MODE_*). Boot
+// hosts only read the 6KRO report, so NKRO is used in report mode only.
+void kb_mgt_hid_set_protocol_mode(uint8_t protocol_mode);
+
+// Record the ATT MTU of the host connection, on connect and whenever it is
+// negotiated again. NKRO needs HID_NKRO_MIN_MTU, smaller ones get 6KRO.
+void kb_mgt_hid_set_mtu(uint16_t mtu);
+
+// A notification left the BLE host and returned one transmit credit
+// (master). Paces macro playback. Safe to call from other tasks.
+void kb_mgt_hid_tx_done(void);
+
+// The ESP-NOW driver reported frame seq (see send_to_espnow). The slave
+// paces macro playback on its own report frames and resends lost ones.
+// Call from the ESP-NOW task, in the order frames are reported.
+void kb_mgt_link_tx_done(uint32_t seq, bool delivered);
 
 // =============================================================================
 // MAIN MANAGEMENT INTERFACE
 // =============================================================================
+//
+// All keyboard management state is owned by the kb_mgt processing task. Other
+// tasks only hand it work through the two inboxes below.
 
-// Initialize all keyboard management subsystems
+// Initialize all keyboard management subsystems and start the processing task
 esp_err_t kb_mgt_init(void);
 
-// Process complete key event (combines all subsystems)
-void kb_mgt_process_key_event(key_def_t key, uint8_t row, uint8_t col,
-                              bool pressed, uint32_t timestamp);
+// Queue a debounced key event. Only the matrix scan task may call this (the
+// ring is single-producer). Never blocks; returns false if the ring is full.
+bool kb_mgt_post_key_event(const key_event_t *event);
 
-// Send final report after processing events.
-void kb_mgt_finalize_processing(void);
+// Queue a message received from the remote half. Only the ESP-NOW task may
+// call this. Never blocks. Key reports, consumer reports, layer syncs and hold
+// pending states replace one of their kind not applied yet, so they always
+// fit; key events and brief taps are queued and ESP_FAIL means the inbox was
+// full (the processing task logs how many were lost).
+esp_err_t kb_mgt_post_remote(const kb_mgt_remote_msg_t *msg);
 
 #endif // KB_MGT_H
@@ -1,8 +1,21 @@
 #include "keymap.h"
 #include "config.h"
 
-// Define keymaps for each layer
-static const key_def_t keymaps[MAX_LAYERS][MATRIX_ROW][MATRIX_COL] = {
+static const char *TAG = "KEYMAP";
+
+_Static_assert(MAX_KEYS <= 32, "sparse layer bitmaps are 32 bits");
+
+// Upper layer stored sparsely: positions it leaves out are transparent
+typedef struct
+{
+  uint32_t          defined;   // KEY_POS_BIT of each position it defines
+  const key_code_t *codes;     // Definitions in ascending position order
+  const uint8_t    *positions; // KEY_POS of each code, checked by keymap_init
+  uint8_t           count;
+} keymap_sparse_layer_t;
+
+// Layer 0 is stored densely, every position is defined
+static const key_code_t keymap_base[MATRIX_ROW][MATRIX_COL] = {
 #if !IS_MASTER
     // Layer 0 - Base layer Left Side (Homerow Mods: GACS)
     // =    1  2  3  4  5
@@ -10,16 +23,16 @@ static const key_def_t keymaps[MAX_LAYERS][MATRIX_ROW][MATRIX_COL] = {
     // CTL  A  S  D  F  G
     //      Z  X  C  V  B
     //                  L1/TAB  GUI/SPC
-    [0] = {{NORM_KEY(KC_EQUAL), NORM_KEY(KC_1), NORM_KEY(KC_2), NORM_KEY(KC_3),
-            NORM_KEY(KC_4), NORM_KEY(KC_5)},
-           {NORM_KEY(KC_ESC), NORM_KEY(KC_Q), NORM_KEY(KC_W), NORM_KEY(KC_E),
-            NORM_KEY(KC_R), NORM_KEY(KC_T)},
-           {MOD_KEY(KC_LCTRL), NORM_KEY(KC_A), MT_TO(KC_LALT, KC_S, 270),
-            MT_TO(KC_LCTRL, KC_D, 200), NORM_KEY(KC_F), NORM_KEY(KC_G)},
-           {MOD_KEY(KC_LALT), NORM_KEY(KC_Z), NORM_KEY(KC_X), NORM_KEY(KC_C),
-            NORM_KEY(KC_V), NORM_KEY(KC_B)},
-           {NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-            LT_TO(1, KC_TAB, 100), MT_TO(KC_LGUI, KC_SPACE, 200)}},
+    {NORM_KEY(KC_EQUAL), NORM_KEY(KC_1), NORM_KEY(KC_2), NORM_KEY(KC_3),
+     NORM_KEY(KC_4), NORM_KEY(KC_5)},
+    {NORM_KEY(KC_ESC), NORM_KEY(KC_Q), NORM_KEY(KC_W), NORM_KEY(KC_E),
+     NORM_KEY(KC_R), NORM_KEY(KC_T)},
+    {MOD_KEY(KC_LCTRL), NORM_KEY(KC_A), MT_TO(KC_LALT, KC_S, 270),
+     MT_TO(KC_LCTRL, KC_D, 200), NORM_KEY(KC_F), NORM_KEY(KC_G)},
+    {MOD_KEY(KC_LALT), NORM_KEY(KC_Z), NORM_KEY(KC_X), NORM_KEY(KC_C),
+     NORM_KEY(KC_V), NORM_KEY(KC_B)},
+    {NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
+     LT_TO(1, KC_TAB, 100), MT_TO(KC_LGUI, KC_SPACE, 200)},
 #else
     // Layer 0 - Base layer Right Side (Homerow Mods: SCAG)
     //        6    7    8    9    0    -
@@ -27,114 +40,425 @@ static const key_def_t keymaps[MAX_LAYERS][MATRIX_ROW][MATRIX_COL] = {
     //        H    J    K    L    ;    '
     //        N    M    ,    .    /    ESC
     // SHIFT/ENT   L2/BS
-    [0] = {{NORM_KEY(KC_6), NORM_KEY(KC_7), NORM_KEY(KC_8), NORM_KEY(KC_9),
-            NORM_KEY(KC_0), NORM_KEY(KC_MINUS)},
-           {NORM_KEY(KC_Y), NORM_KEY(KC_U), NORM_KEY(KC_I), NORM_KEY(KC_O),
-            NORM_KEY(KC_P), NORM_KEY(KC_BSLASH)},
-           {NORM_KEY(KC_H), NORM_KEY(KC_J), MT_TO(KC_RCTRL, KC_K, 200),
-            MT_TO(KC_RALT, KC_L, 270), NORM_KEY(KC_SEMICOLON),
-            NORM_KEY(KC_QUOT)},
-           {NORM_KEY(KC_N), NORM_KEY(KC_M), NORM_KEY(KC_COMMA),
-            NORM_KEY(KC_DOT), NORM_KEY(KC_SLASH), NORM_KEY(KC_ESC)},
-           {MT_TO(KC_RSHIFT, KC_ENTER, 80), LT_TO(2, KC_BSPC, 100),
-            NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-            NORM_KEY(KC_NO)}},
+    {NORM_KEY(KC_6), NORM_KEY(KC_7), NORM_KEY(KC_8), NORM_KEY(KC_9),
+     NORM_KEY(KC_0), NORM_KEY(KC_MINUS)},
+    {NORM_KEY(KC_Y), NORM_KEY(KC_U), NORM_KEY(KC_I), NORM_KEY(KC_O),
+     NORM_KEY(KC_P), NORM_KEY(KC_BSLASH)},
+    {NORM_KEY(KC_H), NORM_KEY(KC_J), MT_TO(KC_RCTRL, KC_K, 200),
+     MT_TO(KC_RALT, KC_L, 270), NORM_KEY(KC_SEMICOLON), NORM_KEY(KC_QUOT)},
+    {NORM_KEY(KC_N), NORM_KEY(KC_M), NORM_KEY(KC_COMMA), NORM_KEY(KC_DOT),
+     NORM_KEY(KC_SLASH), NORM_KEY(KC_ESC)},
+    {MT_TO(KC_RSHIFT, KC_ENTER, 80), LT_TO(2, KC_BSPC, 100), NORM_KEY(KC_NO),
+     NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO)},
 #endif
+};
 
 #if !IS_MASTER
-    // Layer 1 - Function Symbol layer Left side
-    // =    F2    F3    F4    F5    F6
-    // TAB  `     <     >     -     |
-    // CTL  !     *     /     =     &
-    //      ~     +     ?     _     %
-    //                        TRNS TRNS
-    [1] =
-        {
-            {TRANS_KEY(), NORM_KEY(KC_F2), NORM_KEY(KC_F3), NORM_KEY(KC_F4),
-             NORM_KEY(KC_F5), NORM_KEY(KC_F6)},
-            {TRANS_KEY(), NORM_KEY(KC_GRAVE), SHIFT_KEY(KC_COMMA),
-             SHIFT_KEY(KC_DOT), NORM_KEY(KC_MINUS), SHIFT_KEY(KC_BSLASH)},
-            {TRANS_KEY(), SHIFT_KEY(KC_1), SHIFT_KEY(KC_8), NORM_KEY(KC_SLASH),
-             NORM_KEY(KC_EQUAL), SHIFT_KEY(KC_7)},
-            {TRANS_KEY(), SHIFT_KEY(KC_GRAVE), SHIFT_KEY(KC_EQUAL),
-             SHIFT_KEY(KC_SLASH), SHIFT_KEY(KC_MINUS), SHIFT_KEY(KC_5)},
-            {NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-             TRANS_KEY(), TRANS_KEY()},
-        },
+// Layer 1 - Function Symbol layer Left side
+// =    F2    F3    F4    F5    F6
+// TAB  `     <     >     -     |
+// CTL  !     *     /     =     &
+//      ~     +     ?     _     %
+//                        TRNS TRNS
+#define LAYER_1_KEYS(X)                                                        \
+  X(0, 1, NORM_KEY(KC_F2))                                                     \
+  X(0, 2, NORM_KEY(KC_F3))                                                     \
+  X(0, 3, NORM_KEY(KC_F4))                                                     \
+  X(0, 4, NORM_KEY(KC_F5))                                                     \
+  X(0, 5, NORM_KEY(KC_F6))                                                     \
+  X(1, 1, NORM_KEY(KC_GRAVE))                                                  \
+  X(1, 2, SHIFT_KEY(KC_COMMA))                                                 \
+  X(1, 3, SHIFT_KEY(KC_DOT))                                                   \
+  X(1, 4, NORM_KEY(KC_MINUS))                                                  \
+  X(1, 5, SHIFT_KEY(KC_BSLASH))                                                \
+  X(2, 1, SHIFT_KEY(KC_1))                                                     \
+  X(2, 2, SHIFT_KEY(KC_8))                                                     \
+  X(2, 3, NORM_KEY(KC_SLASH))                                                  \
+  X(2, 4, NORM_KEY(KC_EQUAL))                                                  \
+  X(2, 5, SHIFT_KEY(KC_7))                                                     \
+  X(3, 1, SHIFT_KEY(KC_GRAVE))                                                 \
+  X(3, 2, SHIFT_KEY(KC_EQUAL))                                                 \
+  X(3, 3, SHIFT_KEY(KC_SLASH))                                                 \
+  X(3, 4, SHIFT_KEY(KC_MINUS))                                                 \
+  X(3, 5, SHIFT_KEY(KC_5))                                                     \
+  X(4, 0, NORM_KEY(KC_NO))                                                     \
+  X(4, 1, NORM_KEY(KC_NO))                                                     \
+  X(4, 2, NORM_KEY(KC_NO))                                                     \
+  X(4, 3, NORM_KEY(KC_NO))
 #else
-    // Layer 1 - Function Symbol layer Right side
-    //          F7   F8   F9   F10  F11  F12
-    //          ^    "    :    ;    _    bslash
-    //          $    (    {    [    @    TRNS
-    //          #    )    }    ]    NO   NO
-    // TRNS          0
-    [1] =
-        {
-            {NORM_KEY(KC_F7), NORM_KEY(KC_F8), NORM_KEY(KC_F9),
-             NORM_KEY(KC_F10), NORM_KEY(KC_F11), NORM_KEY(KC_F12)},
-            {SHIFT_KEY(KC_6), SHIFT_KEY(KC_QUOT), SHIFT_KEY(KC_SEMICOLON),
-             NORM_KEY(KC_SEMICOLON), SHIFT_KEY(KC_MINUS), NORM_KEY(KC_BSLASH)},
-            {SHIFT_KEY(KC_4), SHIFT_KEY(KC_9), SHIFT_KEY(KC_LBRC),
-             NORM_KEY(KC_LBRC), SHIFT_KEY(KC_2), TRANS_KEY()},
-            {SHIFT_KEY(KC_3), SHIFT_KEY(KC_0), SHIFT_KEY(KC_RBRC),
-             NORM_KEY(KC_RBRC), NORM_KEY(KC_NO), TRANS_KEY()},
-            {TRANS_KEY(), NORM_KEY(KC_0), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-             NORM_KEY(KC_NO), NORM_KEY(KC_NO)},
-        },
+// Layer 1 - Function Symbol layer Right side
+//          F7   F8   F9   F10  F11  F12
+//          ^    "    :    ;    _    bslash
+//          $    (    {    [    @    TRNS
+//          #    )    }    ]    NO   NO
+// TRNS          0
+#define LAYER_1_KEYS(X)                                                        \
+  X(0, 0, NORM_KEY(KC_F7))                                                     \
+  X(0, 1, NORM_KEY(KC_F8))                                                     \
+  X(0, 2, NORM_KEY(KC_F9))                                                     \
+  X(0, 3, NORM_KEY(KC_F10))                                                    \
+  X(0, 4, NORM_KEY(KC_F11))                                                    \
+  X(0, 5, NORM_KEY(KC_F12))                                                    \
+  X(1, 0, SHIFT_KEY(KC_6))                                                     \
+  X(1, 1, SHIFT_KEY(KC_QUOT))                                                  \
+  X(1, 2, SHIFT_KEY(KC_SEMICOLON))                                             \
+  X(1, 3, NORM_KEY(KC_SEMICOLON))                                              \
+  X(1, 4, SHIFT_KEY(KC_MINUS))                                                 \
+  X(1, 5, NORM_KEY(KC_BSLASH))                                                 \
+  X(2, 0, SHIFT_KEY(KC_4))                                                     \
+  X(2, 1, SHIFT_KEY(KC_9))                                                     \
+  X(2, 2, SHIFT_KEY(KC_LBRC))                                                  \
+  X(2, 3, NORM_KEY(KC_LBRC))                                                   \
+  X(2, 4, SHIFT_KEY(KC_2))                                                     \
+  X(3, 0, SHIFT_KEY(KC_3))                                                     \
+  X(3, 1, SHIFT_KEY(KC_0))                                                     \
+  X(3, 2, SHIFT_KEY(KC_RBRC))                                                  \
+  X(3, 3, NORM_KEY(KC_RBRC))                                                   \
+  X(3, 4, NORM_KEY(KC_NO))                                                     \
+  X(4, 1, NORM_KEY(KC_0))                                                      \
+  X(4, 2, NORM_KEY(KC_NO))                                                     \
+  X(4, 3, NORM_KEY(KC_NO))                                                     \
+  X(4, 4, NORM_KEY(KC_NO))                                                     \
+  X(4, 5, NORM_KEY(KC_NO))
 #endif
 
 #if !IS_MASTER
-    // Layer 2 - Media Navigation layer Left side
-    // ESC      F2      F3      F4      F5      F6
-    // TAB      NO      MUTE    VOL_D   VOL_U   NO
-    // CTRL     NO      PREV    NEXT    PLAY    STOP
-    // ALT      NO      NO      NO      NO      NO
-    //                                  L1/TAB  GUI/SPC
-    [2] =
-        {
-            {TRANS_KEY(), NORM_KEY(KC_F2), NORM_KEY(KC_F3), NORM_KEY(KC_F4),
-             NORM_KEY(KC_F5), NORM_KEY(KC_F6)},
-            {TRANS_KEY(), CONS_KEY(KC_BRIGHTNESS_UP), CONS_KEY(KC_AUDIO_MUTE),
-             CONS_KEY(KC_AUDIO_VOL_DOWN), CONS_KEY(KC_AUDIO_VOL_UP),
-             NORM_KEY(KC_NO)},
-            {TRANS_KEY(), CONS_KEY(KC_BRIGHTNESS_DOWN),
-             CONS_KEY(KC_MEDIA_PREV_TRACK), CONS_KEY(KC_MEDIA_NEXT_TRACK),
-             CONS_KEY(KC_MEDIA_PLAY_PAUSE), CONS_KEY(KC_MEDIA_STOP)},
-            {TRANS_KEY(), NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-             NORM_KEY(KC_NO), NORM_KEY(KC_NO)},
-            {NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO), TRANS_KEY(),
-             TRANS_KEY(), TRANS_KEY()},
-        },
+// Layer 2 - Media Navigation layer Left side
+// ESC      F2      F3      F4      F5      F6
+// TAB      NO      MUTE    VOL_D   VOL_U   NO
+// CTRL     NO      PREV    NEXT    PLAY    STOP
+// ALT      NO      NO      NO      NO      NO
+//                                  L1/TAB  GUI/SPC
+#define LAYER_2_KEYS(X)                                                        \
+  X(0, 1, NORM_KEY(KC_F2))                                                     \
+  X(0, 2, NORM_KEY(KC_F3))                                                     \
+  X(0, 3, NORM_KEY(KC_F4))                                                     \
+  X(0, 4, NORM_KEY(KC_F5))                                                     \
+  X(0, 5, NORM_KEY(KC_F6))                                                     \
+  X(1, 1, CONS_KEY(KC_BRIGHTNESS_UP))                                          \
+  X(1, 2, CONS_KEY(KC_AUDIO_MUTE))                                             \
+  X(1, 3, CONS_KEY(KC_AUDIO_VOL_DOWN))                                         \
+  X(1, 4, CONS_KEY(KC_AUDIO_VOL_UP))                                           \
+  X(1, 5, NORM_KEY(KC_NO))                                                     \
+  X(2, 1, CONS_KEY(KC_BRIGHTNESS_DOWN))                                        \
+  X(2, 2, CONS_KEY(KC_MEDIA_PREV_TRACK))                                       \
+  X(2, 3, CONS_KEY(KC_MEDIA_NEXT_TRACK))                                       \
+  X(2, 4, CONS_KEY(KC_MEDIA_PLAY_PAUSE))                                       \
+  X(2, 5, CONS_KEY(KC_MEDIA_STOP))                                             \
+  X(3, 1, NORM_KEY(KC_NO))                                                     \
+  X(3, 2, NORM_KEY(KC_NO))                                                     \
+  X(3, 3, NORM_KEY(KC_NO))                                                     \
+  X(3, 4, NORM_KEY(KC_NO))                                                     \
+  X(3, 5, NORM_KEY(KC_NO))                                                     \
+  X(4, 0, NORM_KEY(KC_NO))                                                     \
+  X(4, 1, NORM_KEY(KC_NO))                                                     \
+  X(4, 2, NORM_KEY(KC_NO))
 #else
-    // Layer 2 - Media Navigation layer Right side
-    //      F7       F8       F9       F10      F11      F12
-    //      PGUP     HOME     UP       END      NO       DEL
-    //      PGDOWN   LEFT     DOWN     RIGHT    NO       INS
-    //      NO       NO       NO       NO       NO       TRNS
-    // TRNS          TRNS
-    [2] =
-        {
-            {NORM_KEY(KC_F7), NORM_KEY(KC_F8), NORM_KEY(KC_F9),
-             NORM_KEY(KC_F10), NORM_KEY(KC_F11), NORM_KEY(KC_F12)},
-            {NORM_KEY(KC_PGUP), NORM_KEY(KC_HOME), NORM_KEY(KC_UP),
-             NORM_KEY(KC_END), NORM_KEY(KC_NO), NORM_KEY(KC_DEL)},
-            {NORM_KEY(KC_PGDN), NORM_KEY(KC_LEFT), NORM_KEY(KC_DOWN),
-             NORM_KEY(KC_RIGHT), NORM_KEY(KC_NO), NORM_KEY(KC_INS)},
-            {NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-             NORM_KEY(KC_NO), TRANS_KEY()},
-            {TRANS_KEY(), TRANS_KEY(), NORM_KEY(KC_NO), NORM_KEY(KC_NO),
-             NORM_KEY(KC_NO), NORM_KEY(KC_NO)},
-        },
+// Layer 2 - Media Navigation layer Right side
+//      F7       F8       F9       F10      F11      F12
+//      PGUP     HOME     UP       END      NO       DEL
+//      PGDOWN   LEFT     DOWN     RIGHT    NO       INS
+//      NO       NO       NO       NO       NO       TRNS
+// TRNS          TRNS
+#define LAYER_2_KEYS(X)                                                        \
+  X(0, 0, NORM_KEY(KC_F7))                                                     \
+  X(0, 1, NORM_KEY(KC_F8))                                                     \
+  X(0, 2, NORM_KEY(KC_F9))                                                     \
+  X(0, 3, NORM_KEY(KC_F10))                                                    \
+  X(0, 4, NORM_KEY(KC_F11))                                                    \
+  X(0, 5, NORM_KEY(KC_F12))                                                    \
+  X(1, 0, NORM_KEY(KC_PGUP))                                                   \
+  X(1, 1, NORM_KEY(KC_HOME))                                                   \
+  X(1, 2, NORM_KEY(KC_UP))                                                     \
+  X(1, 3, NORM_KEY(KC_END))                                                    \
+  X(1, 4, NORM_KEY(KC_NO))                                                     \
+  X(1, 5, NORM_KEY(KC_DEL))                                                    \
+  X(2, 0, NORM_KEY(KC_PGDN))                                                   \
+  X(2, 1, NORM_KEY(KC_LEFT))                                                   \
+  X(2, 2, NORM_KEY(KC_DOWN))                                                   \
+  X(2, 3, NORM_KEY(KC_RIGHT))                                                  \
+  X(2, 4, NORM_KEY(KC_NO))                                                     \
+  X(2, 5, NORM_KEY(KC_INS))                                                    \
+  X(3, 0, NORM_KEY(KC_NO))                                                     \
+  X(3, 1, NORM_KEY(KC_NO))                                                     \
+  X(3, 2, NORM_KEY(KC_NO))                                                     \
+  X(3, 3, NORM_KEY(KC_NO))                                                     \
+  X(3, 4, NORM_KEY(KC_NO))                                                     \
+  X(4, 2, NORM_KEY(KC_NO))                                                     \
+  X(4, 3, NORM_KEY(KC_NO))                                                     \
+  X(4, 4, NORM_KEY(KC_NO))                                                     \
+  X(4, 5, NORM_KEY(KC_NO))
 #endif
+
+// Expand a LAYER_n_KEYS(X) list into its bitmap and packed arrays. Entries
+// must be listed in ascending position order (row by row).
+#define SPARSE_BIT(row, col, code)  | KEY_POS_BIT(row, col)
+#define SPARSE_CODE(row, col, code) code,
+#define SPARSE_POS(row, col, code)  KEY_POS(row, col),
+#define SPARSE_LAYER(keys)                                                     \
+  {.defined = 0 keys(SPARSE_BIT),                                              \
+   .codes = (const key_code_t[]){keys(SPARSE_CODE)},                           \
+   .positions = (const uint8_t[]){keys(SPARSE_POS)},                           \
+   .count = sizeof((const uint8_t[]){keys(SPARSE_POS)})}
+
+static const keymap_sparse_layer_t keymap_upper[MAX_LAYERS - 1] = {
+    SPARSE_LAYER(LAYER_1_KEYS),
+    SPARSE_LAYER(LAYER_2_KEYS),
+};
+
+// Combos work on every layer, by position. None ship by default: a press of
+// any member key waits up to COMBO_TERM_MS for the rest, so a combo on base
+// layer letters delays typing them and turns a fast roll over the pair into
+// the combo. An entry looks like this one for X + C on the left half:
+//   {KEY_POS_BIT(3, 2) | KEY_POS_BIT(3, 3), NORM_KEY(KC_ESC)},
+static const keymap_combo_t keymap_combos[] = {};
+
+_Static_assert(sizeof(keymap_combos) / sizeof(keymap_combos[0]) <=
+                   KEYMAP_MAX_COMBOS,
+               "combo candidates are a 32-bit mask");
+
+#define MACRO(...)                                                             \
+  {.code = (const uint8_t[]){__VA_ARGS__},                                     \
+   .length = sizeof((const uint8_t[]){__VA_ARGS__})}
+
+// Played by MACRO_KEY(id), id is the index here. None is bound by default.
+static const keymap_macro_t keymap_macros[] = {
+    // M0: select all, copy
+    MACRO(MACRO_MOD_DOWN(HID_MOD_LEFT_CTRL), MACRO_TAP(KC_A), MACRO_TAP(KC_C),
+          MACRO_MOD_UP(HID_MOD_LEFT_CTRL)),
+};
+
+#define KEYMAP_MACRO_COUNT (sizeof(keymap_macros) / sizeof(keymap_macros[0]))
+
+// Played by TD(id), id is the index here. Unused counts are 0. None is bound
+// by default.
+static const keymap_tap_dance_t keymap_tap_dances[] = {
+    // TD0: print screen, scroll lock, pause; tap then hold for GUI
+    {.tap = {NORM_KEY(KC_PSCR), NORM_KEY(KC_SLCK), NORM_KEY(KC_PAUSE)},
+     .hold = {[1] = MOD_KEY(KC_LGUI)}},
 };
 
+_Static_assert(sizeof(keymap_tap_dances) / sizeof(keymap_tap_dances[0]) <=
+                   KEYMAP_MAX_TAP_DANCES,
+               "tap-dance stats are sized by KEYMAP_MAX_TAP_DANCES");
+
+static bool keymap_macro_valid(const keymap_macro_t *macro);
+static bool keymap_tap_dance_action_valid(key_code_t code);
+static bool keymap_tap_dance_valid(const keymap_tap_dance_t *dance);
+
+static key_code_t keymap_code(uint8_t layer, uint8_t row, uint8_t col)
+{
+  if (layer == 0)
+  {
+    return keymap_base[row][col];
+  }
+
+  // Rank of the position among the defined ones indexes the packed array
+  const keymap_sparse_layer_t *sparse = &keymap_upper[layer - 1];
+  uint32_t                     bit = KEY_POS_BIT(row, col);
+
+  if ((sparse->defined & bit) == 0)
+  {
+    return TRANS_KEY();
+  }
+  return sparse->codes[__builtin_popcount(sparse->defined & (bit - 1))];
+}
+
+esp_err_t keymap_init(void)
+{
+  for (uint8_t layer = 1; layer < MAX_LAYERS; layer++)
+  {
+    const keymap_sparse_layer_t *sparse = &keymap_upper[layer - 1];
+
+    bool ok = sparse->count == __builtin_popcount(sparse->defined);
+    for (uint8_t i = 1; ok && i < sparse->count; i++)
+    {
+      ok = sparse->positions[i] > sparse->positions[i - 1];
+    }
+
+    if (!ok)
+    {
+      ESP_LOGE(TAG, "Layer %d keys must be unique and in position order",
+               layer);
+      return ESP_ERR_INVALID_STATE;
+    }
+  }
+
+  for (uint8_t i = 0; i < keymap_combo_count(); i++)
+  {
+    uint32_t keys = keymap_combos[i].keys;
+    int      count = __builtin_popcount(keys);
+    bool     ok = count >= 2 && count <= KEYMAP_COMBO_MAX_KEYS &&
+              (keys & ~(0xFFFFFFFFU >> (32 - MAX_KEYS))) == 0;
+
+    for (uint8_t j = 0; ok && j < i; j++)
+    {
+      ok = keymap_combos[j].keys != keys;
+    }
+
+    if (!ok)
+    {
+      ESP_LOGE(TAG, "Combo %d needs 2-%d unique keys inside the matrix", i,
+               KEYMAP_COMBO_MAX_KEYS);
+      return ESP_ERR_INVALID_STATE;
+    }
+  }
+
+  for (uint8_t id = 0; id < KEYMAP_MACRO_COUNT; id++)
+  {
+    if (!keymap_macro_valid(&keymap_macros[id]))
+    {
+      ESP_LOGE(TAG, "Macro %d has a bad opcode or a truncated argument", id);
+      return ESP_ERR_INVALID_STATE;
+    }
+  }
+
+  for (uint8_t id = 0; id < keymap_tap_dance_count(); id++)
+  {
+    if (!keymap_tap_dance_valid(&keymap_tap_dances[id]))
+    {
+      ESP_LOGE(TAG, "Tap-dance %d needs a first action and only plain keys",
+               id);
+      return ESP_ERR_INVALID_STATE;
+    }
+  }
+
+  ESP_LOGI(TAG, "Keymap ready: %d layers, %d combos, %d macros, %d tap-dances",
+           MAX_LAYERS, keymap_combo_count(), (int)KEYMAP_MACRO_COUNT,
+           keymap_tap_dance_count());
+  return ESP_OK;
+}
+
+uint8_t keymap_combo_count(void)
+{
+  return sizeof(keymap_combos) / sizeof(keymap_combos[0]);
+}
+
+const keymap_combo_t *keymap_get_combo(uint8_t index)
+{
+  return index < keymap_combo_count() ? &keymap_combos[index] : NULL;
+}
+
+const keymap_macro_t *keymap_get_macro(uint8_t id)
+{
+  return id < KEYMAP_MACRO_COUNT ? &keymap_macros[id] : NULL;
+}
+
+uint8_t keymap_tap_dance_count(void)
+{
+  return sizeof(keymap_tap_dances) / sizeof(keymap_tap_dances[0]);
+}
+
+const keymap_tap_dance_t *keymap_get_tap_dance(uint8_t id)
+{
+  return id < keymap_tap_dance_count() ? &keymap_tap_dances[id] : NULL;
+}
+
+// Every opcode is known and its argument ends inside the macro
+static bool keymap_macro_valid(const keymap_macro_t *macro)
+{
+  uint16_t pc = 0;
+
+  while (pc < macro->length)
+  {
+    uint8_t op = macro->code[pc++];
+
+    if (op >= MACRO_OP_COUNT)
+    {
+      return false;
+    }
+
+    if (op == MACRO_OP_DELAY)
+    {
+      // Varint continuation bytes have the top bit set
+      while (pc < macro->length && (macro->code[pc] & 0x80))
+      {
+        pc++;
+      }
+    }
+
+    if (pc++ >= macro->length)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Dance actions run on the decision, so none may wait on one of its own
+static bool keymap_tap_dance_action_valid(key_code_t code)
+{
+  key_type_t type = keymap_decode(code).type;
+
+  return type != KEY_TYPE_LAYER_TAP && type != KEY_TYPE_MOD_TAP &&
+         type != KEY_TYPE_TAP_DANCE && type != KEY_TYPE_TRANSPARENT;
+}
+
+// A single tap or hold does something and every action is a plain key
+static bool keymap_tap_dance_valid(const keymap_tap_dance_t *dance)
+{
+  if (dance->tap[0] == 0 && dance->hold[0] == 0)
+  {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < KEYMAP_TAP_DANCE_MAX_TAPS; i++)
+  {
+    if (!keymap_tap_dance_action_valid(dance->tap[i]) ||
+        !keymap_tap_dance_action_valid(dance->hold[i]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 key_def_t keymap_get_key(uint8_t layer, uint8_t row, uint8_t col)
 {
   if (layer >= MAX_LAYERS || row >= MATRIX_ROW || col >= MATRIX_COL)
   {
-    return NORM_KEY(KC_NO);
+    return keymap_decode(NORM_KEY(KC_NO));
   }
-  return keymaps[layer][row][col];
+  return keymap_decode(keymap_code(layer, row, col));
+}
+
+key_def_t keymap_decode(key_code_t code)
+{
+  key_def_t key = {.type = code >> KEY_CODE_TYPE_SHIFT};
+
+  switch (key.type)
+  {
+  case KEY_TYPE_MOD_TAP:
+    key.mod_tap.tap_key = code & 0xFF;
+    key.mod_tap.hold_key = (code >> KEY_CODE_HOLD_SHIFT) & 0xFF;
+    key.mod_tap.tap_timeout_ms =
+        (code >> KEY_CODE_TIMEOUT_SHIFT) & KEY_CODE_TIMEOUT_MAX;
+    key.mod_tap.flavor =
+        (code >> KEY_CODE_FLAVOR_SHIFT) & KEY_CODE_FLAVOR_MAX;
+    break;
+
+  case KEY_TYPE_LAYER_TAP:
+    key.layer_tap.tap_key = code & 0xFF;
+    key.layer_tap.layer = (code >> KEY_CODE_HOLD_SHIFT) & 0xFF;
+    key.layer_tap.tap_timeout_ms =
+        (code >> KEY_CODE_TIMEOUT_SHIFT) & KEY_CODE_TIMEOUT_MAX;
+    key.layer_tap.flavor =
+        (code >> KEY_CODE_FLAVOR_SHIFT) & KEY_CODE_FLAVOR_MAX;
+    break;
+
+  case KEY_TYPE_CONSUMER:
+    key.consumer = code & 0xFFFF;
+    break;
+
+  default:
+    // keycode, modifier, layer and macro_id share the low byte
+    key.keycode = code & 0xFF;
+    break;
+  }
+
+  return key;
 }
 
 static const char *key_to_string(key_def_t key)
@@ -269,6 +593,8 @@ static const char *key_to_string(key_def_t key)
     return "Macro";
   case KEY_TYPE_TRANSPARENT:
     return "Transparent";
+  case KEY_TYPE_TAP_DANCE:
+    return "TapDance";
   case KEY_TYPE_SHIFTED:
     switch (key.keycode)
     {
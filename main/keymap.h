@@ -15,10 +15,26 @@ typedef enum
   KEY_TYPE_LAYER_TOGGLE,
   KEY_TYPE_CONSUMER,
   KEY_TYPE_MACRO,
-  KEY_TYPE_TRANSPARENT
+  KEY_TYPE_TRANSPARENT,
+  KEY_TYPE_TAP_DANCE
 } key_type_t;
 
-// Key definition structure
+// How a tap-hold key decides between tap and hold while it is held. Keys
+// pressed in the meantime wait for the decision, so they are processed on the
+// layer and with the modifiers it selects.
+typedef enum
+{
+  HOLD_TAP_TAP_PREFERRED,   // Hold only once the timeout passes
+  HOLD_TAP_BALANCED,        // Also hold when another key is tapped inside it
+  HOLD_TAP_HOLD_PREFERRED,  // Also hold as soon as another key is pressed
+  HOLD_TAP_PERMISSIVE_HOLD, // Hold when another key is tapped inside it, as
+                            // balanced does (QMK's name for it)
+  HOLD_TAP_OPPOSITE_HANDS,  // Hold as soon as a key on the other half is
+                            // pressed, tap as soon as one on this half is
+                            // (home-row mods)
+} hold_tap_flavor_t;
+
+// Decoded key definition, what key processing works with
 typedef struct
 {
   key_type_t type;
@@ -33,18 +49,105 @@ typedef struct
       uint8_t  tap_key;
       uint8_t  hold_key;
       uint16_t tap_timeout_ms; // 0 = use default TAP_TIMEOUT_MS
+      uint8_t  flavor;         // hold_tap_flavor_t
     } mod_tap;
     struct
     {
       uint8_t  tap_key;
       uint8_t  layer;
       uint16_t tap_timeout_ms; // 0 = use default TAP_TIMEOUT_MS
+      uint8_t  flavor;         // hold_tap_flavor_t
     } layer_tap;
-    uint8_t layer;    // For layer keys
-    uint8_t macro_id; // For macros
+    uint8_t layer;     // For layer keys
+    uint8_t macro_id;  // For macros
+    uint8_t tap_dance; // For tap-dance keys
   };
 } key_def_t;
 
+// Packed key action as stored in the keymap tables:
+//   bits 31-28  key_type_t
+//   bits 27-25  hold_tap_flavor_t (tap-hold keys)
+//   bits 24-16  tap-hold timeout in ms (0 = default, max 511)
+//   bits 15-8   hold modifier or layer (tap-hold keys)
+//   bits 15-0   consumer usage
+//   bits 7-0    keycode, modifier, tap key, layer, macro or tap-dance id
+typedef uint32_t key_code_t;
+
+#define KEY_CODE_TYPE_SHIFT    28
+#define KEY_CODE_FLAVOR_SHIFT  25
+#define KEY_CODE_TIMEOUT_SHIFT 16
+#define KEY_CODE_HOLD_SHIFT    8
+#define KEY_CODE_FLAVOR_MAX    0x7
+#define KEY_CODE_TIMEOUT_MAX   0x1FF
+
+#define KEY_CODE(type, payload)                                                \
+  (((key_code_t)(type) << KEY_CODE_TYPE_SHIFT) | (key_code_t)(payload))
+
+// Keymap timeouts are constants, so one too long for its field fails the
+// build instead of wrapping
+#define KEY_CODE_TIMEOUT(timeout)                                              \
+  ((timeout) + 0 * sizeof(char[(timeout) <= KEY_CODE_TIMEOUT_MAX ? 1 : -1]))
+#define KEY_CODE_TAP_HOLD(type, tap, hold, timeout, flavor)                    \
+  KEY_CODE(type, ((tap) & 0xFF) | (((hold) & 0xFF) << KEY_CODE_HOLD_SHIFT) |   \
+                     (KEY_CODE_TIMEOUT(timeout) << KEY_CODE_TIMEOUT_SHIFT) |   \
+                     (((flavor) & KEY_CODE_FLAVOR_MAX)                         \
+                      << KEY_CODE_FLAVOR_SHIFT))
+
+// Matrix position index, used by the sparse layer bitmaps
+#define KEY_POS(row, col)     ((row) * MATRIX_COL + (col))
+#define KEY_POS_BIT(row, col) (1UL << KEY_POS(row, col))
+
+// Keys pressed together that trigger one action instead of their own
+typedef struct
+{
+  uint32_t   keys;   // KEY_POS_BIT of each key, keymap columns
+  key_code_t action; // Runs like a key press for as long as the combo is held
+} keymap_combo_t;
+
+#define KEYMAP_MAX_COMBOS     32 // Candidate combos are tracked as a bitmask
+#define KEYMAP_COMBO_MAX_KEYS 4
+
+// Tap-dance key: a different action for each tap count, and optionally for
+// holding the key on the last tap. It resolves as soon as the outcome is
+// known: another key is pressed, or no further tap is defined.
+#define KEYMAP_TAP_DANCE_MAX_TAPS 3
+#define KEYMAP_MAX_TAP_DANCES     16
+
+typedef struct
+{
+  key_code_t tap[KEYMAP_TAP_DANCE_MAX_TAPS];  // Action for 1, 2, 3 taps
+  key_code_t hold[KEYMAP_TAP_DANCE_MAX_TAPS]; // Tap n-1 times, then hold
+  uint16_t   timeout_ms; // Between taps and for a hold, 0 = default
+} keymap_tap_dance_t;
+
+// Macro bytecode: an opcode byte followed by its argument. Keycodes and
+// modifier masks are one byte, durations are LEB128 varints.
+typedef enum
+{
+  MACRO_OP_PRESS,    // keycode: hold the key down
+  MACRO_OP_RELEASE,  // keycode: let the key go
+  MACRO_OP_TAP,      // keycode: press, then release on the next report
+  MACRO_OP_MOD_DOWN, // modifier mask
+  MACRO_OP_MOD_UP,   // modifier mask
+  MACRO_OP_DELAY,    // varint milliseconds
+  MACRO_OP_COUNT
+} macro_op_t;
+
+typedef struct
+{
+  const uint8_t *code;
+  uint16_t       length;
+} keymap_macro_t;
+
+#define MACRO_PRESS(kc)    MACRO_OP_PRESS, (kc)
+#define MACRO_RELEASE(kc)  MACRO_OP_RELEASE, (kc)
+#define MACRO_TAP(kc)      MACRO_OP_TAP, (kc)
+#define MACRO_MOD_DOWN(m)  MACRO_OP_MOD_DOWN, (m)
+#define MACRO_MOD_UP(m)    MACRO_OP_MOD_UP, (m)
+// Two varint bytes so it fits an initializer, up to 16383ms
+#define MACRO_DELAY(ms)                                                        \
+  MACRO_OP_DELAY, 0x80 | ((ms) & 0x7F), ((ms) >> 7) & 0x7F
+
 // Letter keys
 #define KC_A HID_KEY_A
 #define KC_B HID_KEY_B
@@ -220,35 +323,45 @@ typedef struct
 #define KC_AUDIO_VOL_UP     HID_CONSUMER_VOLUME_UP
 #define KC_AUDIO_VOL_DOWN   HID_CONSUMER_VOLUME_DOWN
 
-// Macro functions for creating complex key definitions
-#define NORM_KEY(k) ((key_def_t){.type = KEY_TYPE_NORMAL, .keycode = (k)})
-#define MOD_KEY(m)  ((key_def_t){.type = KEY_TYPE_MODIFIER, .modifier = (m)})
-#define LAYER_TAP(t, l)                                                        \
-  ((key_def_t){.type = KEY_TYPE_LAYER_TAP, .layer_tap = {(t), (l), 0}})
-#define MOD_TAP(t, m)                                                          \
-  ((key_def_t){.type = KEY_TYPE_MOD_TAP, .mod_tap = {(t), (m), 0}})
-#define LAYER_TAP_TO(t, l, to)                                                 \
-  ((key_def_t){.type = KEY_TYPE_LAYER_TAP, .layer_tap = {(t), (l), (to)}})
-#define MOD_TAP_TO(t, m, to)                                                   \
-  ((key_def_t){.type = KEY_TYPE_MOD_TAP, .mod_tap = {(t), (m), (to)}})
-#define LAYER_TOG(l) ((key_def_t){.type = KEY_TYPE_LAYER_TOGGLE, .layer = (l)})
-#define LAYER_MOM(l)                                                           \
-  ((key_def_t){.type = KEY_TYPE_LAYER_MOMENTARY, .layer = (l)})
-#define CONS_KEY(k)   ((key_def_t){.type = KEY_TYPE_CONSUMER, .consumer = (k)})
-#define MACRO_KEY(id) ((key_def_t){.type = KEY_TYPE_MACRO, .macro_id = (id)})
-#define TRANS_KEY()                                                            \
-  ((key_def_t){.type = KEY_TYPE_TRANSPARENT, .keycode = KC_TRNS})
-#define SHIFT_KEY(k) ((key_def_t){.type = KEY_TYPE_SHIFTED, .keycode = (k)})
+// Macro functions for creating packed key codes
+#define NORM_KEY(k) KEY_CODE(KEY_TYPE_NORMAL, (k) & 0xFF)
+#define MOD_KEY(m)  KEY_CODE(KEY_TYPE_MODIFIER, (m) & 0xFF)
+#define LAYER_TAP(t, l)           LAYER_TAP_TO(t, l, 0)
+#define MOD_TAP(t, m)             MOD_TAP_TO(t, m, 0)
+#define LAYER_TAP_TO(t, l, to)    LAYER_TAP_FL(t, l, to, HOLD_TAP_FLAVOR)
+#define MOD_TAP_TO(t, m, to)      MOD_TAP_FL(t, m, to, HOLD_TAP_FLAVOR)
+#define LAYER_TAP_FL(t, l, to, f)                                              \
+  KEY_CODE_TAP_HOLD(KEY_TYPE_LAYER_TAP, (t), (l), (to), (f))
+#define MOD_TAP_FL(t, m, to, f)                                                \
+  KEY_CODE_TAP_HOLD(KEY_TYPE_MOD_TAP, (t), (m), (to), (f))
+#define LAYER_TOG(l)  KEY_CODE(KEY_TYPE_LAYER_TOGGLE, (l) & 0xFF)
+#define LAYER_MOM(l)  KEY_CODE(KEY_TYPE_LAYER_MOMENTARY, (l) & 0xFF)
+#define CONS_KEY(k)   KEY_CODE(KEY_TYPE_CONSUMER, (k) & 0xFFFF)
+#define MACRO_KEY(id) KEY_CODE(KEY_TYPE_MACRO, (id) & 0xFF)
+#define TRANS_KEY()   KEY_CODE(KEY_TYPE_TRANSPARENT, KC_TRNS)
+#define SHIFT_KEY(k)  KEY_CODE(KEY_TYPE_SHIFTED, (k) & 0xFF)
+#define TAP_DANCE(id) KEY_CODE(KEY_TYPE_TAP_DANCE, (id) & 0xFF)
 
 // Convenient shortcuts
-#define LT(layer, tap)        LAYER_TAP(tap, layer)
-#define MT(mod, tap)          MOD_TAP(tap, mod)
-#define LT_TO(layer, tap, to) LAYER_TAP_TO(tap, layer, to)
-#define MT_TO(mod, tap, to)   MOD_TAP_TO(tap, mod, to)
-#define TO(layer)             LAYER_TOG(layer)
-#define MO(layer)             LAYER_MOM(layer)
-
-// Function declarations
-key_def_t keymap_get_key(uint8_t layer, uint8_t row, uint8_t col);
+#define LT(layer, tap)            LAYER_TAP(tap, layer)
+#define MT(mod, tap)              MOD_TAP(tap, mod)
+#define LT_TO(layer, tap, to)     LAYER_TAP_TO(tap, layer, to)
+#define MT_TO(mod, tap, to)       MOD_TAP_TO(tap, mod, to)
+#define LT_FL(layer, tap, to, fl) LAYER_TAP_FL(tap, layer, to, fl)
+#define MT_FL(mod, tap, to, fl)   MOD_TAP_FL(tap, mod, to, fl)
+#define TO(layer)                 LAYER_TOG(layer)
+#define MO(layer)                 LAYER_MOM(layer)
+#define TD(id)                    TAP_DANCE(id)
+
+// Function declarations. The table getters return NULL when out of range.
+esp_err_t                 keymap_init(void); // Validates the keymap tables
+key_def_t                 keymap_get_key(uint8_t layer, uint8_t row,
+                                         uint8_t col);
+key_def_t                 keymap_decode(key_code_t code);
+uint8_t                   keymap_combo_count(void);
+const keymap_combo_t     *keymap_get_combo(uint8_t index);
+const keymap_macro_t     *keymap_get_macro(uint8_t id);
+uint8_t                   keymap_tap_dance_count(void);
+const keymap_tap_dance_t *keymap_get_tap_dance(uint8_t id);
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef LP_MATRIX_IDLE_H
+#define LP_MATRIX_IDLE_H
+
+#include <stdint.h>
+
+// Shared by kb_matrix.c (HP core), ulp/lp_matrix_idle.c (LP core) and the host
+// tests (test/host/test_lp_idle.c), so it must stay plain C with no ESP-IDF
+// driver headers
+
+#define LP_MATRIX_POLL_US      1000 // LP core wake-up period while idle
+#define LP_MATRIX_STABLE_POLLS 2    // Consecutive active polls before waking
+
+// One poll of the idle column filter. Returns the active columns once some
+// column has been active for LP_MATRIX_STABLE_POLLS polls in a row, else 0.
+static inline uint32_t lp_matrix_idle_filter(uint32_t  cols,
+                                             uint32_t *stable_polls)
+{
+  if (cols == 0)
+  {
+    *stable_polls = 0;
+    return 0;
+  }
+
+  if (*stable_polls < LP_MATRIX_STABLE_POLLS)
+  {
+    (*stable_polls)++;
+  }
+
+  return *stable_polls >= LP_MATRIX_STABLE_POLLS ? cols : 0;
+}
+
+#endif // LP_MATRIX_IDLE_H
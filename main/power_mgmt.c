@@ -25,10 +25,10 @@ static const char *TAG = "POWER_MGMT";
 
 static const power_config_t DEFAULT_CONFIG = {
     // Matrix scanning intervals - optimized for immediate responsiveness
-    .active_scan_ms = 1,     // Ultra-fast scan when actively typing
-    .normal_scan_ms = 5,     // Quick scan after short inactivity
-    .efficient_scan_ms = 25, // Power saving but still reasonable for idle
-    .deep_scan_ms = 100,     // Maximum efficiency for long idle periods
+    .active_scan_us = 250,      // Sub-ms scan when actively typing
+    .normal_scan_us = 5000,     // Quick scan after short inactivity
+    .efficient_scan_us = 25000, // Power saving but still reasonable for idle
+    .deep_scan_us = 100000,     // Maximum efficiency for long idle periods
 
     // Mode transition timeouts - more patient for better UX
     .active_timeout_ms =
@@ -97,9 +97,9 @@ esp_err_t power_mgmt_init(void)
   state.metrics.last_activity_time = get_current_time_ms();
 
   ESP_LOGI(TAG, "Power management initialized - Immediate response strategy");
-  ESP_LOGI(TAG, "  Ultra-fast: %dms, Quick: %dms, Efficient: %dms, Deep: %dms",
-           state.config.active_scan_ms, state.config.normal_scan_ms,
-           state.config.efficient_scan_ms, state.config.deep_scan_ms);
+  ESP_LOGI(TAG, "  Ultra-fast: %dus, Quick: %dus, Efficient: %dus, Deep: %dus",
+           state.config.active_scan_us, state.config.normal_scan_us,
+           state.config.efficient_scan_us, state.config.deep_scan_us);
   ESP_LOGI(TAG, "  ⚡ Zero latency activation on key press");
 
   // Set initial LED state to ACTIVE
@@ -238,13 +238,21 @@ bool power_mgmt_is_immediate_response(void)
   return immediate;
 }
 
+bool power_mgmt_light_sleep_allowed(void)
+{
+  // BLE and ESP-NOW do not run through light sleep (no BT_LE_SLEEP), so a
+  // connected half must keep the SoC awake however long it has been idle
+  return power_mgmt_get_mode() == POWER_MODE_DEEP &&
+         indicator_get_conn_state() != CONN_STATE_CONNECTED;
+}
+
 // =============================================================================
 // PUBLIC API - ADAPTIVE INTERVALS
 // =============================================================================
 
 uint32_t power_mgmt_get_matrix_interval(void)
 {
-  uint32_t interval = state.config.active_scan_ms;
+  uint32_t interval = state.config.active_scan_us;
 
   if (state_mutex == NULL)
   {
@@ -256,16 +264,16 @@ uint32_t power_mgmt_get_matrix_interval(void)
     switch (state.current_mode)
     {
     case POWER_MODE_ACTIVE:
-      interval = state.config.active_scan_ms;
+      interval = state.config.active_scan_us;
       break;
     case POWER_MODE_NORMAL:
-      interval = state.config.normal_scan_ms;
+      interval = state.config.normal_scan_us;
       break;
     case POWER_MODE_EFFICIENT:
-      interval = state.config.efficient_scan_ms;
+      interval = state.config.efficient_scan_us;
       break;
     case POWER_MODE_DEEP:
-      interval = state.config.deep_scan_ms;
+      interval = state.config.deep_scan_us;
       break;
     }
     xSemaphoreGive(state_mutex);
@@ -408,7 +416,7 @@ void power_mgmt_print_status(void)
     ESP_LOGI(TAG, "  Mode Transitions: %u, Battery Reads: %u",
              state.metrics.power_mode_transitions,
              state.metrics.battery_read_count);
-    ESP_LOGI(TAG, "  Current Matrix Interval: %d ms",
+    ESP_LOGI(TAG, "  Current Matrix Interval: %d us",
              power_mgmt_get_matrix_interval());
     ESP_LOGI(TAG, "================================");
     xSemaphoreGive(state_mutex);
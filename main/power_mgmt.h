@@ -65,11 +65,11 @@ typedef struct
 
 typedef struct
 {
-  // Matrix scanning intervals (ms)
-  uint32_t active_scan_ms;
-  uint32_t normal_scan_ms;
-  uint32_t efficient_scan_ms;
-  uint32_t deep_scan_ms;
+  // Matrix scanning intervals (us)
+  uint32_t active_scan_us;
+  uint32_t normal_scan_us;
+  uint32_t efficient_scan_us;
+  uint32_t deep_scan_us;
 
   // Mode transition timeouts (ms)
   uint32_t active_timeout_ms;
@@ -157,13 +157,20 @@ void power_mgmt_force_active(uint32_t timestamp);
  */
 bool power_mgmt_is_immediate_response(void);
 
+/**
+ * @brief Check if the whole SoC may light-sleep
+ * @return true in deep mode with no BLE or ESP-NOW link up, since light sleep
+ *         stops the radio along with every task
+ */
+bool power_mgmt_light_sleep_allowed(void);
+
 // =============================================================================
 // PUBLIC API - ADAPTIVE INTERVALS
 // =============================================================================
 
 /**
  * @brief Get optimal matrix scan interval
- * @return Recommended scan interval in milliseconds
+ * @return Recommended scan interval in microseconds
  */
 uint32_t power_mgmt_get_matrix_interval(void);
 
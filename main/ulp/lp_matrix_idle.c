@@ -0,0 +1,51 @@
+/**
+ * @file lp_matrix_idle.c
+ * @brief LP Core Idle Column Monitor
+ *
+ * Runs on the ESP32-C6 LP core while the HP core light-sleeps in deep idle.
+ * The HP core leaves every row held low, so a pressed key pulls its column
+ * low. On each LP timer wake-up this program samples the column LP IOs, runs
+ * them through the shared idle filter and wakes the HP core once a column
+ * stays active. The HP core then runs a full scan and reports the key.
+ */
+
+#include <stdint.h>
+
+#include "lp_matrix_idle.h"
+#include "ulp_lp_core_gpio.h"
+#include "ulp_lp_core_utils.h"
+
+// Shared with the HP core as ulp_<name>
+volatile uint32_t col_io_mask;  // LP IOs wired to matrix columns (set by HP)
+volatile uint32_t stable_polls; // Filter state, cleared by HP before start
+volatile uint32_t wake_cols;    // Columns that woke the HP core, 0 if none
+
+int main(void)
+{
+  uint32_t cols = 0;
+  uint32_t mask = col_io_mask;
+
+  while (mask)
+  {
+    int io = __builtin_ctz(mask);
+    mask &= mask - 1;
+
+    // Pulled up, so an active column reads low
+    if (ulp_lp_core_gpio_get_level((lp_io_num_t)io) == 0)
+    {
+      cols |= 1U << io;
+    }
+  }
+
+  uint32_t polls = stable_polls;
+  uint32_t active = lp_matrix_idle_filter(cols, &polls);
+  stable_polls = polls;
+
+  if (active != 0 && wake_cols == 0)
+  {
+    wake_cols = active;
+    ulp_lp_core_wakeup_main_processor();
+  }
+
+  return 0;
+}
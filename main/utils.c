@@ -40,3 +40,12 @@ void task_hdl_cleanup(TaskHandle_t task_hdl)
 // =============================================================================
 
 uint32_t get_current_time_ms(void) { return esp_timer_get_time() / 1000; }
+
+time_us_t get_current_time_us(void) { return (time_us_t)esp_timer_get_time(); }
+
+time_snapshot_t get_time_snapshot(void)
+{
+  int64_t now = esp_timer_get_time();
+
+  return (time_snapshot_t){.us = (time_us_t)now, .ms = now / 1000};
+}
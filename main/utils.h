@@ -10,6 +10,33 @@ void task_hdl_init(TaskHandle_t *task_hdl, TaskFunction_t task_func,
 void task_hdl_cleanup(TaskHandle_t task_hdl);
 
 // Timer Utils
-uint32_t get_current_time_ms(void);
+// Microsecond timestamps are 32-bit and wrap every ~71 minutes; compare them
+// only through the helpers below
+typedef uint32_t time_us_t;
+
+#define TIME_MS_TO_US(ms) ((time_us_t)(ms) * 1000U)
+
+// One read of the monotonic clock in both units
+typedef struct
+{
+  time_us_t us;
+  uint32_t  ms;
+} time_snapshot_t;
+
+uint32_t        get_current_time_ms(void);
+time_us_t       get_current_time_us(void);
+time_snapshot_t get_time_snapshot(void);
+
+// Microseconds from `since` to `now`, valid across a wrap
+static inline time_us_t time_elapsed_us(time_us_t now, time_us_t since)
+{
+  return now - since;
+}
+
+// True once `now` is at or past `deadline`
+static inline bool time_reached(time_us_t now, time_us_t deadline)
+{
+  return (int32_t)(now - deadline) >= 0;
+}
 
 #endif
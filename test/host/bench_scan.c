@@ -0,0 +1,230 @@
+/**
+ * @file bench_scan.c
+ * @brief Scan event extraction benchmark
+ *
+ * Feeds the same sampled matrix words through the per-key state loop scan()
+ * used to run and the XOR/count-trailing-zeros loop that replaced it, checks
+ * that both produce the same events, and reports the cost of each per scan.
+ * Only the state update and event generation are timed; strobing the matrix is
+ * the same hardware work in both.
+ */
+
+#include "host_test.h"
+#include "kb_matrix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static inline uint64_t bench_now(void) { return __rdtsc(); }
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_now(void) { return host_now_ns(); }
+#endif
+
+#define SCAN_MS     1 // One scan per tick of the millisecond clock
+#define SCAN_ROUNDS 200000
+#define MAX_EVENTS  (SCAN_ROUNDS * 4)
+
+// =============================================================================
+// PER-KEY LOOP (before bit-packing)
+// =============================================================================
+
+static struct
+{
+  bool     raw[MATRIX_ROW][MATRIX_COL];
+  bool     current[MATRIX_ROW][MATRIX_COL];
+  bool     previous[MATRIX_ROW][MATRIX_COL];
+  uint32_t debounce_time[MATRIX_ROW][MATRIX_COL];
+} per_key;
+
+static uint8_t scan_per_key(matrix_bits_t sample, uint32_t now,
+                            key_event_t *event)
+{
+  uint8_t event_count = 0;
+
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  {
+    for (uint8_t col = 0; col < MATRIX_COL; col++)
+    {
+      bool pressed = (sample & MATRIX_KEY_BIT(row, col)) != 0;
+
+      if (pressed != per_key.raw[row][col])
+      {
+        per_key.raw[row][col] = pressed;
+        per_key.debounce_time[row][col] = now;
+      }
+
+      bool debounce_elapsed =
+          (now - per_key.debounce_time[row][col]) >= DEBOUNCE_TIME_MS;
+      if (debounce_elapsed &&
+          per_key.current[row][col] != per_key.raw[row][col])
+      {
+        per_key.previous[row][col] = per_key.current[row][col];
+        per_key.current[row][col] = per_key.raw[row][col];
+
+        event[event_count].row = row;
+        event[event_count].col = col;
+        event[event_count].pressed = per_key.raw[row][col];
+        event[event_count].timestamp = now;
+        event_count++;
+      }
+    }
+  }
+
+  return event_count;
+}
+
+// =============================================================================
+// XOR / CTZ LOOP
+// =============================================================================
+
+static struct
+{
+  matrix_bits_t raw;
+  matrix_bits_t current;
+  uint32_t      debounce_time[MAX_KEYS];
+} packed;
+
+static uint8_t scan_packed(matrix_bits_t sample, uint32_t now,
+                           key_event_t *event)
+{
+  uint8_t event_count = 0;
+
+  matrix_bits_t moved = sample ^ packed.raw;
+  packed.raw = sample;
+  while (moved)
+  {
+    packed.debounce_time[__builtin_ctz(moved)] = now;
+    moved &= moved - 1;
+  }
+
+  matrix_bits_t pending = packed.raw ^ packed.current;
+  while (pending)
+  {
+    uint8_t       idx = __builtin_ctz(pending);
+    matrix_bits_t bit = pending & -pending;
+    pending &= pending - 1;
+
+    if ((now - packed.debounce_time[idx]) < DEBOUNCE_TIME_MS)
+    {
+      continue;
+    }
+
+    packed.current ^= bit;
+
+    event[event_count].row = idx / MATRIX_COL;
+    event[event_count].col = idx % MATRIX_COL;
+    event[event_count].pressed = (packed.current & bit) != 0;
+    event[event_count].timestamp = now;
+    event_count++;
+  }
+
+  return event_count;
+}
+
+// =============================================================================
+// WORKLOADS
+// =============================================================================
+
+typedef enum
+{
+  WORKLOAD_IDLE,   // No key down
+  WORKLOAD_HELD,   // Two keys held
+  WORKLOAD_TYPING, // A key every 40ms, held 60ms, 2ms of bounce on each edge
+  WORKLOAD_COUNT
+} workload_t;
+
+static const char *const workload_names[WORKLOAD_COUNT] = {"idle", "held",
+                                                           "typing"};
+
+static matrix_bits_t sample_typing(uint32_t now)
+{
+  matrix_bits_t sample = 0;
+
+  for (int32_t k = now / 40; k >= 0 && (uint32_t)k * 40 + 62 > now; k--)
+  {
+    uint32_t age = now - k * 40;
+    bool     down = age < 60;
+
+    // Odd milliseconds inside a bounce read the opposite level
+    if ((age < 2 || age >= 60) && (age & 1))
+    {
+      down = !down;
+    }
+    sample |= down ? (matrix_bits_t)1 << (k * 7 % MAX_KEYS) : 0;
+  }
+
+  return sample;
+}
+
+static matrix_bits_t sample_workload(workload_t workload, uint32_t now)
+{
+  switch (workload)
+  {
+  case WORKLOAD_HELD:
+    return MATRIX_KEY_BIT(2, 1) | MATRIX_KEY_BIT(2, 4);
+  case WORKLOAD_TYPING:
+    return sample_typing(now);
+  default:
+    return 0;
+  }
+}
+
+// =============================================================================
+// BENCHMARK
+// =============================================================================
+
+typedef uint8_t (*scan_fn_t)(matrix_bits_t sample, uint32_t now,
+                             key_event_t *event);
+
+static key_event_t   events[2][MAX_EVENTS];
+static matrix_bits_t samples[SCAN_ROUNDS];
+
+static uint32_t run(scan_fn_t scan, key_event_t *out, double *per_scan)
+{
+  uint32_t total = 0;
+
+  uint64_t start = bench_now();
+  for (uint32_t i = 0; i < SCAN_ROUNDS; i++)
+  {
+    total += scan(samples[i], i * SCAN_MS, &out[total]);
+  }
+  *per_scan = (double)(bench_now() - start) / SCAN_ROUNDS;
+
+  return total;
+}
+
+int main(void)
+{
+  for (workload_t w = 0; w < WORKLOAD_COUNT; w++)
+  {
+    double per_key_cost, packed_cost;
+
+    for (uint32_t i = 0; i < SCAN_ROUNDS; i++)
+    {
+      samples[i] = sample_workload(w, i * SCAN_MS);
+    }
+
+    memset(&per_key, 0, sizeof(per_key));
+    memset(&packed, 0, sizeof(packed));
+    uint32_t per_key_events = run(scan_per_key, events[0], &per_key_cost);
+    uint32_t packed_events = run(scan_packed, events[1], &packed_cost);
+
+    // Same events in the same order (both walk keys in index order)
+    CHECK(per_key_events == packed_events);
+    for (uint32_t i = 0; i < per_key_events && i < packed_events; i++)
+    {
+      CHECK(events[0][i].row == events[1][i].row &&
+            events[0][i].col == events[1][i].col &&
+            events[0][i].pressed == events[1][i].pressed &&
+            events[0][i].timestamp == events[1][i].timestamp);
+    }
+
+    printf("  %-7s per-key %7.1f %s/scan  xor/ctz %7.1f %s/scan  "
+           "(%lu events)\n",
+           workload_names[w], per_key_cost, BENCH_UNIT, packed_cost,
+           BENCH_UNIT, (unsigned long)packed_events);
+  }
+
+  return host_test_result();
+}
@@ -0,0 +1,4 @@
+/**
+ * @file projdefs.h
+ * @brief Host stand-in for freertos/projdefs.h, host_shim.h has the macros
+ */
@@ -0,0 +1,91 @@
+/**
+ * @file host_shim.h
+ * @brief Host stand-in for common.h
+ *
+ * Force-included ahead of every host test translation unit. It claims the
+ * COMMON_H guard so the firmware headers build without ESP-IDF and supplies
+ * the few IDF types and macros they name.
+ */
+
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#define COMMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// esp_err.h
+typedef int esp_err_t;
+
+#define ESP_OK                 0
+#define ESP_FAIL               -1
+#define ESP_ERR_INVALID_ARG    0x102
+#define ESP_ERR_INVALID_STATE  0x103
+
+// esp_log.h, format-checked but silent unless HOST_VERBOSE is set
+#ifdef HOST_VERBOSE
+#define HOST_LOG(tag, fmt, ...) printf("%s: " fmt "\n", tag, ##__VA_ARGS__)
+#else
+#define HOST_LOG(tag, fmt, ...)                                                \
+  do                                                                           \
+  {                                                                            \
+    if (0)                                                                     \
+      printf("%s: " fmt "\n", tag, ##__VA_ARGS__);                             \
+  } while (0)
+#endif
+#define ESP_LOGE HOST_LOG
+#define ESP_LOGW HOST_LOG
+#define ESP_LOGI HOST_LOG
+#define ESP_LOGD HOST_LOG
+
+// freertos/FreeRTOS.h, freertos/task.h, freertos/queue.h. A test that builds
+// code calling these defines them.
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void    *TaskHandle_t;
+typedef void    *QueueHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE            1
+#define pdFALSE           0
+#define portMAX_DELAY     UINT32_MAX
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t    xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t    xTaskNotifyGive(TaskHandle_t task);
+uint32_t      ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+
+// Host tests run on one thread, critical sections have nothing to exclude
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define taskENTER_CRITICAL(mux)      ((void)(mux))
+#define taskEXIT_CRITICAL(mux)       ((void)(mux))
+
+// esp_task_wdt.h
+esp_err_t esp_task_wdt_add(TaskHandle_t task);
+esp_err_t esp_task_wdt_reset(void);
+
+// esp_err.h
+const char *esp_err_to_name(esp_err_t code);
+
+// esp_now.h
+#define ESP_NOW_ETH_ALEN 6
+
+// esp_hidd.h
+typedef struct esp_hidd_dev_s esp_hidd_dev_t;
+
+#define ESP_HID_PROTOCOL_MODE_BOOT   0
+#define ESP_HID_PROTOCOL_MODE_REPORT 1
+
+esp_err_t esp_hidd_dev_input_set(esp_hidd_dev_t *dev, size_t map_index,
+                                 size_t report_id, uint8_t *data,
+                                 size_t length);
+
+#endif // HOST_SHIM_H
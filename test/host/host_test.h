@@ -0,0 +1,45 @@
+/**
+ * @file host_test.h
+ * @brief Minimal check and timing helpers shared by the host tests
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int host_failures;
+
+#define CHECK(cond)                                                            \
+  do                                                                           \
+  {                                                                            \
+    if (!(cond))                                                               \
+    {                                                                          \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);          \
+      host_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+static inline uint64_t host_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+// Keeps benchmark results alive past the optimizer
+static inline void host_sink(uint32_t value)
+{
+  static volatile uint32_t sink;
+  sink ^= value;
+}
+
+static inline int host_test_result(void)
+{
+  printf(host_failures ? "FAILED (%d checks)\n" : "OK\n", host_failures);
+  return host_failures != 0;
+}
+
+#endif // HOST_TEST_H
@@ -0,0 +1,487 @@
+/**
+ * @file kb_mgt_harness.h
+ * @brief Host harness around kb_mgt.c
+ *
+ * Builds kb_mgt.c into the including test with a fake clock and stand-ins
+ * for FreeRTOS, the BLE HID device and ESP-NOW. The keymap comes from the
+ * test: layer 0 types a distinct letter at every position (HARNESS_KEY) and
+ * upper layers are transparent until a test sets them.
+ *
+ * Tests press keys and deliver messages from the other half at given
+ * milliseconds. Every wake-up the processing task would have had in between
+ * runs at its own time first, through the task's own task_process(). What the
+ * host sees is logged as key edges, "+04 +e1 -04", modifiers as 0xe0-0xe7.
+ */
+
+#ifndef KB_MGT_HARNESS_H
+#define KB_MGT_HARNESS_H
+
+#include "host_test.h"
+
+// The keymap is the test's, only decoding and validation are keymap.c's
+#define keymap_get_key         harness_get_key
+#define keymap_combo_count     harness_combo_count
+#define keymap_get_combo       harness_get_combo
+#define keymap_get_macro       harness_get_macro
+#define keymap_tap_dance_count harness_tap_dance_count
+#define keymap_get_tap_dance   harness_get_tap_dance
+#include "kb_mgt.c"
+#undef keymap_get_key
+#undef keymap_combo_count
+#undef keymap_get_combo
+#undef keymap_get_macro
+#undef keymap_tap_dance_count
+#undef keymap_get_tap_dance
+
+// Layer 0 keycode at a position, A upwards in position order. Takes a
+// position macro ("#define M 2, 2") as well.
+#define HARNESS_KEY(...)       HARNESS_KEY_AT(__VA_ARGS__)
+#define HARNESS_KEY_AT(row, col) (HID_KEY_A + KEY_POS(row, col))
+
+#define HARNESS_MAX_FRAMES 64
+#define HARNESS_INBOX_MAX  64
+
+typedef struct
+{
+  espnow_event_info_data_type_t type;
+  union
+  {
+    kb_mgt_hid_key_report_t key_report;
+    kb_comm_key_event_t     key_event;
+    uint16_t                hold_pending_ms;
+    uint32_t                layer_mask;
+  };
+} harness_frame_t;
+
+static struct
+{
+  time_us_t base_us; // Clock at millisecond 0
+  time_us_t now_us;
+
+  key_code_t                keys[MAX_LAYERS][MATRIX_ROW][MATRIX_COL];
+  const keymap_combo_t     *combos;
+  uint8_t                   combo_count;
+  const keymap_macro_t     *macros;
+  uint8_t                   macro_count;
+  const keymap_tap_dance_t *dances;
+  uint8_t                   dance_count;
+
+  // BLE HID device
+  kb_mgt_hid_key_report_t host; // Keys the host holds down
+  char                    log[2048];
+  uint32_t                reports;
+  size_t                  report_id;  // Of the last key report
+  uint32_t                fail_sends; // Refuse this many input reports
+  bool                    hold_tx;    // Keep NOTIFY_TX back
+  uint32_t                held_tx;
+
+  // ESP-NOW
+  harness_frame_t frames[HARNESS_MAX_FRAMES];
+  uint32_t        frame_count;
+
+  // Remote inbox
+  uint8_t  inbox[HARNESS_INBOX_MAX][sizeof(comm_edge_t)];
+  uint32_t inbox_len;
+  uint32_t inbox_head;
+  uint32_t inbox_count;
+} harness;
+
+esp_hidd_dev_t *hid_dev = (esp_hidd_dev_t *)&harness;
+
+// =============================================================================
+// STAND-INS
+// =============================================================================
+
+time_us_t get_current_time_us(void) { return harness.now_us; }
+
+uint32_t get_current_time_ms(void) { return harness.now_us / 1000; }
+
+void task_hdl_init(TaskHandle_t *task_hdl, TaskFunction_t task,
+                   const char *name, UBaseType_t priority, uint32_t stack,
+                   void *arg)
+{
+  (void)task;
+  (void)name;
+  (void)priority;
+  (void)stack;
+  (void)arg;
+  *task_hdl = (TaskHandle_t)&harness;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  if (length > HARNESS_INBOX_MAX || item_size > sizeof(harness.inbox[0]))
+  {
+    return NULL;
+  }
+  harness.inbox_len = length;
+  harness.inbox_head = 0;
+  harness.inbox_count = 0;
+  return (QueueHandle_t)harness.inbox;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+  (void)queue;
+  (void)wait;
+  if (harness.inbox_count == harness.inbox_len)
+  {
+    return pdFALSE;
+  }
+  memcpy(harness.inbox[(harness.inbox_head + harness.inbox_count++) %
+                       harness.inbox_len],
+         item, sizeof(comm_edge_t));
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  (void)queue;
+  (void)wait;
+  if (harness.inbox_count == 0)
+  {
+    return pdFALSE;
+  }
+  memcpy(item, harness.inbox[harness.inbox_head], sizeof(comm_edge_t));
+  harness.inbox_head = (harness.inbox_head + 1) % harness.inbox_len;
+  harness.inbox_count--;
+  return pdTRUE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  (void)task;
+  return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+  (void)clear;
+  (void)wait;
+  return 0;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t task)
+{
+  (void)task;
+  return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset(void) { return ESP_OK; }
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+static void harness_log_edges(const kb_mgt_hid_key_report_t *next)
+{
+  size_t len = strlen(harness.log);
+
+  for (uint16_t usage = 0; usage < HID_NKRO_USAGE_COUNT + 8; usage++)
+  {
+    bool was, is;
+
+    if (usage < HID_NKRO_USAGE_COUNT)
+    {
+      was = harness.host.keys[usage >> 3] >> (usage & 7) & 1;
+      is = next->keys[usage >> 3] >> (usage & 7) & 1;
+    }
+    else
+    {
+      was = harness.host.modifiers >> (usage - HID_NKRO_USAGE_COUNT) & 1;
+      is = next->modifiers >> (usage - HID_NKRO_USAGE_COUNT) & 1;
+    }
+
+    if (was != is && len + 5 < sizeof(harness.log))
+    {
+      uint16_t code = usage < HID_NKRO_USAGE_COUNT
+                          ? usage
+                          : 0xe0 + usage - HID_NKRO_USAGE_COUNT;
+      len += snprintf(harness.log + len, sizeof(harness.log) - len, "%s%c%02x",
+                      len ? " " : "", is ? '+' : '-', code);
+    }
+  }
+
+  harness.host = *next;
+}
+
+esp_err_t esp_hidd_dev_input_set(esp_hidd_dev_t *dev, size_t map_index,
+                                 size_t report_id, uint8_t *data,
+                                 size_t length)
+{
+  kb_mgt_hid_key_report_t next = {0};
+
+  (void)dev;
+  (void)map_index;
+
+  if (report_id != HID_NKRO_REPORT_ID && report_id != HID_KEYBOARD_REPORT_ID)
+  {
+    return ESP_OK;
+  }
+
+  if (harness.fail_sends > 0)
+  {
+    harness.fail_sends--;
+    return ESP_FAIL;
+  }
+
+  if (report_id == HID_NKRO_REPORT_ID)
+  {
+    memcpy(&next, data, length);
+  }
+  else
+  {
+    const kb_mgt_hid_boot_report_t *boot = (const void *)data;
+
+    next.modifiers = boot->modifiers;
+    for (int i = 0; i < HID_MAX_KEYS_IN_REPORT; i++)
+    {
+      next.keys[boot->keys[i] >> 3] |= 1U << (boot->keys[i] & 7);
+    }
+    next.keys[0] &= ~1U; // HID_KEY_NONE
+  }
+
+  harness_log_edges(&next);
+  harness.reports++;
+  harness.report_id = report_id;
+
+  if (harness.hold_tx)
+  {
+    harness.held_tx++;
+  }
+  else
+  {
+    kb_mgt_hid_tx_done();
+  }
+  return ESP_OK;
+}
+
+uint32_t send_to_espnow(espnow_from_t from, espnow_event_info_data_type_t type,
+                        void *data)
+{
+  (void)from;
+
+  if (harness.frame_count == HARNESS_MAX_FRAMES)
+  {
+    return 0;
+  }
+
+  harness_frame_t *frame = &harness.frames[harness.frame_count++];
+  frame->type = type;
+  switch (type)
+  {
+  case TAP:
+  case BRIEF_TAP:
+    frame->key_report = *(kb_mgt_hid_key_report_t *)data;
+    break;
+  case KEY_EVENT:
+    frame->key_event = *(kb_comm_key_event_t *)data;
+    break;
+  case HOLD_PENDING:
+    frame->hold_pending_ms = *(uint16_t *)data;
+    break;
+  case LAYER_SYNC:
+    frame->layer_mask = *(uint32_t *)data;
+    break;
+  default:
+    break;
+  }
+  return harness.frame_count;
+}
+
+// =============================================================================
+// TEST KEYMAP
+// =============================================================================
+
+key_def_t keymap_get_key(uint8_t layer, uint8_t row, uint8_t col);
+
+key_def_t harness_get_key(uint8_t layer, uint8_t row, uint8_t col)
+{
+  if (layer >= MAX_LAYERS || row >= MATRIX_ROW || col >= MATRIX_COL)
+  {
+    return keymap_decode(NORM_KEY(KC_NO));
+  }
+  return keymap_decode(harness.keys[layer][row][col]);
+}
+
+uint8_t harness_combo_count(void) { return harness.combo_count; }
+
+const keymap_combo_t *harness_get_combo(uint8_t index)
+{
+  return index < harness.combo_count ? &harness.combos[index] : NULL;
+}
+
+const keymap_macro_t *harness_get_macro(uint8_t id)
+{
+  return id < harness.macro_count ? &harness.macros[id] : NULL;
+}
+
+uint8_t harness_tap_dance_count(void) { return harness.dance_count; }
+
+const keymap_tap_dance_t *harness_get_tap_dance(uint8_t id)
+{
+  return id < harness.dance_count ? &harness.dances[id] : NULL;
+}
+
+// =============================================================================
+// DRIVING THE TASK
+// =============================================================================
+
+// Clears everything back to the default test keymap. Set keys, combos,
+// macros and dances afterwards, then call harness_start().
+static void harness_reset(void)
+{
+  memset(&harness, 0, sizeof(harness));
+
+  // Statistics outlive kb_mgt_init() on purpose, but not a test case
+  memset(combo_stats, 0, sizeof(combo_stats));
+  memset(&combo_miss_stats, 0, sizeof(combo_miss_stats));
+  memset(dance_stats, 0, sizeof(dance_stats));
+
+  for (uint8_t row = 0; row < MATRIX_ROW; row++)
+  {
+    for (uint8_t col = 0; col < MATRIX_COL; col++)
+    {
+      harness.keys[0][row][col] = NORM_KEY(HARNESS_KEY(row, col));
+      for (uint8_t layer = 1; layer < MAX_LAYERS; layer++)
+      {
+        harness.keys[layer][row][col] = TRANS_KEY();
+      }
+    }
+  }
+}
+
+static void harness_start(void)
+{
+  harness.now_us = harness.base_us;
+  CHECK(kb_mgt_init() == ESP_OK);
+}
+
+static time_us_t harness_at(uint32_t ms)
+{
+  return harness.base_us + TIME_MS_TO_US((time_us_t)ms);
+}
+
+// When the task would wake up on its own, as its loop computes it
+static bool harness_next_wake(time_us_t *wake)
+{
+  bool found = task_next_deadline(wake);
+
+#if IS_MASTER
+  if (hid_tx.count > 0)
+  {
+    time_us_t hid = harness.now_us +
+                    TIME_MS_TO_US(hid_tx.failing ? HID_TX_RETRY_MS
+                                                 : HID_TX_STALL_MS);
+    if (!found || time_reached(*wake, hid))
+    {
+      *wake = hid;
+      found = true;
+    }
+  }
+#endif
+
+  return found;
+}
+
+// Runs every wake-up due before ms, then moves the clock to ms
+static void harness_run_until(uint32_t ms)
+{
+  time_us_t target = harness_at(ms);
+  time_us_t wake;
+  int       guard = 0;
+
+  while (harness_next_wake(&wake) && !time_reached(wake, target + 1))
+  {
+    if (++guard > 10000)
+    {
+      CHECK(!"task keeps waking at the same time");
+      break;
+    }
+    if (time_reached(wake, harness.now_us))
+    {
+      harness.now_us = wake;
+    }
+    task_process();
+  }
+
+  harness.now_us = target;
+}
+
+static void harness_key(uint32_t ms, uint8_t row, uint8_t col, bool pressed)
+{
+  harness_run_until(ms);
+
+  key_event_t event = {
+      .row = row,
+      .col = col,
+      .pressed = pressed,
+      .timestamp = harness.now_us,
+  };
+  CHECK(kb_mgt_post_key_event(&event));
+  task_process();
+}
+
+static void harness_tap(uint32_t ms, uint32_t hold_ms, uint8_t row,
+                        uint8_t col)
+{
+  harness_key(ms, row, col, true);
+  harness_key(ms + hold_ms, row, col, false);
+}
+
+#if IS_MASTER
+// The BLE stack returns the credits of the notifications hold_tx kept back
+static void harness_tx_done(uint32_t ms)
+{
+  harness_run_until(ms);
+  for (; harness.held_tx > 0; harness.held_tx--)
+  {
+    kb_mgt_hid_tx_done();
+  }
+  task_process();
+}
+#endif
+
+static void harness_remote(uint32_t ms, const kb_mgt_remote_msg_t *msg)
+{
+  harness_run_until(ms);
+  CHECK(kb_mgt_post_remote(msg) == ESP_OK);
+  task_process();
+}
+
+// A key on the other half, reported while something here is pending
+static void harness_remote_key(uint32_t ms, uint8_t pos, bool pressed)
+{
+  kb_mgt_remote_msg_t msg = {.type = KB_MGT_REMOTE_KEY_EVENT};
+
+  msg.key_event.row = PROC_REMOTE_ROW;
+  msg.key_event.col = pos;
+  msg.key_event.pressed = pressed;
+  msg.key_event.timestamp = harness_at(ms);
+  harness_remote(ms, &msg);
+}
+
+static void harness_remote_pending(uint32_t ms, uint16_t hold_pending_ms)
+{
+  kb_mgt_remote_msg_t msg = {
+      .type = KB_MGT_REMOTE_HOLD_PENDING,
+      .hold_pending_ms = hold_pending_ms,
+  };
+  harness_remote(ms, &msg);
+}
+
+// Key edges the host saw since the last call, then forgets them
+static bool harness_saw(const char *expected)
+{
+  bool same = strcmp(harness.log, expected) == 0;
+
+  if (!same)
+  {
+    printf("  host saw \"%s\", expected \"%s\"\n", harness.log, expected);
+  }
+  harness.log[0] = '\0';
+  return same;
+}
+
+#endif // KB_MGT_HARNESS_H
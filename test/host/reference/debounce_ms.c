@@ -0,0 +1,181 @@
+// Reference copy of main/debounce.c before the bit-sliced counters (one
+// millisecond timestamp per key). Host tests build it with every public symbol
+// renamed to ref_* and replay the same waveforms through both engines.
+
+/**
+ * @file debounce.c
+ * @brief Matrix Debounce Engine
+ *
+ * Turns raw matrix samples into debounced key state. Works on whole-half
+ * bitboards, so keys that are not changing cost nothing per scan.
+ *
+ * Algorithms:
+ * - Symmetric defer: report a change once the raw level has been stable for
+ *   DEBOUNCE_TIME_MS
+ * - Per-key eager: report the first edge immediately, then ignore the key for
+ *   DEBOUNCE_TIME_MS
+ * - Asymmetric: eager on press, deferred on release
+ */
+
+#include "debounce.h"
+
+static const char *TAG = "DEBOUNCE";
+
+// =============================================================================
+// STATE VARIABLES
+// =============================================================================
+
+static struct
+{
+  debounce_algo_t algo;
+  matrix_bits_t   raw;    // Last raw sample
+  matrix_bits_t   cooked; // Debounced state
+  matrix_bits_t   locked; // Eager keys inside their lockout window
+  uint32_t        key_time[MAX_KEYS];
+} state;
+
+// =============================================================================
+// FORWARD DECLARATIONS
+// =============================================================================
+
+static void          track_raw(matrix_bits_t raw, uint32_t now_ms);
+static matrix_bits_t elapsed_keys(matrix_bits_t keys, uint32_t now_ms);
+static void          update_sym_defer(matrix_bits_t raw, uint32_t now_ms);
+static void          update_sym_eager_pk(matrix_bits_t raw, uint32_t now_ms);
+static void update_asym_eager_defer(matrix_bits_t raw, uint32_t now_ms);
+static const char *algo_to_string(debounce_algo_t algo);
+
+// =============================================================================
+// PUBLIC API
+// =============================================================================
+
+esp_err_t debounce_init(debounce_algo_t algo)
+{
+  memset(&state, 0, sizeof(state));
+  state.algo = algo;
+
+  ESP_LOGI(TAG, "Debounce initialized: %s, %dms", algo_to_string(algo),
+           DEBOUNCE_TIME_MS);
+  return ESP_OK;
+}
+
+void debounce_set_algo(debounce_algo_t algo)
+{
+  // Keep the reported state, restart any window in flight
+  state.algo = algo;
+  state.locked = 0;
+  state.raw = state.cooked;
+
+  ESP_LOGI(TAG, "Debounce algorithm: %s", algo_to_string(algo));
+}
+
+debounce_algo_t debounce_get_algo(void) { return state.algo; }
+
+matrix_bits_t debounce_update(matrix_bits_t raw, uint32_t now_ms)
+{
+  switch (state.algo)
+  {
+  case DEBOUNCE_SYM_DEFER:
+    update_sym_defer(raw, now_ms);
+    break;
+  case DEBOUNCE_SYM_EAGER_PK:
+    update_sym_eager_pk(raw, now_ms);
+    break;
+  case DEBOUNCE_ASYM_EAGER_DEFER:
+    update_asym_eager_defer(raw, now_ms);
+    break;
+  }
+
+  return state.cooked;
+}
+
+bool debounce_is_settling(void)
+{
+  return ((state.raw ^ state.cooked) | state.locked) != 0;
+}
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - HELPERS
+// =============================================================================
+
+// Restart the window of every key whose raw level moved
+static void track_raw(matrix_bits_t raw, uint32_t now_ms)
+{
+  matrix_bits_t moved = raw ^ state.raw;
+  state.raw = raw;
+
+  while (moved)
+  {
+    state.key_time[__builtin_ctz(moved)] = now_ms;
+    moved &= moved - 1;
+  }
+}
+
+// Subset of keys whose window has run for DEBOUNCE_TIME_MS
+static matrix_bits_t elapsed_keys(matrix_bits_t keys, uint32_t now_ms)
+{
+  matrix_bits_t elapsed = 0;
+
+  while (keys)
+  {
+    matrix_bits_t bit = keys & -keys;
+    if ((now_ms - state.key_time[__builtin_ctz(keys)]) >= DEBOUNCE_TIME_MS)
+    {
+      elapsed |= bit;
+    }
+    keys &= keys - 1;
+  }
+
+  return elapsed;
+}
+
+// =============================================================================
+// PRIVATE IMPLEMENTATIONS - ALGORITHMS
+// =============================================================================
+
+static void update_sym_defer(matrix_bits_t raw, uint32_t now_ms)
+{
+  track_raw(raw, now_ms);
+  state.cooked ^= elapsed_keys(state.raw ^ state.cooked, now_ms);
+}
+
+static void update_sym_eager_pk(matrix_bits_t raw, uint32_t now_ms)
+{
+  state.raw = raw;
+  state.locked &= ~elapsed_keys(state.locked, now_ms);
+
+  matrix_bits_t changed = (raw ^ state.cooked) & ~state.locked;
+  state.cooked ^= changed;
+  state.locked |= changed;
+
+  while (changed)
+  {
+    state.key_time[__builtin_ctz(changed)] = now_ms;
+    changed &= changed - 1;
+  }
+}
+
+static void update_asym_eager_defer(matrix_bits_t raw, uint32_t now_ms)
+{
+  track_raw(raw, now_ms);
+
+  // Presses go out on the first edge; the deferred release already filters
+  // the bounce that follows
+  state.cooked |= raw;
+  state.cooked &= ~elapsed_keys(state.cooked & ~raw, now_ms);
+}
+
+static const char *algo_to_string(debounce_algo_t algo)
+{
+  switch (algo)
+  {
+  case DEBOUNCE_SYM_DEFER:
+    return "SYM_DEFER";
+  case DEBOUNCE_SYM_EAGER_PK:
+    return "SYM_EAGER_PK";
+  case DEBOUNCE_ASYM_EAGER_DEFER:
+    return "ASYM_EAGER_DEFER";
+  default:
+    return "UNKNOWN";
+  }
+}
@@ -0,0 +1,140 @@
+/**
+ * @file test_combo.c
+ * @brief Combo resolution of the key processor
+ *
+ * Combo 0 is A + B (Escape), combo 1 is A + B + C (Tab), Shift is a plain
+ * modifier key. Checks when held back combo keys fire, pass on as their own
+ * letters, that other keys are never delayed and that nothing overtakes the
+ * presses a combo holds back.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define A     1, 1
+#define B     1, 2
+#define C     1, 3
+#define X     2, 4
+#define SHIFT 3, 0
+
+static const keymap_combo_t combos[] = {
+    {KEY_POS_BIT(1, 1) | KEY_POS_BIT(1, 2), NORM_KEY(KC_ESC)},
+    {KEY_POS_BIT(1, 1) | KEY_POS_BIT(1, 2) | KEY_POS_BIT(1, 3),
+     NORM_KEY(KC_TAB)},
+};
+
+static void start(uint8_t combo_count)
+{
+  harness_reset();
+  harness.keys[0][3][0] = MOD_KEY(KC_LSFT);
+  harness.combos = combos;
+  harness.combo_count = combo_count;
+  harness_start();
+}
+
+static void test_fire(void)
+{
+  // Both keys inside the window: the combo only, released with the first key
+  start(1);
+  harness_key(1000, A, true);
+  CHECK(harness_saw(""));
+  harness_key(1010, B, true);
+  CHECK(harness_saw("+29"));
+  harness_key(1100, A, false);
+  CHECK(harness_saw("-29"));
+  harness_key(1110, B, false);
+  CHECK(harness_saw(""));
+  CHECK(combo_stats[0].count == 1);
+  CHECK(combo_stats[0].latency_max_us == TIME_MS_TO_US(10));
+
+  // A + B could still become A + B + C: waits for the window
+  start(2);
+  harness_key(1000, A, true);
+  harness_key(1010, B, true);
+  CHECK(harness_saw(""));
+  harness_run_until(1000 + COMBO_TERM_MS);
+  CHECK(harness_saw("+29"));
+
+  // All three fire the larger one at once
+  start(2);
+  harness_key(1000, A, true);
+  harness_key(1010, B, true);
+  harness_key(1020, C, true);
+  CHECK(harness_saw("+2b"));
+}
+
+static void test_miss(void)
+{
+  // Alone until the window closes: its own letter
+  start(1);
+  harness_key(1000, A, true);
+  harness_run_until(1000 + COMBO_TERM_MS - 1);
+  CHECK(harness_saw(""));
+  harness_run_until(1000 + COMBO_TERM_MS);
+  CHECK(harness_saw("+0b"));
+  CHECK(combo_miss_stats.count == 1);
+
+  // Released inside the window
+  start(1);
+  harness_tap(1000, 20, A);
+  CHECK(harness_saw("+0b -0b"));
+
+  // A key that is in no combo with it ends the wait, in order
+  start(1);
+  harness_key(1000, A, true);
+  harness_key(1010, X, true);
+  CHECK(harness_saw("+0b +14"));
+
+  // Other keys are never held back
+  start(1);
+  harness_key(1000, X, true);
+  CHECK(harness_saw("+14"));
+}
+
+static void test_release_order(void)
+{
+  // Shift let go after the combo key went down: the letter is still shifted
+  start(1);
+  harness_key(990, SHIFT, true);
+  CHECK(harness_saw("+e1"));
+  harness_key(1000, A, true);
+  harness_key(1010, SHIFT, false);
+  CHECK(harness_saw(""));
+  harness_run_until(1000 + COMBO_TERM_MS);
+  CHECK(harness_saw("+0b -e1"));
+
+  // Also when the combo fires after the release
+  start(1);
+  harness_key(990, SHIFT, true);
+  CHECK(harness_saw("+e1"));
+  harness_key(1000, A, true);
+  harness_key(1010, SHIFT, false);
+  harness_key(1020, B, true);
+  CHECK(harness_saw("+29 -e1"));
+
+  // And when the held key's own release settles it
+  start(1);
+  harness_key(990, SHIFT, true);
+  CHECK(harness_saw("+e1"));
+  harness_key(1000, A, true);
+  harness_key(1010, SHIFT, false);
+  harness_key(1020, A, false);
+  CHECK(harness_saw("+0b -e1 -0b"));
+
+  // Any key's release, not only modifiers
+  start(1);
+  harness_key(990, X, true);
+  CHECK(harness_saw("+14"));
+  harness_key(1000, A, true);
+  harness_key(1010, X, false);
+  harness_run_until(1000 + COMBO_TERM_MS);
+  CHECK(harness_saw("+0b -14"));
+}
+
+int main(void)
+{
+  test_fire();
+  test_miss();
+  test_release_order();
+
+  return host_test_result();
+}
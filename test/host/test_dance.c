@@ -0,0 +1,129 @@
+/**
+ * @file test_dance.c
+ * @brief Tap-dance decisions of the key processor
+ *
+ * Dance 0 on D types 1, 2 or 3 by tap count, holds Shift or Control on the
+ * first or second tap. Dance 1 types 1 or 2 and holds Shift on the second
+ * tap. Checks that a dance decides as soon as its final tap count is known,
+ * at its timeout otherwise, and at once when another key interrupts it.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define D 2, 2
+#define X 2, 4
+
+static const keymap_tap_dance_t dances[] = {
+    {
+        .tap = {NORM_KEY(KC_1), NORM_KEY(KC_2), NORM_KEY(KC_3)},
+        .hold = {MOD_KEY(KC_LSFT), MOD_KEY(KC_LCTRL)},
+        .timeout_ms = 200,
+    },
+    {
+        .tap = {NORM_KEY(KC_1), NORM_KEY(KC_2)},
+        .hold = {[1] = MOD_KEY(KC_LSFT)},
+    },
+};
+
+static void start(uint8_t dance)
+{
+  harness_reset();
+  harness.keys[0][2][2] = TD(dance);
+  harness.dances = dances;
+  harness.dance_count = sizeof(dances) / sizeof(dances[0]);
+  harness_start();
+}
+
+static void test_final_tap(void)
+{
+  // The third press can only mean 3: typed at once, held with the key
+  start(0);
+  harness_tap(1000, 40, D);
+  harness_tap(1080, 40, D);
+  CHECK(harness_saw(""));
+  harness_key(1160, D, true);
+  CHECK(harness_saw("+20"));
+  harness_key(1300, D, false);
+  CHECK(harness_saw("-20"));
+  CHECK(dance_stats[0].count == 1);
+  CHECK(dance_stats[0].early == 1);
+  CHECK(dance_stats[0].latency_max_us == 0);
+
+  // The last tap can still be held: its release decides
+  start(1);
+  harness_tap(1000, 40, D);
+  harness_key(1080, D, true);
+  CHECK(harness_saw(""));
+  harness_key(1110, D, false);
+  CHECK(harness_saw("+1f -1f"));
+  CHECK(dance_stats[1].early == 1);
+}
+
+static void test_timeout(void)
+{
+  // Up at the timeout: taps the count so far, timed from the release
+  start(0);
+  harness_tap(1000, 40, D);
+  harness_run_until(1239);
+  CHECK(harness_saw(""));
+  harness_run_until(1240);
+  CHECK(harness_saw("+1e -1e"));
+  CHECK(dance_stats[0].early == 0);
+
+  // Down at the timeout: holds the action of that count
+  start(0);
+  harness_key(1000, D, true);
+  harness_run_until(1199);
+  CHECK(harness_saw(""));
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1"));
+  harness_key(1300, D, false);
+  CHECK(harness_saw("-e1"));
+
+  start(0);
+  harness_tap(1000, 40, D);
+  harness_key(1080, D, true);
+  harness_run_until(1280);
+  CHECK(harness_saw("+e0"));
+
+  // No timeout of its own: DEFAULT_TIMEOUT_MS
+  start(1);
+  harness_tap(1000, 40, D);
+  harness_run_until(1040 + DEFAULT_TIMEOUT_MS - 1);
+  CHECK(harness_saw(""));
+  harness_run_until(1040 + DEFAULT_TIMEOUT_MS);
+  CHECK(harness_saw("+1e -1e"));
+}
+
+static void test_interrupt(void)
+{
+  // Another key between taps: the count so far, before that key
+  start(0);
+  harness_tap(1000, 40, D);
+  harness_key(1060, X, true);
+  CHECK(harness_saw("+1e -1e +14"));
+  CHECK(dance_stats[0].early == 1);
+
+  start(0);
+  harness_tap(1000, 40, D);
+  harness_tap(1080, 40, D);
+  harness_key(1140, X, true);
+  CHECK(harness_saw("+1f -1f +14"));
+
+  // Another key while it is down: a tap too, held with the key
+  start(0);
+  harness_key(1000, D, true);
+  harness_key(1050, X, true);
+  CHECK(harness_saw("+1e +14"));
+  harness_key(1100, D, false);
+  CHECK(harness_saw("-1e"));
+}
+
+int main(void)
+{
+  test_final_tap();
+  test_timeout();
+  test_interrupt();
+
+  return host_test_result();
+}
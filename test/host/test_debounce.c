@@ -0,0 +1,444 @@
+/**
+ * @file test_debounce.c
+ * @brief Debounce engine replay tests and benchmark
+ *
+ * Replays synthetic bounce waveforms through the bit-sliced engine
+ * (main/debounce.c) and the per-key timestamp engine it replaced
+ * (reference/debounce_ms.c), sampled the way the matrix task samples them,
+ * and compares when each one reports every edge. Also pins what sets the
+ * algorithms apart on bounce and glitches, and ends with a cost-per-update
+ * benchmark of both engines.
+ */
+
+#include "debounce.h"
+#include "host_test.h"
+
+// Reference engine, public symbols renamed at build time
+esp_err_t     ref_debounce_init(debounce_algo_t algo);
+matrix_bits_t ref_debounce_update(matrix_bits_t raw, uint32_t now_ms);
+bool          ref_debounce_is_settling(void);
+
+#define SCAN_US       250 // Active scan period (power_config_t)
+#define MAX_STEPS     64
+#define MAX_REPORTS   64
+#define KEY_A         MATRIX_KEY_BIT(1, 2)
+#define KEY_B         MATRIX_KEY_BIT(3, 4)
+#define DEBOUNCE_US   TIME_MS_TO_US(DEBOUNCE_TIME_MS)
+
+// =============================================================================
+// WAVEFORMS
+// =============================================================================
+
+// Raw matrix level from `at_us` on
+typedef struct
+{
+  time_us_t     at_us;
+  matrix_bits_t level;
+} wave_step_t;
+
+typedef struct
+{
+  const char *name;
+  wave_step_t step[MAX_STEPS];
+  uint8_t     count;
+  time_us_t   end_us;
+} waveform_t;
+
+// Debounced level from `at_us` on, as reported by an engine
+typedef struct
+{
+  time_us_t     at_us;
+  matrix_bits_t level;
+} report_t;
+
+typedef struct
+{
+  report_t report[MAX_REPORTS];
+  uint8_t  count;
+} trace_t;
+
+typedef enum
+{
+  ENGINE_COUNTER, // main/debounce.c
+  ENGINE_MS,      // reference/debounce_ms.c
+} engine_t;
+
+static void wave_add(waveform_t *wave, time_us_t at_us, matrix_bits_t level)
+{
+  wave->step[wave->count].at_us = at_us;
+  wave->step[wave->count].level = level;
+  wave->count++;
+}
+
+// Toggle `key` every `period_us` for `edges` edges starting at `start_us`,
+// ending on `final`. Other keys keep the level of the previous step.
+static time_us_t wave_bounce(waveform_t *wave, matrix_bits_t key,
+                             time_us_t start_us, uint8_t edges,
+                             uint32_t period_us, bool final)
+{
+  matrix_bits_t base = wave->count ? wave->step[wave->count - 1].level : 0;
+  time_us_t     at = start_us;
+
+  for (uint8_t i = 0; i < edges; i++, at += period_us)
+  {
+    // Odd edge count from the start level lands on `final`
+    bool high = ((edges - 1 - i) & 1) ? !final : final;
+    base = high ? (base | key) : (base & ~key);
+    wave_add(wave, at, base);
+  }
+
+  return at - period_us; // Time of the last edge
+}
+
+static matrix_bits_t wave_level(const waveform_t *wave, time_us_t now_us)
+{
+  matrix_bits_t level = 0;
+
+  for (uint8_t i = 0; i < wave->count && wave->step[i].at_us <= now_us; i++)
+  {
+    level = wave->step[i].level;
+  }
+
+  return level;
+}
+
+// =============================================================================
+// REPLAY
+// =============================================================================
+
+// Sample `wave` every SCAN_US starting at `phase_us`. Like scan(), the engine
+// is skipped while nothing is down, reported or settling.
+static void replay(engine_t engine, debounce_algo_t algo,
+                   const waveform_t *wave, uint32_t phase_us, trace_t *trace)
+{
+  matrix_bits_t cooked = 0;
+
+  trace->count = 0;
+  if (engine == ENGINE_COUNTER)
+  {
+    debounce_init(algo);
+  }
+  else
+  {
+    ref_debounce_init(algo);
+  }
+
+  for (time_us_t now = phase_us; now <= wave->end_us; now += SCAN_US)
+  {
+    matrix_bits_t raw = wave_level(wave, now);
+    bool settling = engine == ENGINE_COUNTER ? debounce_is_settling()
+                                             : ref_debounce_is_settling();
+
+    if (cooked == 0 && !settling && raw == 0)
+    {
+      continue;
+    }
+
+    matrix_bits_t next = engine == ENGINE_COUNTER
+                             ? debounce_update(raw, now)
+                             : ref_debounce_update(raw, now / 1000);
+
+    if (next != cooked && trace->count < MAX_REPORTS)
+    {
+      trace->report[trace->count].at_us = now;
+      trace->report[trace->count].level = next;
+      trace->count++;
+    }
+    cooked = next;
+  }
+}
+
+// First report at or after `from_us` that changes `key` to `pressed`
+static const report_t *find_report(const trace_t *trace, matrix_bits_t key,
+                                   bool pressed, time_us_t from_us)
+{
+  matrix_bits_t prev = 0;
+
+  for (uint8_t i = 0; i < trace->count; i++)
+  {
+    const report_t *r = &trace->report[i];
+    bool changed = ((r->level ^ prev) & key) != 0;
+    prev = r->level;
+
+    if (changed && r->at_us >= from_us && ((r->level & key) != 0) == pressed)
+    {
+      return r;
+    }
+  }
+
+  return NULL;
+}
+
+static uint8_t count_edges(const trace_t *trace, matrix_bits_t key)
+{
+  matrix_bits_t prev = 0;
+  uint8_t       edges = 0;
+
+  for (uint8_t i = 0; i < trace->count; i++)
+  {
+    edges += ((trace->report[i].level ^ prev) & key) != 0;
+    prev = trace->report[i].level;
+  }
+
+  return edges;
+}
+
+// =============================================================================
+// TESTS - ENGINE EQUIVALENCE
+// =============================================================================
+
+// Clean press and release, then the same key bouncing every 250us on both
+// edges, then two keys bouncing over each other
+static void build_waveforms(waveform_t *wave, uint8_t *count,
+                            time_us_t last_edge[][2])
+{
+  waveform_t *w = &wave[0];
+  w->name = "clean";
+  wave_add(w, 10000, KEY_A);
+  wave_add(w, 60000, 0);
+  last_edge[0][0] = 10000;
+  last_edge[0][1] = 60000;
+  w->end_us = 90000;
+
+  w = &wave[1];
+  w->name = "bounce 250us";
+  last_edge[1][0] = wave_bounce(w, KEY_A, 10000, 7, 250, true);
+  last_edge[1][1] = wave_bounce(w, KEY_A, 60000, 7, 250, false);
+  w->end_us = 90000;
+
+  w = &wave[2];
+  w->name = "two keys";
+  last_edge[2][0] = wave_bounce(w, KEY_A, 10000, 5, 250, true);
+  wave_bounce(w, KEY_B, 11300, 9, 250, true);
+  last_edge[2][1] = wave_bounce(w, KEY_A, 40000, 5, 250, false);
+  wave_bounce(w, KEY_B, 41100, 3, 250, false);
+  w->end_us = 90000;
+
+  *count = 3;
+}
+
+static void test_engines_agree(void)
+{
+  static waveform_t wave[3];
+  time_us_t         last_edge[3][2];
+  uint8_t           wave_count;
+  const debounce_algo_t algos[] = {DEBOUNCE_SYM_DEFER, DEBOUNCE_SYM_EAGER_PK,
+                                   DEBOUNCE_ASYM_EAGER_DEFER};
+
+  memset(wave, 0, sizeof(wave));
+  build_waveforms(wave, &wave_count, last_edge);
+
+  for (uint8_t a = 0; a < 3; a++)
+  {
+    for (uint8_t w = 0; w < wave_count; w++)
+    {
+      uint32_t worst_gap = 0;
+
+      for (uint32_t phase = 0; phase < 1000; phase += 50)
+      {
+        trace_t counter, ms;
+        replay(ENGINE_COUNTER, algos[a], &wave[w], phase, &counter);
+        replay(ENGINE_MS, algos[a], &wave[w], phase, &ms);
+
+        // Same edges in the same order, each within a millisecond
+        CHECK(count_edges(&counter, KEY_A) == count_edges(&ms, KEY_A));
+        CHECK(count_edges(&counter, KEY_B) == count_edges(&ms, KEY_B));
+        CHECK(counter.count == ms.count);
+        for (uint8_t i = 0; i < counter.count && i < ms.count; i++)
+        {
+          uint32_t gap = counter.report[i].at_us > ms.report[i].at_us
+                             ? counter.report[i].at_us - ms.report[i].at_us
+                             : ms.report[i].at_us - counter.report[i].at_us;
+          CHECK(counter.report[i].level == ms.report[i].level);
+          CHECK(gap < 1000);
+          worst_gap = gap > worst_gap ? gap : worst_gap;
+        }
+      }
+
+      printf("  %-16s %-12s engines differ by at most %4lu us\n",
+             algos[a] == DEBOUNCE_SYM_DEFER      ? "SYM_DEFER"
+             : algos[a] == DEBOUNCE_SYM_EAGER_PK ? "SYM_EAGER_PK"
+                                                 : "ASYM_EAGER_DEFER",
+             wave[w].name, (unsigned long)worst_gap);
+    }
+  }
+}
+
+// A deferred edge goes out once the raw level has been stable for the
+// window. Both engines count whole milliseconds, so the edge is reported
+// between DEBOUNCE_TIME_MS - 1 and DEBOUNCE_TIME_MS after the scan that saw
+// the last bounce.
+static void test_defer_latency(void)
+{
+  static waveform_t wave[3];
+  time_us_t         last_edge[3][2];
+  uint8_t           wave_count;
+
+  memset(wave, 0, sizeof(wave));
+  build_waveforms(wave, &wave_count, last_edge);
+
+  for (engine_t engine = ENGINE_COUNTER; engine <= ENGINE_MS; engine++)
+  {
+    for (uint8_t w = 0; w < wave_count; w++)
+    {
+      uint32_t lo = UINT32_MAX, hi = 0;
+
+      for (uint32_t phase = 0; phase < 1000; phase += 50)
+      {
+        trace_t trace;
+        replay(engine, DEBOUNCE_SYM_DEFER, &wave[w], phase, &trace);
+
+        for (int edge = 0; edge < 2; edge++)
+        {
+          const report_t *r =
+              find_report(&trace, KEY_A, edge == 0, last_edge[w][edge]);
+          CHECK(r != NULL);
+          if (r == NULL)
+          {
+            continue;
+          }
+
+          uint32_t latency = r->at_us - last_edge[w][edge];
+          CHECK(latency > DEBOUNCE_US - 1000);
+          CHECK(latency <= DEBOUNCE_US + SCAN_US);
+          lo = latency < lo ? latency : lo;
+          hi = latency > hi ? latency : hi;
+        }
+      }
+
+      printf("  %-8s %-12s defer latency after last edge %4lu-%4lu us\n",
+             engine == ENGINE_COUNTER ? "counter" : "ms", wave[w].name,
+             (unsigned long)lo, (unsigned long)hi);
+    }
+  }
+}
+
+// =============================================================================
+// TESTS - ALGORITHMS
+// =============================================================================
+
+// A noise spike one scan long: only the deferring algorithm ignores it
+static void test_glitch(engine_t engine)
+{
+  waveform_t wave = {.name = "glitch", .end_us = 30000};
+  trace_t    trace;
+
+  wave_add(&wave, 10000, KEY_A);
+  wave_add(&wave, 10000 + SCAN_US, 0);
+
+  replay(engine, DEBOUNCE_SYM_DEFER, &wave, 0, &trace);
+  CHECK(trace.count == 0);
+
+  replay(engine, DEBOUNCE_SYM_EAGER_PK, &wave, 0, &trace);
+  CHECK(count_edges(&trace, KEY_A) == 2);
+
+  replay(engine, DEBOUNCE_ASYM_EAGER_DEFER, &wave, 0, &trace);
+  CHECK(count_edges(&trace, KEY_A) == 2);
+}
+
+// The eager algorithms report a bounced press on the scan that sees its first
+// edge and swallow the bounce behind it
+static void test_eager_press(engine_t engine)
+{
+  const debounce_algo_t algos[] = {DEBOUNCE_SYM_EAGER_PK,
+                                   DEBOUNCE_ASYM_EAGER_DEFER};
+  waveform_t            wave = {.name = "press", .end_us = 30000};
+  trace_t               trace;
+
+  wave_bounce(&wave, KEY_A, 10000, 7, SCAN_US, true);
+
+  for (uint8_t a = 0; a < 2; a++)
+  {
+    replay(engine, algos[a], &wave, 0, &trace);
+    const report_t *press = find_report(&trace, KEY_A, true, 0);
+
+    CHECK(press != NULL && press->at_us == 10000);
+    CHECK(count_edges(&trace, KEY_A) == 1);
+  }
+}
+
+// The asymmetric algorithm holds a bounced release until the line has been
+// quiet for the window, the symmetric eager one reports its first edge
+static void test_asym_release(engine_t engine)
+{
+  waveform_t wave = {.name = "release", .end_us = 60000};
+  trace_t    trace;
+
+  wave_add(&wave, 10000, KEY_A);
+  time_us_t last = wave_bounce(&wave, KEY_A, 30000, 7, SCAN_US, false);
+
+  replay(engine, DEBOUNCE_ASYM_EAGER_DEFER, &wave, 0, &trace);
+  const report_t *release = find_report(&trace, KEY_A, false, 0);
+  CHECK(count_edges(&trace, KEY_A) == 2);
+  CHECK(release != NULL && release->at_us > last + DEBOUNCE_US - 1000);
+
+  replay(engine, DEBOUNCE_SYM_EAGER_PK, &wave, 0, &trace);
+  release = find_report(&trace, KEY_A, false, 0);
+  CHECK(count_edges(&trace, KEY_A) == 2);
+  CHECK(release != NULL && release->at_us == 30000);
+}
+
+// =============================================================================
+// BENCHMARK
+// =============================================================================
+
+// Every key of the half bouncing at once, the worst case for per-key work
+static matrix_bits_t bench_raw(uint32_t i)
+{
+  return (i & 1 ? 0x2AAAAAAAU : 0x15555555U) & MATRIX_KEYS_MASK;
+}
+
+static void bench_engine(engine_t engine, bool busy)
+{
+  const uint32_t rounds = 2000000;
+  matrix_bits_t  sink = 0;
+
+  if (engine == ENGINE_COUNTER)
+  {
+    debounce_init(DEBOUNCE_SYM_DEFER);
+  }
+  else
+  {
+    ref_debounce_init(DEBOUNCE_SYM_DEFER);
+  }
+
+  uint64_t start = host_now_ns();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    // Bounce for 2ms out of every 8ms, otherwise one key held
+    time_us_t     now = i * SCAN_US;
+    matrix_bits_t raw = busy && (now % 8000) < 2000 ? bench_raw(i) : KEY_A;
+    sink ^= engine == ENGINE_COUNTER ? debounce_update(raw, now)
+                                     : ref_debounce_update(raw, now / 1000);
+  }
+  uint64_t elapsed = host_now_ns() - start;
+
+  host_sink(sink);
+  printf("  %-8s %-6s %6.2f ns/update\n",
+         engine == ENGINE_COUNTER ? "counter" : "ms", busy ? "busy" : "held",
+         (double)elapsed / rounds);
+}
+
+int main(void)
+{
+  for (engine_t engine = ENGINE_COUNTER; engine <= ENGINE_MS; engine++)
+  {
+    test_glitch(engine);
+    test_eager_press(engine);
+    test_asym_release(engine);
+  }
+
+  printf("engine equivalence:\n");
+  test_engines_agree();
+  printf("defer latency:\n");
+  test_defer_latency();
+
+  printf("benchmark:\n");
+  for (engine_t engine = ENGINE_COUNTER; engine <= ENGINE_MS; engine++)
+  {
+    bench_engine(engine, false);
+    bench_engine(engine, true);
+  }
+
+  return host_test_result();
+}
@@ -0,0 +1,75 @@
+/**
+ * @file test_hid_report.c
+ * @brief Key report format the master sends the host
+ *
+ * NKRO goes out only in report protocol and once the ATT MTU carries the
+ * whole report; everything else gets the 6KRO report. Checks the format
+ * follows the host and that a switch releases what the old format held.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define X 2, 4
+
+static void test_mtu(void)
+{
+  harness_reset();
+  harness_start();
+  CHECK(HID_NKRO_MIN_MTU == 33);
+
+  // The default MTU cuts the NKRO report short, none is ever sent at it
+  harness_key(1000, X, true);
+  CHECK(harness_saw("+14"));
+  CHECK(harness.report_id == HID_KEYBOARD_REPORT_ID);
+  CHECK(harness.reports == 1);
+  harness_key(1010, X, false);
+  CHECK(harness_saw("-14"));
+
+  // One that fits it
+  kb_mgt_hid_set_mtu(HID_NKRO_MIN_MTU);
+  harness_key(1100, X, true);
+  CHECK(harness_saw("+14"));
+  CHECK(harness.report_id == HID_NKRO_REPORT_ID);
+
+  // A new connection starts small again. Nothing is sent in NKRO to release
+  // the old format, it would be cut short.
+  kb_mgt_hid_set_mtu(HID_ATT_MTU_DEFAULT);
+  uint32_t reports = harness.reports;
+  harness_key(1200, 3, 1, true);
+  CHECK(harness.report_id == HID_KEYBOARD_REPORT_ID);
+  CHECK(harness.reports == reports + 1);
+  CHECK(harness_saw("+17"));
+
+  // Growing past it while keys are down: 6KRO releases, NKRO takes over
+  kb_mgt_hid_set_mtu(247);
+  reports = harness.reports;
+  harness_key(1300, X, false);
+  CHECK(harness.report_id == HID_NKRO_REPORT_ID);
+  CHECK(harness.reports == reports + 2);
+  CHECK(harness_saw("-14 -17 +17"));
+}
+
+static void test_boot_protocol(void)
+{
+  harness_reset();
+  harness_start();
+  kb_mgt_hid_set_mtu(247);
+  kb_mgt_hid_set_protocol_mode(ESP_HID_PROTOCOL_MODE_BOOT);
+
+  harness_key(1000, X, true);
+  CHECK(harness_saw("+14"));
+  CHECK(harness.report_id == HID_KEYBOARD_REPORT_ID);
+
+  kb_mgt_hid_set_protocol_mode(ESP_HID_PROTOCOL_MODE_REPORT);
+  harness_key(1010, X, false);
+  CHECK(harness_saw("-14"));
+  CHECK(harness.report_id == HID_NKRO_REPORT_ID);
+}
+
+int main(void)
+{
+  test_mtu();
+  test_boot_protocol();
+
+  return host_test_result();
+}
@@ -0,0 +1,210 @@
+/**
+ * @file test_hold_tap.c
+ * @brief Hold-tap decisions of the key processor
+ *
+ * One mod-tap key M (Shift / its letter) and plain keys X and Y, each case
+ * from a fresh start. Checks what the host sees for every flavor, the
+ * timeout, per-key timeouts, quick-tap and that keys held back behind a
+ * layer-tap land on the layer it selects.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define M 2, 2
+#define X 2, 4
+#define Y 3, 1
+
+static void start(key_code_t m)
+{
+  harness_reset();
+  harness.keys[0][2][2] = m;
+  harness_start();
+}
+
+static key_code_t mod_tap(uint16_t timeout_ms, uint8_t flavor)
+{
+  return MT_FL(KC_LSFT, HARNESS_KEY(M), timeout_ms, flavor);
+}
+
+// M held over a complete tap of X
+static void nested_tap(void)
+{
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  harness_key(1080, X, false);
+  harness_key(1120, M, false);
+}
+
+// M released while X is still down
+static void roll(void)
+{
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  harness_key(1090, M, false);
+  harness_key(1120, X, false);
+}
+
+static void test_tap_preferred(void)
+{
+  start(mod_tap(200, HOLD_TAP_TAP_PREFERRED));
+  harness_tap(1000, 50, M);
+  CHECK(harness_saw("+12 -12"));
+
+  // A nested tap does not make it a hold
+  start(mod_tap(200, HOLD_TAP_TAP_PREFERRED));
+  nested_tap();
+  CHECK(harness_saw("+12 +14 -14 -12"));
+
+  // The timeout does, and the held-back press follows the modifier
+  start(mod_tap(200, HOLD_TAP_TAP_PREFERRED));
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  harness_run_until(1199);
+  CHECK(harness_saw(""));
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1 +14"));
+  harness_key(1250, X, false);
+  harness_key(1260, M, false);
+  CHECK(harness_saw("-14 -e1"));
+}
+
+static void test_default_flavor(void)
+{
+  // Keys without a flavor of their own keep the tap-preferred behaviour
+  start(MT_TO(KC_LSFT, HARNESS_KEY(M), 200));
+  nested_tap();
+  CHECK(harness_saw("+12 +14 -14 -12"));
+}
+
+static void test_balanced(void)
+{
+  start(mod_tap(200, HOLD_TAP_BALANCED));
+  nested_tap();
+  CHECK(harness_saw("+e1 +14 -14 -e1"));
+
+  start(mod_tap(200, HOLD_TAP_BALANCED));
+  roll();
+  CHECK(harness_saw("+12 +14 -12 -14"));
+}
+
+static void test_permissive_hold(void)
+{
+  start(mod_tap(200, HOLD_TAP_PERMISSIVE_HOLD));
+  nested_tap();
+  CHECK(harness_saw("+e1 +14 -14 -e1"));
+
+  start(mod_tap(200, HOLD_TAP_PERMISSIVE_HOLD));
+  roll();
+  CHECK(harness_saw("+12 +14 -12 -14"));
+
+  // A press still down at the timeout: the timeout decides, no release is
+  // waited for
+  start(mod_tap(200, HOLD_TAP_PERMISSIVE_HOLD));
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1 +14"));
+}
+
+static void test_hold_preferred(void)
+{
+  start(mod_tap(200, HOLD_TAP_HOLD_PREFERRED));
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  CHECK(harness_saw("+e1 +14"));
+  harness_key(1060, M, false);
+  harness_key(1070, X, false);
+  CHECK(harness_saw("-e1 -14"));
+}
+
+static void test_timeouts(void)
+{
+  // Held alone past its timeout
+  start(mod_tap(200, HOLD_TAP_TAP_PREFERRED));
+  harness_key(1000, M, true);
+  harness_run_until(1199);
+  CHECK(harness_saw(""));
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1"));
+  harness_key(1300, M, false);
+  CHECK(harness_saw("-e1"));
+
+  // Per-key timeout, longer than the default
+  start(mod_tap(300, HOLD_TAP_TAP_PREFERRED));
+  harness_key(1000, M, true);
+  harness_key(1250, X, true);
+  CHECK(harness_saw(""));
+  harness_run_until(1300);
+  CHECK(harness_saw("+e1 +14"));
+
+  // No timeout of its own: DEFAULT_TIMEOUT_MS
+  start(mod_tap(0, HOLD_TAP_TAP_PREFERRED));
+  harness_key(1000, M, true);
+  harness_run_until(1000 + DEFAULT_TIMEOUT_MS - 1);
+  CHECK(harness_saw(""));
+  harness_run_until(1000 + DEFAULT_TIMEOUT_MS);
+  CHECK(harness_saw("+e1"));
+}
+
+static void test_quick_tap(void)
+{
+  // Tapped, then pressed again inside the quick-tap window: a tap at once,
+  // held for as long as the key is
+  start(mod_tap(200, HOLD_TAP_BALANCED));
+  harness_tap(1000, 40, M);
+  CHECK(harness_saw("+12 -12"));
+  harness_key(1000 + HOLD_TAP_QUICK_TAP_MS - 10, M, true);
+  CHECK(harness_saw("+12"));
+  harness_run_until(1600);
+  harness_key(1600, M, false);
+  CHECK(harness_saw("-12"));
+
+  // Outside the window it is undecided again
+  start(mod_tap(200, HOLD_TAP_BALANCED));
+  harness_tap(1000, 40, M);
+  CHECK(harness_saw("+12 -12"));
+  harness_key(1040 + HOLD_TAP_QUICK_TAP_MS, M, true);
+  CHECK(harness_saw(""));
+}
+
+static void test_layer_tap(void)
+{
+  // Keys held back behind a layer-tap are processed on the layer it selects
+  harness_reset();
+  harness.keys[0][2][2] = LT_FL(1, HARNESS_KEY(M), 200, HOLD_TAP_BALANCED);
+  harness.keys[1][2][4] = NORM_KEY(KC_1);
+  harness_start();
+  nested_tap();
+  CHECK(harness_saw("+1e -1e"));
+
+  harness_reset();
+  harness.keys[0][2][2] = LT_FL(1, HARNESS_KEY(M), 200, HOLD_TAP_BALANCED);
+  harness.keys[1][2][4] = NORM_KEY(KC_1);
+  harness_start();
+  roll();
+  CHECK(harness_saw("+12 +14 -12 -14"));
+}
+
+static void test_other_keys_untouched(void)
+{
+  // Plain keys are never held back without a pending key
+  start(mod_tap(200, HOLD_TAP_BALANCED));
+  harness_key(1000, X, true);
+  harness_key(1010, Y, true);
+  CHECK(harness_saw("+14 +17"));
+}
+
+int main(void)
+{
+  test_tap_preferred();
+  test_default_flavor();
+  test_balanced();
+  test_permissive_hold();
+  test_hold_preferred();
+  test_timeouts();
+  test_quick_tap();
+  test_layer_tap();
+  test_other_keys_untouched();
+
+  return host_test_result();
+}
@@ -0,0 +1,85 @@
+/**
+ * @file test_keymap.c
+ * @brief Sparse layer lookup tests
+ *
+ * Includes keymap.c to reach its layer tables, expands every LAYER_n_KEYS
+ * list into a dense layer with transparent gaps, and checks that the
+ * popcount-rank lookup resolves every layer and position to the same code.
+ * Built once per half.
+ */
+
+#include "host_test.h"
+#include "keymap.c"
+
+static key_code_t dense[MAX_LAYERS][MATRIX_ROW][MATRIX_COL];
+
+#define DENSE_SET(row, col, code) dense[layer][row][col] = code;
+
+static void build_dense(void)
+{
+  uint8_t layer;
+
+  memcpy(dense[0], keymap_base, sizeof(keymap_base));
+  for (layer = 1; layer < MAX_LAYERS; layer++)
+  {
+    for (uint8_t row = 0; row < MATRIX_ROW; row++)
+    {
+      for (uint8_t col = 0; col < MATRIX_COL; col++)
+      {
+        dense[layer][row][col] = TRANS_KEY();
+      }
+    }
+  }
+
+  layer = 1;
+  LAYER_1_KEYS(DENSE_SET)
+  layer = 2;
+  LAYER_2_KEYS(DENSE_SET)
+}
+
+_Static_assert(MAX_LAYERS == 3, "build_dense expands LAYER_1 and LAYER_2");
+
+static void test_every_position(void)
+{
+  uint32_t defined = 0;
+
+  for (uint8_t layer = 0; layer < MAX_LAYERS; layer++)
+  {
+    for (uint8_t row = 0; row < MATRIX_ROW; row++)
+    {
+      for (uint8_t col = 0; col < MATRIX_COL; col++)
+      {
+        key_code_t code = dense[layer][row][col];
+        key_def_t  key = keymap_get_key(layer, row, col);
+        key_def_t  want = keymap_decode(code);
+
+        CHECK(keymap_code(layer, row, col) == code);
+        CHECK(key.type == want.type && key.keycode == want.keycode);
+        defined += layer > 0 && code != TRANS_KEY();
+      }
+    }
+  }
+
+  // Every listed entry was found, none collapsed onto another
+  CHECK(defined == keymap_upper[0].count + keymap_upper[1].count);
+}
+
+static void test_out_of_range(void)
+{
+  key_def_t none = keymap_decode(NORM_KEY(KC_NO));
+
+  CHECK(keymap_get_key(MAX_LAYERS, 0, 0).type == none.type);
+  CHECK(keymap_get_key(0, MATRIX_ROW, 0).keycode == none.keycode);
+  CHECK(keymap_get_key(1, 0, MATRIX_COL).keycode == none.keycode);
+}
+
+int main(void)
+{
+  CHECK(keymap_init() == ESP_OK);
+
+  build_dense();
+  test_every_position();
+  test_out_of_range();
+
+  return host_test_result();
+}
@@ -0,0 +1,90 @@
+/**
+ * @file test_lp_idle.c
+ * @brief LP core idle column filter tests
+ *
+ * Drives lp_matrix_idle_filter(), the same inline filter the LP core program
+ * runs every LP_MATRIX_POLL_US, with column poll sequences.
+ */
+
+#include "host_test.h"
+#include "lp_matrix_idle.h"
+
+// Feeds `count` polls, returns the index of the poll that wakes (or -1) and
+// the columns it reported
+static int run_polls(const uint32_t *polls, int count, uint32_t *woke_cols)
+{
+  uint32_t stable = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    uint32_t cols = lp_matrix_idle_filter(polls[i], &stable);
+    if (cols)
+    {
+      *woke_cols = cols;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// A spike one poll long never wakes the HP core
+static void test_glitch(void)
+{
+  const uint32_t polls[] = {0, 0x04, 0, 0, 0x10, 0, 0x01, 0};
+  uint32_t       cols = 0;
+
+  CHECK(run_polls(polls, 8, &cols) == -1);
+}
+
+// A key held for LP_MATRIX_STABLE_POLLS polls wakes on the last of them
+static void test_held_key(void)
+{
+  const uint32_t polls[] = {0, 0, 0x08, 0x08, 0x08};
+  uint32_t       cols = 0;
+
+  CHECK(run_polls(polls, 5, &cols) == 1 + LP_MATRIX_STABLE_POLLS);
+  CHECK(cols == 0x08);
+}
+
+// Any active column keeps the run going, even when it moves between polls,
+// and the wake reports the columns seen on the waking poll
+static void test_rolling_columns(void)
+{
+  const uint32_t polls[] = {0x01, 0x03, 0x02, 0x06, 0x04, 0x0C};
+  uint32_t       cols = 0;
+
+  CHECK(run_polls(polls, 6, &cols) == LP_MATRIX_STABLE_POLLS - 1);
+  CHECK(cols == polls[LP_MATRIX_STABLE_POLLS - 1]);
+}
+
+// A quiet poll restarts the count, and the count saturates instead of
+// wrapping while a key stays down
+static void test_counter(void)
+{
+  uint32_t stable = 0;
+
+  for (int i = 1; i < LP_MATRIX_STABLE_POLLS; i++)
+  {
+    CHECK(lp_matrix_idle_filter(0x01, &stable) == 0);
+  }
+  CHECK(lp_matrix_idle_filter(0, &stable) == 0);
+  CHECK(stable == 0);
+
+  for (int i = 0; i < 1000; i++)
+  {
+    lp_matrix_idle_filter(0x20, &stable);
+  }
+  CHECK(stable == LP_MATRIX_STABLE_POLLS);
+  CHECK(lp_matrix_idle_filter(0x20, &stable) == 0x20);
+}
+
+int main(void)
+{
+  test_glitch();
+  test_held_key();
+  test_rolling_columns();
+  test_counter();
+
+  return host_test_result();
+}
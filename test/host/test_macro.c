@@ -0,0 +1,126 @@
+/**
+ * @file test_macro.c
+ * @brief Macro playback of the key processor
+ *
+ * Macro keys on the master, played through the BLE transmit credits. Checks
+ * that steps wait for the link, that delays hold playback for their time
+ * only, that nothing a macro pressed outlives it and that macros pressed
+ * while one plays follow it in order.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define M0 2, 2
+#define M1 2, 3
+#define X  2, 4
+
+#define MACRO(...)                                                             \
+  {.code = (const uint8_t[]){__VA_ARGS__},                                     \
+   .length = sizeof((const uint8_t[]){__VA_ARGS__})}
+
+static const keymap_macro_t macros[] = {
+    MACRO(MACRO_TAP(KC_A), MACRO_TAP(KC_B), MACRO_TAP(KC_C)),
+    MACRO(MACRO_TAP(KC_A), MACRO_DELAY(300), MACRO_TAP(KC_B)),
+    MACRO(MACRO_MOD_DOWN(HID_MOD_LEFT_SHIFT), MACRO_PRESS(KC_A)),
+};
+
+static void start(uint8_t m0, uint8_t m1)
+{
+  harness_reset();
+  harness.keys[0][2][2] = MACRO_KEY(m0);
+  harness.keys[0][2][3] = MACRO_KEY(m1);
+  harness.macros = macros;
+  harness.macro_count = sizeof(macros) / sizeof(macros[0]);
+  harness_start();
+}
+
+static void test_pacing(void)
+{
+  // A free link plays the whole macro at once, one report per step
+  start(0, 0);
+  harness_tap(900, 20, X);
+  CHECK(harness_saw("+14 -14"));
+  uint32_t reports = harness.reports;
+  harness_tap(1000, 20, M0);
+  CHECK(harness_saw("+04 -04 +05 -05 +06 -06"));
+  CHECK(harness.reports == reports + 6);
+
+  // Each step waits for the notification before it to complete
+  start(0, 0);
+  harness.hold_tx = true;
+  harness_key(1000, M0, true);
+  CHECK(harness_saw("+04"));
+  harness_run_until(1010);
+  CHECK(harness_saw(""));
+  harness_tx_done(1010);
+  CHECK(harness_saw("-04"));
+  harness_tx_done(1020);
+  CHECK(harness_saw("+05"));
+
+  // A real key waits for the link only, not for the rest of the macro
+  harness_key(1025, X, true);
+  CHECK(harness_saw(""));
+  harness_tx_done(1030);
+  CHECK(harness_saw("-05 +14"));
+  harness.hold_tx = false;
+  harness_tx_done(1040);
+  CHECK(harness_saw("+06 -06"));
+}
+
+static void test_delay(void)
+{
+  start(1, 1);
+  harness_tap(1000, 20, M0);
+  CHECK(harness_saw("+04 -04"));
+  harness_run_until(1299);
+  CHECK(harness_saw(""));
+  harness_run_until(1300);
+  CHECK(harness_saw("+05 -05"));
+
+  // Keys typed during the delay go out right away
+  start(1, 1);
+  harness_tap(1000, 20, M0);
+  CHECK(harness_saw("+04 -04"));
+  harness_tap(1100, 20, X);
+  CHECK(harness_saw("+14 -14"));
+  harness_run_until(1300);
+  CHECK(harness_saw("+05 -05"));
+}
+
+static void test_release_all(void)
+{
+  // Left down by the program, released when it ends
+  start(2, 2);
+  harness_key(1000, M0, true);
+  CHECK(harness_saw("+e1 +04 -04 -e1"));
+  harness_key(1100, M0, false);
+  CHECK(harness_saw(""));
+
+  // Also under a real key still held
+  start(2, 2);
+  harness_key(990, X, true);
+  CHECK(harness_saw("+14"));
+  harness_key(1000, M0, true);
+  CHECK(harness_saw("+e1 +04 -04 -e1"));
+}
+
+static void test_queue(void)
+{
+  // Pressed while another plays: waits its turn
+  start(1, 0);
+  harness_tap(1000, 20, M0);
+  harness_tap(1050, 20, M1);
+  CHECK(harness_saw("+04 -04"));
+  harness_run_until(1300);
+  CHECK(harness_saw("+05 -05 +04 -04 +05 -05 +06 -06"));
+}
+
+int main(void)
+{
+  test_pacing();
+  test_delay();
+  test_release_all();
+  test_queue();
+
+  return host_test_result();
+}
@@ -0,0 +1,164 @@
+/**
+ * @file test_opposite_hands.c
+ * @brief Tap-hold keys across the two halves
+ *
+ * One opposite-hands mod-tap key M (Shift / its letter) and a plain key X on
+ * this half, keys of the other half arrive as its key events. Checks that
+ * this half's keys tap M and the other half's hold it, that a waiting key is
+ * announced to the other half and resent until decided, and how long keys
+ * wait here for a decision the other half announced.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define M 2, 2
+#define X 2, 4
+
+#define OTHER KEY_POS(2, 1) // A key on the other half
+
+static void start(void)
+{
+  harness_reset();
+  harness.keys[0][2][2] =
+      MT_FL(KC_LSFT, HARNESS_KEY(M), 200, HOLD_TAP_OPPOSITE_HANDS);
+  harness_start();
+}
+
+// HOLD_PENDING frames sent since the last call, the last one's value in ms
+static uint32_t pending_sent(uint16_t *ms)
+{
+  uint32_t count = 0;
+
+  for (uint32_t i = 0; i < harness.frame_count; i++)
+  {
+    if (harness.frames[i].type == HOLD_PENDING)
+    {
+      *ms = harness.frames[i].hold_pending_ms;
+      count++;
+    }
+  }
+  harness.frame_count = 0;
+  return count;
+}
+
+static void test_same_half(void)
+{
+  // A roll on this half: the letter at once, before X
+  start();
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  CHECK(harness_saw("+12 +14"));
+  harness_key(1080, M, false);
+  harness_key(1100, X, false);
+  CHECK(harness_saw("-12 -14"));
+
+  // Also when X is let go while M is still down
+  start();
+  harness_key(1000, M, true);
+  harness_key(1050, X, true);
+  harness_key(1080, X, false);
+  harness_key(1120, M, false);
+  CHECK(harness_saw("+12 +14 -14 -12"));
+}
+
+static void test_other_half(void)
+{
+  // A chord across the halves: Shift at once
+  start();
+  harness_key(1000, M, true);
+  harness_remote_key(1050, OTHER, true);
+  CHECK(harness_saw("+e1"));
+  harness_remote_key(1080, OTHER, false);
+  harness_key(1120, M, false);
+  CHECK(harness_saw("-e1"));
+
+  // A release of a key pressed before M decides nothing
+  start();
+  harness_key(1000, M, true);
+  harness_remote_key(1050, OTHER, false);
+  CHECK(harness_saw(""));
+  harness_key(1100, M, false);
+  CHECK(harness_saw("+12 -12"));
+
+  // Alone, the timeout holds as usual
+  start();
+  harness_key(1000, M, true);
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1"));
+}
+
+static void test_pending_resend(void)
+{
+  uint16_t ms = UINT16_MAX;
+
+  // Announced with its timeout when pressed
+  start();
+  harness.frame_count = 0;
+  harness_key(1000, M, true);
+  CHECK(pending_sent(&ms) == 1);
+  CHECK(ms == 200);
+
+  // Repeated while it waits
+  harness_run_until(1000 + PROC_PENDING_RESEND_MS - 1);
+  CHECK(pending_sent(&ms) == 0);
+  harness_run_until(1000 + PROC_PENDING_RESEND_MS);
+  CHECK(pending_sent(&ms) == 1);
+  CHECK(ms == 200);
+  harness_run_until(1000 + 2 * PROC_PENDING_RESEND_MS);
+  CHECK(pending_sent(&ms) == 1);
+
+  // Settled once decided, then quiet
+  harness_run_until(1199);
+  pending_sent(&ms);
+  CHECK(ms == 200);
+  harness_run_until(1200);
+  CHECK(harness_saw("+e1"));
+  CHECK(pending_sent(&ms) == 1);
+  CHECK(ms == 0);
+  harness_run_until(1200 + 4 * PROC_PENDING_RESEND_MS);
+  CHECK(pending_sent(&ms) == 0);
+}
+
+static void test_pending_expiry(void)
+{
+  uint32_t overdue = 1000 + 200 + PROC_REMOTE_PENDING_MARGIN_MS;
+
+  // The other half waits on a key: ours wait with it, at most its timeout
+  // and the margin
+  start();
+  harness_remote_pending(1000, 200);
+  harness_key(1050, X, true);
+  CHECK(harness_saw(""));
+  harness_run_until(overdue - 1);
+  CHECK(harness_saw(""));
+  harness_run_until(overdue);
+  CHECK(harness_saw("+14"));
+  CHECK(!proc_state.remote_pending);
+
+  // A resend starts the wait over
+  start();
+  harness_remote_pending(1000, 200);
+  harness_key(1050, X, true);
+  harness_remote_pending(1000 + PROC_PENDING_RESEND_MS, 200);
+  harness_run_until(overdue);
+  CHECK(harness_saw(""));
+  harness_run_until(overdue + PROC_PENDING_RESEND_MS);
+  CHECK(harness_saw("+14"));
+
+  // Its decision lets them go at once
+  start();
+  harness_remote_pending(1000, 200);
+  harness_key(1050, X, true);
+  harness_remote_pending(1100, 0);
+  CHECK(harness_saw("+14"));
+}
+
+int main(void)
+{
+  test_same_half();
+  test_other_half();
+  test_pending_resend();
+  test_pending_expiry();
+
+  return host_test_result();
+}
@@ -0,0 +1,147 @@
+/**
+ * @file test_remote_inbox.c
+ * @brief Messages from the other half arriving faster than they are applied
+ *
+ * Messages are posted the way the ESP-NOW task posts them, several before the
+ * processing task gets to run. Checks that state messages never fill the
+ * inbox, that taps and decisions inside a burst still reach the host, that
+ * states and edges are applied in the order they were sent and that the edge
+ * inbox holds the worst case burst.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define X 2, 4
+
+static kb_mgt_remote_msg_t report(uint8_t modifiers, uint8_t key)
+{
+  kb_mgt_remote_msg_t msg = {.type = KB_MGT_REMOTE_KEY_REPORT};
+
+  msg.key_report.modifiers = modifiers;
+  if (key != HID_KEY_NONE)
+  {
+    msg.key_report.keys[key >> 3] = 1U << (key & 7);
+  }
+  return msg;
+}
+
+static kb_mgt_remote_msg_t hold_pending(uint16_t hold_pending_ms)
+{
+  return (kb_mgt_remote_msg_t){
+      .type = KB_MGT_REMOTE_HOLD_PENDING,
+      .hold_pending_ms = hold_pending_ms,
+  };
+}
+
+// Posted, not applied yet
+static void post(kb_mgt_remote_msg_t msg)
+{
+  CHECK(kb_mgt_post_remote(&msg) == ESP_OK);
+}
+
+// Posted and applied at ms
+static void deliver(uint32_t ms, kb_mgt_remote_msg_t msg)
+{
+  harness_remote(ms, &msg);
+}
+
+static void test_report_burst(void)
+{
+  harness_reset();
+  harness_start();
+  harness_run_until(1000);
+
+  // Far more key reports than the inbox holds, the last one is what counts
+  for (int i = 0; i < 4 * KB_MGT_INBOX_SIZE; i++)
+  {
+    post(report(0, i % 2 ? HID_KEY_0 : HID_KEY_1));
+  }
+  task_process();
+  CHECK(harness_saw("+1e +27 -1e"));
+
+  // Taps that came and went inside one burst are still typed
+  post(report(0, HID_KEY_2));
+  post(report(0, HID_KEY_NONE));
+  post(report(0, HID_KEY_3));
+  post(report(0, HID_KEY_NONE));
+  task_process();
+  CHECK(harness_saw("+1f +20 -27 -1f -20"));
+}
+
+static void test_order(void)
+{
+  kb_mgt_remote_msg_t brief = report(HID_MOD_LEFT_SHIFT, HID_KEY_A);
+  brief.type = KB_MGT_REMOTE_BRIEF_TAP;
+
+  // A brief tap between two reports lands between them
+  harness_reset();
+  harness_start();
+  harness_run_until(1000);
+  post(report(HID_MOD_LEFT_SHIFT, HID_KEY_NONE));
+  post(brief);
+  post(report(0, HID_KEY_NONE));
+  task_process();
+  CHECK(harness_saw("+e1 +04 -04 -e1"));
+
+  // The other half's decision is on the host before the key that waited
+  harness_reset();
+  harness_start();
+  deliver(1000, hold_pending(200));
+  harness_key(1050, X, true);
+  CHECK(harness_saw(""));
+  post(report(HID_MOD_LEFT_SHIFT, HID_KEY_NONE));
+  post(hold_pending(0));
+  task_process();
+  CHECK(harness_saw("+e1 +14"));
+
+  // Also when its next pending key replaced the decision before it applied
+  harness_reset();
+  harness_start();
+  deliver(1000, hold_pending(200));
+  harness_key(1050, X, true);
+  post(report(HID_MOD_LEFT_SHIFT, HID_KEY_NONE));
+  post(hold_pending(0));
+  post(hold_pending(200));
+  task_process();
+  CHECK(harness_saw("+e1 +14"));
+  CHECK(proc_state.remote_pending);
+}
+
+static void test_edge_burst(void)
+{
+  kb_mgt_remote_msg_t msg = {.type = KB_MGT_REMOTE_KEY_EVENT};
+
+  harness_reset();
+  harness_start();
+  harness_run_until(1000);
+
+  // Every key of the other half pressed and released fits
+  for (uint8_t i = 0; i < 2 * MAX_KEYS; i++)
+  {
+    msg.key_event = (key_event_t){
+        .row = PROC_REMOTE_ROW,
+        .col = i / 2,
+        .pressed = i % 2 == 0,
+        .timestamp = harness.now_us,
+    };
+    post(msg);
+  }
+  CHECK(kb_mgt_post_remote(&msg) == ESP_FAIL);
+  CHECK(atomic_load(&remote_overflows) == 1);
+
+  // States still get through, and the overflow is reported once
+  post(report(0, HID_KEY_1));
+  task_process();
+  CHECK(harness_saw("+1e"));
+  CHECK(atomic_load(&remote_overflows) == 0);
+  CHECK(harness.inbox_count == 0);
+}
+
+int main(void)
+{
+  test_report_burst();
+  test_order();
+  test_edge_burst();
+
+  return host_test_result();
+}
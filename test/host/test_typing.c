@@ -0,0 +1,137 @@
+/**
+ * @file test_typing.c
+ * @brief Typing cadence of the key processor
+ *
+ * A mod-tap key M pressed while typing taps at once, one pressed after a
+ * pause waits for its decision as usual. Checks the prior-idle window, the
+ * pause share of the average gap, presses from the other half and presses
+ * across a wrap of the 32-bit microsecond clock.
+ */
+
+#include "kb_mgt_harness.h"
+
+#define M 2, 2
+#define X 2, 4
+
+#define GAP_MS 40 // Typing cadence
+#define BURST  20 // Presses it takes the average to settle on GAP_MS
+
+static void start(void)
+{
+  harness_reset();
+  harness.keys[0][2][2] = MT_TO(KC_LSFT, HARNESS_KEY(M), 200);
+  harness_start();
+}
+
+// X typed BURST times at GAP_MS from `ms` on, returns the last press
+static uint32_t type_burst(uint32_t ms)
+{
+  for (int i = 0; i < BURST; i++, ms += GAP_MS)
+  {
+    harness_tap(ms, GAP_MS / 2, X);
+    CHECK(harness_saw("+14 -14"));
+  }
+  return ms - GAP_MS;
+}
+
+static void test_cadence(void)
+{
+  start();
+  CHECK(kb_mgt_typing_interval_ms() == PROC_TYPING_INTERVAL_MAX_MS);
+
+  uint32_t last = type_burst(1000);
+  CHECK(kb_mgt_typing_interval_ms() >= GAP_MS);
+  CHECK(kb_mgt_typing_interval_ms() < GAP_MS + 10);
+
+  // Keeping the cadence: a letter right away
+  harness_key(last + GAP_MS, M, true);
+  CHECK(harness_saw("+12"));
+  harness_key(last + GAP_MS + 20, M, false);
+  CHECK(harness_saw("-12"));
+
+  // Past the prior-idle window: undecided
+  start();
+  last = type_burst(1000);
+  harness_key(last + HOLD_TAP_PRIOR_IDLE_MS, M, true);
+  CHECK(harness_saw(""));
+  harness_run_until(last + HOLD_TAP_PRIOR_IDLE_MS + 200);
+  CHECK(harness_saw("+e1"));
+}
+
+static void test_pause(void)
+{
+  uint32_t pause_ms = GAP_MS * PROC_TYPING_PAUSE_PCT / 100 + 10;
+
+  // Inside the prior-idle window, but well past the cadence
+  CHECK(pause_ms < HOLD_TAP_PRIOR_IDLE_MS);
+
+  start();
+  uint32_t last = type_burst(1000);
+  harness_key(last + pause_ms, M, true);
+  CHECK(harness_saw(""));
+
+  // The same gap keeps up with a slower cadence
+  start();
+  last = 1000;
+  for (int i = 0; i < BURST; i++, last += pause_ms)
+  {
+    harness_tap(last, GAP_MS / 2, X);
+    CHECK(harness_saw("+14 -14"));
+  }
+  harness_key(last, M, true);
+  CHECK(harness_saw("+12"));
+}
+
+static void test_other_half(void)
+{
+  // A key the other half reports counts as a press of the burst
+  kb_mgt_remote_msg_t msg = {.type = KB_MGT_REMOTE_KEY_REPORT};
+  msg.key_report.keys[HID_KEY_0 >> 3] = 1U << (HID_KEY_0 & 7);
+
+  start();
+  uint32_t last = type_burst(1000);
+  harness_remote(last + GAP_MS, &msg);
+  CHECK(harness_saw("+27"));
+  harness_key(last + 2 * GAP_MS, M, true);
+  CHECK(harness_saw("+12"));
+}
+
+static void test_clock_wrap(void)
+{
+  // The clock wraps mid-burst
+  harness_reset();
+  harness.keys[0][2][2] = MT_TO(KC_LSFT, HARNESS_KEY(M), 200);
+  harness.base_us = UINT32_MAX - TIME_MS_TO_US(1000 + BURST * GAP_MS / 2);
+  harness_start();
+  uint32_t last = type_burst(1000);
+  harness_key(last + GAP_MS, M, true);
+  CHECK(harness_saw("+12"));
+
+  // A press 40 minutes later reads as before the last one in 32 bits. It is
+  // a pause, not typing.
+  start();
+  last = type_burst(1000);
+  uint32_t later = last + 40 * 60 * 1000;
+  CHECK(!time_reached(harness_at(later), harness_at(last)));
+  harness_key(later, M, true);
+  CHECK(harness_saw(""));
+  harness_run_until(later + 200);
+  CHECK(harness_saw("+e1"));
+
+  // A press that really is older is left out
+  start();
+  last = type_burst(1000);
+  uint32_t interval = kb_mgt_typing_interval_ms();
+  CHECK(proc_typing_record(harness_at(last - 5)) == 0);
+  CHECK(kb_mgt_typing_interval_ms() == interval);
+}
+
+int main(void)
+{
+  test_cadence();
+  test_pause();
+  test_other_half();
+  test_clock_wrap();
+
+  return host_test_result();
+}